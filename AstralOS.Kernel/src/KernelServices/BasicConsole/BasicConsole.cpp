@@ -2,143 +2,336 @@
 #include "../../Utils/cpu.h"
 #include "../KernelServices.h"
 
-BasicConsole::BasicConsole(FrameBuffer fb) : pFramebuffer(fb) {
-    CursorPosition.X = 10;
-    CursorPosition.Y = 10;
-    outb(0x3F8 + 1, 0x00);
-    outb(0x3F8 + 3, 0x80);
-    outb(0x3F8 + 0, 0x03);
-    outb(0x3F8 + 1, 0x00);
-    outb(0x3F8 + 3, 0x03);
-    outb(0x3F8 + 2, 0xC7);
-    outb(0x3F8 + 4, 0x0B);
-}
+/*
+ * Every glyph row is one byte, where each bit
+ * is a pixel. Instead of testing the bits one
+ * at a time while drawing, we expand every
+ * possible byte into 8 pixel masks (all ones
+ * or all zeroes) once, at compile time. Then
+ * drawing a row is just 8 and/or's and stores,
+ * with no branches.
+ *
+ * It's per byte value instead of per glyph, so
+ * it's only 8KB instead of 128KB, and glyphs
+ * share rows a lot anyway.
+*/
+struct GlyphRowMasks {
+    uint32_t masks[256][8];
+
+    constexpr GlyphRowMasks() : masks() {
+        for (unsigned int bits = 0; bits < 256; bits++) {
+            for (unsigned int x = 0; x < 8; x++) {
+                masks[bits][x] = (bits & (0x80 >> x)) ? 0xFFFFFFFF : 0;
+            }
+        }
+    }
+};
 
-int is_transmit_empty() {
-    return inb(0x3F8 + 5) & 0x20;
+static constexpr GlyphRowMasks RowMasks;
+
+BasicConsole::BasicConsole(FrameBuffer fb, SerialPort* serial) : pFramebuffer(fb), serial(serial) {
+    CursorPosition.X = 0;
+    CursorPosition.Y = 0;
+    if (fb.Width > Margin * 2 && fb.Height > Margin * 2) {
+        Columns = (fb.Width - Margin * 2) / GlyphWidth;
+        Rows = (fb.Height - Margin * 2) / GlyphHeight;
+    }
 }
 
-void serial_write_char(char a) {
-    while (is_transmit_empty() == 0);
-    outb(0x3F8, a);
+/*
+ * Gives back where the top left pixel of a cell
+ * is, and how many pixels there are per line,
+ * in whatever we are drawing into right now.
+*/
+uint32_t* BasicConsole::CellAddress(unsigned int col, unsigned int row, uint32_t& pitch) {
+    if (shadowEnabled) {
+        unsigned int ringRow = (firstRow + row) % Rows;
+        pitch = shadowPitch;
+        return shadow + (size_t)ringRow * GlyphHeight * shadowPitch + col * GlyphWidth;
+    }
+
+    pitch = pFramebuffer.PixelsPerScanLine;
+    return (uint32_t*)pFramebuffer.BaseAddress + (size_t)(Margin + row * GlyphHeight) * pitch + Margin + col * GlyphWidth;
 }
 
-void serial_write(const char* str) {
-    while (*str) {
-        if (*str == '\n')
-            serial_write_char('\r'); // so newlines look right
-        serial_write_char(*str++);
+void BasicConsole::MarkDirty(unsigned int row, unsigned int start, unsigned int end) {
+    DirtySpan& span = dirty[row];
+    if (span.end == 0) {
+        span.start = start;
+        span.end = end;
+        return;
+    }
+    if (start < span.start) {
+        span.start = start;
+    }
+    if (end > span.end) {
+        span.end = end;
     }
 }
 
-void BasicConsole::putChar(unsigned int colour, char chr, unsigned int xOff, unsigned int yOff) {
-    unsigned int* pixPtr = (unsigned int*)pFramebuffer.BaseAddress;
+void BasicConsole::MarkAllDirty() {
+    for (unsigned int row = 0; row < Rows; row++) {
+        dirty[row].start = 0;
+        dirty[row].end = Columns;
+    }
+}
 
-    // Check if the character is within the font range
-    if (chr < 0 || chr >= 256) return;  // Assuming 256 characters for simplicity
+/*
+ * Draws a whole cell, background included, so
+ * we never have to clear a cell before drawing
+ * over it. The grid always fits inside the
+ * framebuffer, so we don't need to check every
+ * pixel like we used to.
+*/
+void BasicConsole::putChar(unsigned int colour, char chr, unsigned int col, unsigned int row) {
+    if (col >= Columns || row >= Rows) {
+        return;
+    }
 
-    const uint8_t* fontPtr = font + (chr * 16);  // Each character takes 16 bytes (8 rows)
+    uint32_t pitch;
+    uint32_t* dst = CellAddress(col, row, pitch);
+    const uint8_t* glyph = font + (uint8_t)chr * GlyphHeight;
+    uint32_t background = 0;
 
-    for (unsigned long y = 0; y < 16; y++) { // Iterate over 16 rows
-        for (unsigned long x = 0; x < 8; x++) { // Iterate over 8 columns
-            // Check if the bit is set
-            if (fontPtr[y] & (0b10000000 >> x)) {
-                // Calculate pixel position in framebuffer
-                unsigned long pixelIndex = (x + xOff) + ((y + yOff) * pFramebuffer.PixelsPerScanLine);
-                if (pixelIndex < (pFramebuffer.Width * pFramebuffer.Height)) { // Ensure we don't write out of bounds
-                    pixPtr[pixelIndex] = colour; // Write the pixel colour
-                }
-            }
+    for (unsigned int y = 0; y < GlyphHeight; y++) {
+        const uint32_t* mask = RowMasks.masks[glyph[y]];
+        for (unsigned int x = 0; x < GlyphWidth; x++) {
+            dst[x] = (colour & mask[x]) | (background & ~mask[x]);
         }
+        dst += pitch;
+    }
+
+    if (shadowEnabled) {
+        MarkDirty(row, col, col + 1);
     }
 }
 
-void BasicConsole::Print(const char* str, unsigned int colour) {
-    const char* chr = str;
-    serial_write(chr);
-    while (*chr != 0) {
-        if (*chr == '\n') {
-            CursorPosition.X = 10;           // Reset X position for new line
-            CursorPosition.Y += 16;         // Move cursor down by 16 pixels
+/*
+ * Moves every text row up by one and clears
+ * the last one.
+ *
+ * With the shadow buffer, the old top row just
+ * becomes the new bottom row. Without it, we
+ * have to memmove the whole framebuffer.
+*/
+void BasicConsole::Scroll() {
+    if (Rows == 0) {
+        return;
+    }
+
+    if (shadowEnabled) {
+        size_t rowPixels = (size_t)GlyphHeight * shadowPitch;
+        memset(shadow + firstRow * rowPixels, 0, rowPixels * sizeof(uint32_t));
+        firstRow = (firstRow + 1) % Rows;
+        MarkAllDirty();
+        return;
+    }
+
+    uint32_t pitch = pFramebuffer.PixelsPerScanLine;
+    uint32_t* top = (uint32_t*)pFramebuffer.BaseAddress + Margin * pitch;
+    size_t rowPixels = (size_t)GlyphHeight * pitch;
+
+    memmove(top, top + rowPixels, (Rows - 1) * rowPixels * sizeof(uint32_t));
+    memset(top + (Rows - 1) * rowPixels, 0, rowPixels * sizeof(uint32_t));
+}
+
+/*
+ * Copies everything that changed since the last
+ * Flush from the shadow buffer to the screen.
+ *
+ * The framebuffer is usually uncached or write
+ * combining, so we want to write it in big
+ * chunks and never read from it. memcpy uses
+ * rep movs, which does exactly that.
+*/
+void BasicConsole::Flush() {
+    if (!shadowEnabled || flushing) {
+        return;
+    }
+    flushing = true;
+
+    uint32_t fbPitch = pFramebuffer.PixelsPerScanLine;
+    for (unsigned int row = 0; row < Rows; row++) {
+        DirtySpan span = dirty[row];
+        if (span.end == 0) {
+            continue;
         }
-        else {
-            putChar(colour, *chr, CursorPosition.X, CursorPosition.Y);
-            CursorPosition.X += 8;          // Move cursor right by 8 pixels for the next character
-            if (CursorPosition.X + 10 > pFramebuffer.Width) {
-                CursorPosition.X = 10;       // Reset X position
-                CursorPosition.Y += 16;     // Move cursor down by 16 pixels for a new line
-            }
+        dirty[row].end = 0;
+
+        uint32_t pitch;
+        const uint32_t* src = CellAddress(span.start, row, pitch);
+        uint32_t* dst = (uint32_t*)pFramebuffer.BaseAddress + (size_t)(Margin + row * GlyphHeight) * fbPitch + Margin + span.start * GlyphWidth;
+        size_t bytes = (size_t)(span.end - span.start) * GlyphWidth * sizeof(uint32_t);
+
+        for (unsigned int y = 0; y < GlyphHeight; y++) {
+            memcpy(dst, src, bytes);
+            src += pitch;
+            dst += fbPitch;
         }
-        chr++;
     }
+
+    flushing = false;
 }
 
-void BasicConsole::Println(const char* str, unsigned int colour) {
-    const char* chr = str;
-    serial_write(chr);
-    serial_write("\n");
-    while (*chr != 0) {
+/*
+ * Gets called from the timer interrupt, so
+ * text that doesn't end with a newline (like
+ * a prompt) still shows up. We skip it if we
+ * interrupted a Print, since the shadow buffer
+ * might be half drawn.
+*/
+void BasicConsole::Tick() {
+    if (!drawing) {
+        Flush();
+    }
+}
+
+/*
+ * Needs the heap, so this gets called once the
+ * heap is up. Whatever is on the screen right
+ * now gets copied in, so nothing is lost.
+*/
+bool BasicConsole::EnableShadowBuffer() {
+    if (shadowEnabled || Rows == 0) {
+        return shadowEnabled;
+    }
+
+    if (!shadow) {
+        shadowPitch = Columns * GlyphWidth;
+        shadow = (uint32_t*)malloc((size_t)Rows * GlyphHeight * shadowPitch * sizeof(uint32_t));
+        dirty = (DirtySpan*)malloc(Rows * sizeof(DirtySpan));
+        if (!shadow || !dirty) {
+            free(shadow);
+            free(dirty);
+            shadow = nullptr;
+            dirty = nullptr;
+            return false;
+        }
+    }
+
+    firstRow = 0;
+    uint32_t fbPitch = pFramebuffer.PixelsPerScanLine;
+    const uint32_t* src = (uint32_t*)pFramebuffer.BaseAddress + (size_t)Margin * fbPitch + Margin;
+    uint32_t* dst = shadow;
+    for (unsigned int y = 0; y < Rows * GlyphHeight; y++) {
+        memcpy(dst, src, shadowPitch * sizeof(uint32_t));
+        src += fbPitch;
+        dst += shadowPitch;
+    }
+
+    for (unsigned int row = 0; row < Rows; row++) {
+        dirty[row].end = 0;
+    }
+    shadowEnabled = true;
+    return true;
+}
+
+/*
+ * Goes back to drawing straight into the
+ * framebuffer. We keep the buffer around in
+ * case it gets turned back on.
+*/
+void BasicConsole::DisableShadowBuffer() {
+    Flush();
+    shadowEnabled = false;
+}
+
+void BasicConsole::NewLine() {
+    CursorPosition.X = 0;
+    CursorPosition.Y++;
+    if (CursorPosition.Y >= Rows) {
+        Scroll();
+        CursorPosition.Y = Rows ? Rows - 1 : 0;
+    }
+    Flush();
+}
+
+void BasicConsole::Print(const char* str, unsigned int colour) {
+    serial->Write(str);
+    Draw(str, colour);
+}
+
+/*
+ * Puts the text on the screen without sending
+ * it to serial. The kernel log uses this, since
+ * it decides on its own what goes to serial.
+ *
+ * We only wrap right before drawing a char that
+ * wouldn't fit, so a line that is exactly as
+ * wide as the screen followed by a \n doesn't
+ * leave an empty line behind.
+*/
+void BasicConsole::Draw(const char* str, unsigned int colour) {
+    bool wasDrawing = drawing;
+    drawing = true;
+    for (const char* chr = str; *chr != 0; chr++) {
         if (*chr == '\n') {
-            CursorPosition.X = 10;           // Reset X position for new line
-            CursorPosition.Y += 16;         // Move cursor down by 16 pixels
+            NewLine();
+            continue;
         }
-        else {
-            putChar(colour, *chr, CursorPosition.X, CursorPosition.Y);
-            CursorPosition.X += 8;          // Move cursor right by 8 pixels for the next character
-            if (CursorPosition.X + 10 > pFramebuffer.Width) {
-                CursorPosition.X = 10;       // Reset X position
-                CursorPosition.Y += 16;     // Move cursor down by 16 pixels for a new line
-            }
+
+        if (CursorPosition.X >= Columns) {
+            NewLine();
         }
-        chr++;
+        putChar(colour, *chr, CursorPosition.X, CursorPosition.Y);
+        CursorPosition.X++;
     }
+    drawing = wasDrawing;
+}
 
-    CursorPosition.X = 10;           // Reset X position for new line
-    CursorPosition.Y += 16;         // Move cursor down by 16 pixels
+void BasicConsole::Println(const char* str, unsigned int colour) {
+    Print(str, colour);
+    serial->Write("\n", 1);
+    bool wasDrawing = drawing;
+    drawing = true;
+    NewLine();
+    drawing = wasDrawing;
 }
 
+/*
+ * Clears the first `lineCount` text rows (and
+ * the margin above them).
+*/
 void BasicConsole::ClearLines(unsigned int lineCount) {
-    unsigned int fontHeight = 16; // or whatever your font height is
-    unsigned int clearHeight = fontHeight * lineCount;
+    if (lineCount > Rows) {
+        lineCount = Rows;
+    }
 
-    for (unsigned int y = 0; y < clearHeight; y++) {
-        for (unsigned int x = 0; x < pFramebuffer.Width; x++) {
-            ((uint32_t*)pFramebuffer.BaseAddress)[y * pFramebuffer.PixelsPerScanLine + x] = 0x000000;
+    uint32_t pitch = pFramebuffer.PixelsPerScanLine;
+    size_t pixels = (size_t)(Margin + lineCount * GlyphHeight) * pitch;
+    memset(pFramebuffer.BaseAddress, 0, pixels * sizeof(uint32_t));
+
+    if (shadowEnabled) {
+        for (unsigned int row = 0; row < lineCount; row++) {
+            uint32_t rowPitch;
+            memset(CellAddress(0, row, rowPitch), 0, (size_t)GlyphHeight * shadowPitch * sizeof(uint32_t));
+            dirty[row].end = 0;
         }
     }
 }
 
+/*
+ * Blocks (with hlt) until the user presses
+ * enter, and gives back what they typed.
+*/
 char* BasicConsole::Input() {
-    inputActive = true;
-    finished = false;
-    input = strdup("");
-    while (!finished);
-    inputActive = false;
-    return input;
-}
-void BasicConsole::FinishInput() {
-    finished = true;
-}
-void BasicConsole::SubmitText(char* text) {
-    if (inputActive) {
-        char* oldInp = input;
-
-        input = (char*)malloc(strlen(oldInp) + strlen(text) + 1);
-        if (oldInp) {
-            memcpy(input, oldInp, strlen(oldInp));
-            free(oldInp);
-        }
-        memcpy(input + strlen(oldInp), text, strlen(text));
-        input[strlen(oldInp) + strlen(text)] = 0;
-    }
+    Flush();
+    return ks->keyboard.ReadLine();
 }
+
+/*
+ * Erases the cell before the cursor, going back
+ * to the end of the previous row if we have to.
+*/
 void BasicConsole::Backspace() {
-    if (inputActive) {
-        size_t len = strlen(input);
-        char ol = input[len - 1];
-        if (len == 0) return;
-        input[len - 1] = '\0';
-        CursorPosition.X -= 8;
-        putChar(0, ol, CursorPosition.X, CursorPosition.Y);
-    }
-}
\ No newline at end of file
+    if (CursorPosition.X > 0) {
+        CursorPosition.X--;
+    } else if (CursorPosition.Y > 0) {
+        CursorPosition.Y--;
+        CursorPosition.X = Columns - 1;
+    } else {
+        return;
+    }
+    putChar(0, ' ', CursorPosition.X, CursorPosition.Y);
+    Flush();
+}
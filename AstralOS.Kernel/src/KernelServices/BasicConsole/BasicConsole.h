@@ -2,6 +2,7 @@
 #include <stddef.h>
 #include <cstdint>
 #include "font.h"
+#include "../Serial/Serial.h"
 
 /*
 * Originally Found in https://github.com/Absurdponcho/PonchoOS/blob/Episode-3-Graphics-Output-Protocol/kernel/src/kernel.c
@@ -19,25 +20,67 @@ typedef struct {
 	unsigned int Y;
 } Point;
 
+/*
+ * The console is a grid of 8x16 cells. The
+ * cursor is in cells (not pixels), and when
+ * it falls off the bottom we scroll instead
+ * of drawing off the end of the screen.
+ *
+ * Once the heap is up, we draw into a shadow
+ * buffer in normal RAM instead of straight
+ * into the framebuffer, and only copy the
+ * parts that changed over (see Flush).
+*/
 class BasicConsole {
 public:
-	BasicConsole(FrameBuffer fb);
+	BasicConsole(FrameBuffer fb, SerialPort* serial);
 
 	void Print(const char* str, unsigned int colour = 0xffffffff);
 	void Println(const char* str, unsigned int colour = 0xffffffff);
+	void Draw(const char* str, unsigned int colour = 0xffffffff);
 	char* Input();
-	void FinishInput();
-	void SubmitText(char* text);
 	void Backspace();
+
+	bool EnableShadowBuffer();
+	void DisableShadowBuffer();
+	void Flush();
+	void Tick();
 	Point CursorPosition;
-	bool shift = false;
 public:
-	void putChar(unsigned int colour, char chr, unsigned int xOff, unsigned int yOff);
+	static constexpr unsigned int GlyphWidth = 8;
+	static constexpr unsigned int GlyphHeight = 16;
+	static constexpr unsigned int Margin = 10;
+
+	void putChar(unsigned int colour, char chr, unsigned int col, unsigned int row);
 	void ClearLines(unsigned int lineCount);
+	void NewLine();
+	void Scroll();
+	uint32_t* CellAddress(unsigned int col, unsigned int row, uint32_t& pitch);
+	void MarkDirty(unsigned int row, unsigned int start, unsigned int end);
+	void MarkAllDirty();
 
 	FrameBuffer pFramebuffer;
-	bool finished = false;
-	char* input = nullptr;
-	bool inputActive = false;
-};
+	SerialPort* serial;
+	unsigned int Columns = 0;
+	unsigned int Rows = 0;
+
+	/*
+	 * The shadow buffer is a ring of text rows,
+	 * so scrolling just moves firstRow instead
+	 * of copying the whole screen. Each row
+	 * remembers which columns changed since the
+	 * last Flush (end == 0 means nothing did).
+	*/
+	struct DirtySpan {
+		unsigned int start;
+		unsigned int end;
+	};
 
+	uint32_t* shadow = nullptr;
+	DirtySpan* dirty = nullptr;
+	bool shadowEnabled = false;
+	unsigned int shadowPitch = 0;
+	unsigned int firstRow = 0;
+	volatile bool drawing = false;
+	volatile bool flushing = false;
+};
@@ -0,0 +1,485 @@
+#include "BufferCache.h"
+#include "../KernelServices.h"
+#include "../../Utils/kprintf/kprintf.h"
+
+#define HIGHER_VIRT_ADDR 0xFFFFFFFF00000000
+
+/*
+ * Like the IRQ tables, these live out here
+ * since KernelServices starts out on a small
+ * stack.
+*/
+static BlockBuffer BufferPool[BCACHE_BUFFERS];
+static BlockBuffer* BufferHash[BCACHE_HASH_SIZE];
+static ReadaheadIO ReadaheadSlots[BCACHE_RA_SLOTS];
+static BlockBuffer* SyncList[BCACHE_BUFFERS];
+static BlockRequest SyncRequests[BCACHE_SYNC_BATCH];
+static DMASegment SyncSegs[BCACHE_SYNC_BATCH];
+static bool SyncSubmitted[BCACHE_SYNC_BATCH];
+
+static size_t HashOf(PartitionDevice* dev, uint64_t block) {
+    uint64_t h = ((uint64_t)dev >> 4) ^ (block * 0x9E3779B97F4A7C15ull);
+    return (h >> 32) % BCACHE_HASH_SIZE;
+}
+
+void BufferCache::HashInsert(BlockBuffer* buf) {
+    size_t h = HashOf(buf->dev, buf->block);
+    buf->hashNext = BufferHash[h];
+    BufferHash[h] = buf;
+}
+
+void BufferCache::HashRemove(BlockBuffer* buf) {
+    BlockBuffer** link = &BufferHash[HashOf(buf->dev, buf->block)];
+    while (*link) {
+        if (*link == buf) {
+            *link = buf->hashNext;
+            buf->hashNext = nullptr;
+            return;
+        }
+        link = &(*link)->hashNext;
+    }
+}
+
+/*
+ * Moves buf to the tail of the LRU list,
+ * adding it if it isn't on there yet.
+*/
+void BufferCache::Touch(BlockBuffer* buf) {
+    if (buf == lruTail) {
+        return;
+    }
+
+    if (buf->lruPrev || buf == lruHead) {
+        if (buf->lruPrev) {
+            buf->lruPrev->lruNext = buf->lruNext;
+        } else {
+            lruHead = buf->lruNext;
+        }
+        buf->lruNext->lruPrev = buf->lruPrev;
+    }
+
+    buf->lruPrev = lruTail;
+    buf->lruNext = nullptr;
+    if (lruTail) {
+        lruTail->lruNext = buf;
+    } else {
+        lruHead = buf;
+    }
+    lruTail = buf;
+}
+
+BlockBuffer* BufferCache::Lookup(PartitionDevice* dev, uint64_t block, uint32_t size) {
+    for (BlockBuffer* buf = BufferHash[HashOf(dev, block)]; buf; buf = buf->hashNext) {
+        if (buf->dev == dev && buf->block == block && buf->size == size) {
+            return buf;
+        }
+    }
+    return nullptr;
+}
+
+bool BufferCache::WriteBack(BlockBuffer* buf) {
+    uint32_t sectors = buf->size / buf->dev->SectorSize();
+    if (!ks->iosched.Transfer(buf->dev, buf->block * sectors, sectors, (void*)buf->phys, true)) {
+        klog(LOG_ERROR, "bcache: failed to write back block %lu of %s", buf->block, buf->dev->name());
+        return false;
+    }
+
+    buf->dirty = false;
+    stats.writebacks++;
+    return true;
+}
+
+/*
+ * Hands out an unused buffer from the pool
+ * while there still are some, and after that
+ * the least recently used one that nobody
+ * holds. If that one is dirty and won't write
+ * back, we leave it alone and try the next.
+*/
+BlockBuffer* BufferCache::Evict() {
+    if (used < BCACHE_BUFFERS) {
+        return &BufferPool[used++];
+    }
+
+    for (BlockBuffer* buf = lruHead; buf; buf = buf->lruNext) {
+        if (buf->refs || buf->io) {
+            continue;
+        }
+        if (buf->dirty && !WriteBack(buf)) {
+            continue;
+        }
+
+        HashRemove(buf);
+        buf->dev = nullptr;
+        buf->valid = false;
+        stats.evictions++;
+        return buf;
+    }
+
+    return nullptr;
+}
+
+/*
+ * Gives buf enough contiguous pages for
+ * `size` bytes, keeping the ones it has if
+ * they are the right amount already.
+*/
+bool BufferCache::SetSize(BlockBuffer* buf, uint32_t size) {
+    uint64_t pages = (size + 4095) / 4096;
+    buf->size = size;
+    if (buf->pages == pages) {
+        return true;
+    }
+
+    if (buf->pages) {
+        for (uint64_t i = 0; i < buf->pages; i++) {
+            ks->pageTableManager.UnmapMemory(buf->data + i * 4096);
+        }
+        ks->pageFrameAllocator.FreePages((void*)buf->phys, buf->pages);
+        buf->pages = 0;
+    }
+
+    buf->phys = (uint64_t)ks->pageFrameAllocator.RequestPages(pages);
+    if (!buf->phys) {
+        return false;
+    }
+    buf->pages = pages;
+
+    /*
+     * x86 keeps DMA coherent with the caches,
+     * so this can be mapped cached.
+    */
+    buf->data = (uint8_t*)(HIGHER_VIRT_ADDR + buf->phys);
+    for (uint64_t i = 0; i < pages; i++) {
+        ks->pageTableManager.MapMemory(buf->data + i * 4096, (void*)(buf->phys + i * 4096), true);
+    }
+    return true;
+}
+
+/*
+ * Takes a buffer for (dev, block) and puts it
+ * in the hash, but nobody holds it yet and
+ * there's nothing in it.
+*/
+BlockBuffer* BufferCache::Claim(PartitionDevice* dev, uint64_t block, uint32_t size) {
+    BlockBuffer* buf = Evict();
+    if (!buf) {
+        klog(LOG_ERROR, "bcache: every buffer is in use");
+        return nullptr;
+    }
+
+    if (!SetSize(buf, size)) {
+        klog(LOG_ERROR, "bcache: out of memory for a %u byte block", size);
+        buf->size = 0;
+        Touch(buf);
+        return nullptr;
+    }
+
+    buf->dev = dev;
+    buf->block = block;
+    buf->refs = 0;
+    buf->valid = false;
+    buf->dirty = false;
+    buf->io = nullptr;
+    HashInsert(buf);
+    Touch(buf);
+    return buf;
+}
+
+/*
+ * Takes buf back out of the hash after a read
+ * that didn't work, so the next Get starts
+ * over with it.
+*/
+void BufferCache::Drop(BlockBuffer* buf) {
+    HashRemove(buf);
+    buf->dev = nullptr;
+    buf->valid = false;
+}
+
+/*
+ * Blocks until the readahead that buf is part
+ * of has finished. The completion has run by
+ * the time Wait returns, so `io` and `valid`
+ * are up to date after this.
+*/
+void BufferCache::WaitIO(BlockBuffer* buf) {
+    ReadaheadIO* io = (ReadaheadIO*)buf->io;
+    if (io) {
+        ks->iosched.Wait(buf->dev, &io->req);
+    }
+}
+
+BlockBuffer* BufferCache::Get(PartitionDevice* dev, uint64_t block, uint32_t size) {
+    uint32_t sectorSize = dev->SectorSize();
+    if (size == 0 || sectorSize == 0 || size % sectorSize) {
+        return nullptr;
+    }
+
+    BlockBuffer* buf = Lookup(dev, block, size);
+    if (buf) {
+        WaitIO(buf);
+        buf->refs++;
+        Touch(buf);
+        stats.hits++;
+        return buf;
+    }
+
+    buf = Claim(dev, block, size);
+    if (!buf) {
+        return nullptr;
+    }
+
+    buf->refs = 1;
+    stats.misses++;
+    return buf;
+}
+
+BlockBuffer* BufferCache::Read(PartitionDevice* dev, uint64_t block, uint32_t size) {
+    BlockBuffer* buf = Get(dev, block, size);
+    if (!buf || buf->valid) {
+        return buf;
+    }
+
+    uint32_t sectors = size / dev->SectorSize();
+    if (!ks->iosched.Transfer(dev, block * sectors, sectors, (void*)buf->phys, false)) {
+        klog(LOG_ERROR, "bcache: failed to read block %lu of %s", block, dev->name());
+        buf->refs--;
+        if (!buf->refs) {
+            Drop(buf);
+        }
+        return nullptr;
+    }
+
+    buf->valid = true;
+    return buf;
+}
+
+void BufferCache::MarkDirty(BlockBuffer* buf) {
+    buf->valid = true;
+    buf->dirty = true;
+}
+
+void BufferCache::Release(BlockBuffer* buf) {
+    if (buf && buf->refs) {
+        buf->refs--;
+    }
+}
+
+/*
+ * Called by the controller when a readahead
+ * request finishes, which can be from an IRQ
+ * handler, so this only flips flags. Whoever
+ * wanted the blocks picks them up in Get.
+*/
+static void ReadaheadDone(BlockRequest* req) {
+    ReadaheadIO* io = (ReadaheadIO*)req->ctx;
+    bool ok = req->status == BLOCK_OK;
+    for (uint32_t i = 0; i < io->count; i++) {
+        io->bufs[i]->valid = ok;
+        io->bufs[i]->io = nullptr;
+    }
+    io->busy = false;
+}
+
+static ReadaheadIO* FreeReadaheadSlot() {
+    for (size_t i = 0; i < BCACHE_RA_SLOTS; i++) {
+        if (!ReadaheadSlots[i].busy) {
+            return &ReadaheadSlots[i];
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * Starts reading blocks [block, block + count)
+ * of dev into the cache and returns without
+ * waiting. Blocks that are cached already are
+ * skipped, and every run of ones that aren't
+ * goes out as one request, with one segment
+ * per buffer.
+ *
+ * This is only a hint, so if we run out of
+ * slots or buffers we just stop early. It
+ * returns false if nothing could be started.
+*/
+bool BufferCache::ReadAhead(PartitionDevice* dev, uint64_t block, uint32_t count, uint32_t size) {
+    uint32_t sectorSize = dev->SectorSize();
+    if (size == 0 || sectorSize == 0 || size % sectorSize) {
+        return false;
+    }
+    uint32_t spb = size / sectorSize;
+
+    /*
+     * Plugged, so all the runs get sorted
+     * before any of them go out.
+    */
+    ks->iosched.Plug(dev);
+
+    bool started = false;
+    uint64_t end = block + count;
+    while (block < end) {
+        if (Lookup(dev, block, size)) {
+            block++;
+            continue;
+        }
+
+        ReadaheadIO* io = FreeReadaheadSlot();
+        if (!io) {
+            break;
+        }
+
+        io->count = 0;
+        while (block < end && io->count < BCACHE_RA_BLOCKS && !Lookup(dev, block, size)) {
+            BlockBuffer* buf = Claim(dev, block, size);
+            if (!buf) {
+                break;
+            }
+
+            buf->io = io;
+            io->bufs[io->count] = buf;
+            io->segs[io->count].phys = buf->phys;
+            io->segs[io->count].size = size;
+            io->count++;
+            block++;
+        }
+
+        if (!io->count) {
+            break;
+        }
+
+        io->req.lba = io->bufs[0]->block * spb;
+        io->req.count = io->count * spb;
+        io->req.segs = io->segs;
+        io->req.segCount = io->count;
+        io->req.write = false;
+        io->req.done = ReadaheadDone;
+        io->req.ctx = io;
+        io->busy = true;
+
+        if (!ks->iosched.Submit(dev, &io->req)) {
+            for (uint32_t i = 0; i < io->count; i++) {
+                io->bufs[i]->io = nullptr;
+                Drop(io->bufs[i]);
+            }
+            io->busy = false;
+            break;
+        }
+
+        stats.readahead += io->count;
+        started = true;
+    }
+
+    ks->iosched.Unplug(dev);
+    return started;
+}
+
+/*
+ * Writes back every dirty buffer of dev, in
+ * block order so the disk mostly gets to go
+ * forwards.
+*/
+bool BufferCache::Sync(PartitionDevice* dev) {
+    size_t count = 0;
+    for (size_t i = 0; i < used; i++) {
+        BlockBuffer* buf = &BufferPool[i];
+        if (buf->dirty && (!dev || buf->dev == dev)) {
+            SyncList[count++] = &BufferPool[i];
+        }
+    }
+
+    /*
+     * Insertion sort, there usually aren't
+     * many dirty buffers and they mostly come
+     * out of the pool in order anyway.
+    */
+    for (size_t i = 1; i < count; i++) {
+        BlockBuffer* buf = SyncList[i];
+        size_t j = i;
+        while (j > 0 && (SyncList[j - 1]->dev > buf->dev || (SyncList[j - 1]->dev == buf->dev && SyncList[j - 1]->block > buf->block))) {
+            SyncList[j] = SyncList[j - 1];
+            j--;
+        }
+        SyncList[j] = buf;
+    }
+
+    /*
+     * Each batch goes to the I/O scheduler
+     * plugged, so runs of blocks next to each
+     * other get merged into one write.
+    */
+    bool ok = true;
+    for (size_t base = 0; base < count; base += BCACHE_SYNC_BATCH) {
+        size_t batch = count - base;
+        if (batch > BCACHE_SYNC_BATCH) batch = BCACHE_SYNC_BATCH;
+
+        for (size_t i = 0; i < batch; i++) {
+            BlockBuffer* buf = SyncList[base + i];
+            PartitionDevice* bdev = buf->dev;
+            uint32_t sectors = buf->size / bdev->SectorSize();
+
+            SyncSegs[i].phys = buf->phys;
+            SyncSegs[i].size = buf->size;
+
+            BlockRequest* req = &SyncRequests[i];
+            req->lba = buf->block * sectors;
+            req->count = sectors;
+            req->segs = &SyncSegs[i];
+            req->segCount = 1;
+            req->write = true;
+            req->done = nullptr;
+            req->ctx = nullptr;
+            req->status = BLOCK_PENDING;
+
+            if (i == 0 || SyncList[base + i - 1]->dev != bdev) {
+                if (i) {
+                    ks->iosched.Unplug(SyncList[base + i - 1]->dev);
+                }
+                ks->iosched.Plug(bdev);
+            }
+            SyncSubmitted[i] = ks->iosched.Submit(bdev, req);
+        }
+        ks->iosched.Unplug(SyncList[base + batch - 1]->dev);
+
+        for (size_t i = 0; i < batch; i++) {
+            BlockBuffer* buf = SyncList[base + i];
+            if (SyncSubmitted[i] && ks->iosched.Wait(buf->dev, &SyncRequests[i])) {
+                buf->dirty = false;
+                stats.writebacks++;
+            } else {
+                /*
+                 * It stays dirty (whether it never
+                 * got submitted or the write failed),
+                 * so the next sync (or Evict) tries
+                 * it again instead of us quietly
+                 * losing the data.
+                */
+                klog(LOG_ERROR, "bcache: failed to write back block %lu of %s", buf->block, buf->dev->name());
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+/*
+ * For the `bcache` command.
+*/
+void BufferCache::DumpStats() {
+    size_t dirty = 0;
+    size_t held = 0;
+    size_t inFlight = 0;
+    for (size_t i = 0; i < used; i++) {
+        dirty += BufferPool[i].dirty;
+        held += BufferPool[i].refs != 0;
+        inFlight += BufferPool[i].io != nullptr;
+    }
+
+    uint64_t lookups = stats.hits + stats.misses;
+    uint64_t hitRate = lookups ? stats.hits * 100 / lookups : 0;
+
+    kprintf("Buffers: %zu/%u used, %zu dirty, %zu held\n", used, BCACHE_BUFFERS, dirty, held);
+    kprintf("Hits: %lu  Misses: %lu  (%lu%% hit rate)\n", stats.hits, stats.misses, hitRate);
+    kprintf("Evictions: %lu  Writebacks: %lu\n", stats.evictions, stats.writebacks);
+    kprintf("Readahead: %lu blocks, %zu in flight\n", stats.readahead, inFlight);
+}
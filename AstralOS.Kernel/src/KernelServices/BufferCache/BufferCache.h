@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "../DriverManager/DriverManager.h"
+
+/*
+ * BCACHE_BUFFERS is how many blocks we keep
+ * around (8MB with 4KB blocks), and the hash
+ * table has BCACHE_HASH_SIZE chains.
+ *
+ * Readahead goes out as up to BCACHE_RA_SLOTS
+ * requests at once, each one covering at most
+ * BCACHE_RA_BLOCKS blocks, so there's never
+ * more than half the cache in flight.
+*/
+#define BCACHE_BUFFERS      2048
+#define BCACHE_HASH_SIZE    1024
+#define BCACHE_RA_SLOTS     16
+#define BCACHE_RA_BLOCKS    64
+
+/*
+ * Sync sends this many writes to the I/O
+ * scheduler at a time, and waits for them
+ * before the next lot.
+*/
+#define BCACHE_SYNC_BATCH   256
+
+struct BufferCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+    uint64_t readahead;
+};
+
+/*
+ * One readahead request. The segments point
+ * straight at the buffers' pages, so the
+ * controller reads every block into its own
+ * buffer with one command.
+*/
+struct ReadaheadIO {
+    BlockRequest req;
+    DMASegment segs[BCACHE_RA_BLOCKS];
+    BlockBuffer* bufs[BCACHE_RA_BLOCKS];
+    uint32_t count;
+    volatile bool busy;
+};
+
+/*
+ * The buffer cache sits between filesystems
+ * and PartitionDevice, so metadata that gets
+ * read over and over (inodes, group descs,
+ * bitmaps, directories) only comes off the
+ * disk once.
+ *
+ * Buffers are found through a hash of
+ * (device, block), and all of them sit on an
+ * LRU list, most recently used at the tail.
+ * When we need a new one we take the oldest
+ * buffer nobody holds a reference to, and
+ * write it back first if it's dirty.
+ *
+ * The buffers come out of a fixed pool, and
+ * each one gets its own physically contiguous
+ * pages, so the disk can DMA straight into
+ * it. All of the I/O goes through the I/O
+ * scheduler, so writebacks of blocks next to
+ * each other go out as one request.
+ *
+ * ReadAhead claims buffers for blocks that
+ * aren't cached yet and Submits one request
+ * for a whole run of them. Until it finishes,
+ * the buffers sit in the hash with `io` set,
+ * so nobody evicts them, and anyone who wants
+ * one of them waits for that request.
+ *
+ * We only run one thread for now, so there is
+ * no locking in here.
+*/
+class BufferCache {
+public:
+    BlockBuffer* Read(PartitionDevice* dev, uint64_t block, uint32_t size);
+    BlockBuffer* Get(PartitionDevice* dev, uint64_t block, uint32_t size);
+    void MarkDirty(BlockBuffer* buf);
+    void Release(BlockBuffer* buf);
+    bool Sync(PartitionDevice* dev);
+    bool ReadAhead(PartitionDevice* dev, uint64_t block, uint32_t count, uint32_t size);
+
+    const BufferCacheStats& Stats() const { return stats; }
+    void DumpStats();
+private:
+    BlockBuffer* Lookup(PartitionDevice* dev, uint64_t block, uint32_t size);
+    BlockBuffer* Claim(PartitionDevice* dev, uint64_t block, uint32_t size);
+    void WaitIO(BlockBuffer* buf);
+    void Drop(BlockBuffer* buf);
+    BlockBuffer* Evict();
+    bool SetSize(BlockBuffer* buf, uint32_t size);
+    bool WriteBack(BlockBuffer* buf);
+
+    void HashInsert(BlockBuffer* buf);
+    void HashRemove(BlockBuffer* buf);
+    void Touch(BlockBuffer* buf);
+
+    BlockBuffer* lruHead = nullptr;
+    BlockBuffer* lruTail = nullptr;
+    size_t used = 0;
+    BufferCacheStats stats = {};
+};
@@ -1,6 +1,7 @@
 #define KERNEL
 #include "DriverManager.h"
 #include "../KernelServices.h"
+#include "../../Utils/kprintf/kprintf.h"
 
 /*
  * Ok, here is a quick exp of how this all works.
@@ -170,6 +171,15 @@ void DriverManager::CreateDriverServices() {
         ks->basicConsole.Println(str);
     };
 
+    /*
+     * These are variadic, so we just hand out
+     * the real funcs instead of wrapping them.
+    */
+    ds.kprintf = kprintf;
+    ds.ksnprintf = ksnprintf;
+    ds.kvsnprintf = kvsnprintf;
+    ds.klog = klog;
+
     /*
      * Memory
     */
@@ -177,6 +187,10 @@ void DriverManager::CreateDriverServices() {
         return ks->pageFrameAllocator.RequestPage();
     };
 
+    ds.RequestPages = [](uint64_t pageCount) { 
+        return ks->pageFrameAllocator.RequestPages(pageCount);
+    };
+
     ds.LockPage = [](void* address) { 
         ks->pageFrameAllocator.LockPage(address);
     };
@@ -213,12 +227,64 @@ void DriverManager::CreateDriverServices() {
         return strdup(str);
     };
 
+    /*
+     * Drivers get the kernel's mem and string
+     * funcs, so they don't need their own slow
+     * copies.
+    */
+    ds.memcpy = [](void* dest, const void* src, size_t n) {
+        return memcpy(dest, src, n);
+    };
+
+    ds.memmove = [](void* dest, const void* src, size_t n) {
+        return memmove(dest, src, n);
+    };
+
+    ds.memset = [](void* dest, uint8_t value, size_t n) {
+        return memset(dest, value, n);
+    };
+
+    ds.memcmp = [](const void* s1, const void* s2, size_t n) {
+        return memcmp(s1, s2, n);
+    };
+
+    ds.strlen = [](const char* str) {
+        return strlen(str);
+    };
+
+    ds.strcmp = [](const char* s1, const char* s2) {
+        return strcmp(s1, s2);
+    };
+
+    ds.strncmp = [](const char* s1, const char* s2, size_t n) {
+        return strncmp(s1, s2, n);
+    };
+
+    ds.strchr = [](const char* str, int ch) {
+        return strchr(str, ch);
+    };
+
     /*
      * IRQs
     */
     ds.SetDescriptor = [](uint8_t vector, void* isr, uint8_t flags) { 
         ks->idt.SetDescriptor(vector, isr, flags);
     };
+    ds.RequestIRQ = [](uint8_t vector, IRQHandler handler, void* ctx) {
+        return ks->irq.RequestIRQ(vector, handler, ctx);
+    };
+    ds.FreeIRQ = [](uint8_t vector, IRQHandler handler, void* ctx) {
+        return ks->irq.FreeIRQ(vector, handler, ctx);
+    };
+    ds.AllocateVector = []() {
+        return ks->irq.AllocateVector();
+    };
+    ds.FreeVector = [](uint8_t vector) {
+        ks->irq.FreeVector(vector);
+    };
+    ds.RouteIRQ = [](uint8_t irq, uint8_t vector) {
+        return ks->irq.RouteIRQ(irq, vector);
+    };
 
     /*
      * PCI/e
@@ -239,6 +305,22 @@ void DriverManager::CreateDriverServices() {
         return ks->pcie.EnableMSIx(segment, bus, device, function, vector);
     };
 
+    ds.AllocateMSIx = [](uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t count, uint8_t* vectors) {
+        return ks->pcie.AllocateMSIx(segment, bus, device, function, count, vectors);
+    };
+
+    ds.FreeMSIx = [](uint16_t segment, uint8_t bus, uint8_t device, uint8_t function) {
+        ks->pcie.FreeMSIx(segment, bus, device, function);
+    };
+
+    ds.SetMSIxAffinity = [](uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t entry, uint8_t apicID) {
+        return ks->pcie.SetMSIxAffinity(segment, bus, device, function, entry, apicID);
+    };
+
+    ds.MaskMSIx = [](uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t entry, bool mask) {
+        return ks->pcie.MaskMSIx(segment, bus, device, function, entry, mask);
+    };
+
     ds.ConfigReadWorde = [](uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint8_t vector) { 
         return ks->pcie.ConfigReadWord(segment, bus, device, function, vector);
     };
@@ -276,6 +358,34 @@ void DriverManager::CreateDriverServices() {
     ds.sleep = [](uint64_t ms) { 
         ks->timer.sleep(ms);
     };
+
+    ds.ArmWakeup = [](uint64_t ms) {
+        ks->timer.Wakeup(ms);
+    };
+
+    ds.bread = [](PartitionDevice* dev, uint64_t block, uint32_t size) {
+        return ks->bcache.Read(dev, block, size);
+    };
+
+    ds.bget = [](PartitionDevice* dev, uint64_t block, uint32_t size) {
+        return ks->bcache.Get(dev, block, size);
+    };
+
+    ds.bwrite = [](BlockBuffer* buf) {
+        ks->bcache.MarkDirty(buf);
+    };
+
+    ds.brelse = [](BlockBuffer* buf) {
+        ks->bcache.Release(buf);
+    };
+
+    ds.bsync = [](PartitionDevice* dev) {
+        return ks->bcache.Sync(dev);
+    };
+
+    ds.breada = [](PartitionDevice* dev, uint64_t block, uint32_t count, uint32_t size) {
+        return ks->bcache.ReadAhead(dev, block, count, size);
+    };
 }
 
 DriverServices& DriverManager::GetDS() {
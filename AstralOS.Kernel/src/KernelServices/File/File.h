@@ -39,6 +39,13 @@ struct File {
     uint32_t flags;
     Path* path;
     uint64_t data;
+
+    /*
+     * Belongs to the filesystem driver that
+     * opened the file (EXT4 keeps its readahead
+     * state here). Null if it didn't set one.
+    */
+    void* fsData;
 };
 
 enum FileFlags {
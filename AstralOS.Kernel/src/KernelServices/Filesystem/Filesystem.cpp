@@ -1,53 +1,63 @@
 #include "Filesystem.h"
 #include "../KernelServices.h"
+#include "../../Utils/kprintf/kprintf.h"
 
 bool VFS::mount(const char* source, const char* target) {
-    for (int i = 0; i < mountpoints.size(); i++) {
-        Path* moun = mountpoints[i];
-        String mDev = String(moun->device);
-        if (mDev.c_str() == source) {
-            ks->basicConsole.Println("Device is already Mounted");
-            return false;
-        }
-        if (moun->path.c_str() == target) {
-            ks->basicConsole.Println("Path is in Use");
-            return false;
-        }
+    if (mountsByDevice.contains(source)) {
+        ks->basicConsole.Println("Device is already Mounted");
+        return false;
+    }
+    if (mountsByPath.contains(target)) {
+        ks->basicConsole.Println("Path is in Use");
+        return false;
     }
     Path* mnt = (Path*)ks->heapAllocator.malloc(sizeof(Path));
     mnt->device = source;
     mnt->path = target;
 
-    uint64_t size = 0;
-    char** devs = str_split(strdup((char*)mnt->device.c_str()), '/', &size);
-    if (size != 3) {
-        ks->basicConsole.Print("Dev path doesn't have 3 values: ");
+    /*
+     * The device looks like `/dev/sdap1`,
+     * so we want exactly 2 parts: `dev` and
+     * the disk, and the disk can then be
+     * split at the `p` to get the partition.
+    */
+    PathIterator devIt(mnt->device.c_str());
+    size_t size = devIt.Count();
+    if (size != 2) {
+        ks->basicConsole.Print("Dev path doesn't have 2 values: ");
         ks->basicConsole.Println(to_hstring(size));
         return false;
     }
 
-    if (strcmp(devs[0], "dev") != 0) {
+    StringView devs[2];
+    devIt.Next(devs[0]);
+    devIt.Next(devs[1]);
+
+    if (devs[0] != "dev") {
         ks->basicConsole.Println("Dev path doesn't start with /dev");
         return false;
     }
-    uint64_t diskPathSize = 0;
-    char** diskPath = str_split(strdup(devs[1]), 'p', &diskPathSize);
+
+    PathIterator diskIt(devs[1], 'p');
+    size_t diskPathSize = diskIt.Count();
     if (diskPathSize == 0) {
         ks->basicConsole.Println("Failed to get DiskPath Split");
         return false;
     }
-    char* name = strdup(diskPath[0]);
+
+    StringView diskPath[2];
+    diskIt.Next(diskPath[0]);
+    diskIt.Next(diskPath[1]);
 
     int idx = 0;
 
     /*
      * Skip the `sd` part
     */
-    name += 2;
+    StringView name = diskPath[0].substring(2);
 
-    while (*name) {
-        idx = idx * 26 + (*name - 'a' + 1);
-        name++;
+    for (size_t i = 0; i < name.size(); i++) {
+        idx = idx * 26 + (name[i] - 'a' + 1);
     }
 
     uint64_t num = idx - 1;
@@ -57,7 +67,7 @@ bool VFS::mount(const char* source, const char* target) {
     if (diskPathSize == 2) {
         int value = 0;
 
-        for (int i = 0; diskPath[1][i]; i++) {
+        for (size_t i = 0; i < diskPath[1].size(); i++) {
             if (diskPath[1][i] < '0' || diskPath[1][i] > '9') {
                 ks->basicConsole.Println("Failed to get Partition Num");
                 break;
@@ -84,10 +94,10 @@ bool VFS::mount(const char* source, const char* target) {
             mnt->disk = num;
             mnt->partition = partition;
             mountpoints.push_back(mnt);
+            mountsByPath.insert(mnt->path.c_str(), mnt);
+            mountsByDevice.insert(mnt->device.c_str(), mnt);
             mounted = true;
-            ks->basicConsole.Println(((String)"Mounted disk " + to_hstring(num) + 
-                                              ", partition " + to_hstring(partition) + 
-                                              " at " + mnt->path).c_str());
+            kprintf("Mounted disk 0x%lX, partition 0x%lX at %s\n", num, (uint64_t)partition, mnt->path.c_str());
         }
     }
     return mounted;
@@ -96,22 +106,32 @@ bool VFS::mount(const char* source, const char* target) {
 Path VFS::ResolvePath(const char* pat) {
     String path = String(pat);
     Path* best = nullptr;
-    size_t bestLen = 0;
 
-    for (int i = 0; i < mountpoints.size(); i++) {
-        Path* m = mountpoints[i];
-        if (!path.StartsWith(m->path))
+    /*
+     * We want the longest mount path that is
+     * a prefix of `path`, so we chop `path`
+     * off at every '/' (starting from the end)
+     * and look each prefix up until we find a
+     * mount. `/` is the catch all, so it gets
+     * checked last.
+    */
+    StringView view(path.c_str(), path.size());
+    for (size_t i = view.size(); i > 1; i--) {
+        if (i != view.size() && view[i] != '/') {
             continue;
-        
-        if (strcmp(m->path.c_str(), "/") != 0) {
-            if (path.size() > m->path.size() && path.c_str()[m->path.size()] != '/') {
-                continue;
-            }
         }
 
-        if (m->path.size() > bestLen) {
-            best = m;
-            bestLen = m->path.size();
+        Path** m = mountsByPath.find(view.substring(0, i));
+        if (m) {
+            best = *m;
+            break;
+        }
+    }
+
+    if (!best && view.StartsWith("/")) {
+        Path** m = mountsByPath.find("/");
+        if (m) {
+            best = *m;
         }
     }
 
@@ -238,31 +258,22 @@ bool VFS::close(File* file) {
 
 File* VFS::mkdir(const char* path) {
     Path resPath = ResolvePath(path);
-    size_t size = 0;
-    char** p = str_split(strdup(resPath.path.c_str()), '/', &size);
-
-    uint64_t newSize = 0;
-    for (size_t i = 0; i < (size - 1); i++) {
-        if ((size - 1) == 1) {
-            newSize += strlen(p[i - 1]);
-        } else {
-            newSize += strlen(p[i - 1]) + 1;
-        }
-    }
 
-    char* newPath = (char*)ks->heapAllocator.malloc(newSize);
-    
-    for (size_t i = 0; i < (size - 1); i++) {
-        if ((size - 1) == 1) {
-            strcat(newPath, p[i]);
-        } else {
-            strcat(newPath, p[i]);
-            strcat(newPath, "/");
-        }
+    /*
+     * Everything before the last `/` is the
+     * dir we create the new dir in, and the
+     * part after it is the new dir's name.
+    */
+    StringView rel(resPath.path.c_str(), resPath.path.size());
+    size_t slash = rel.rfind('/');
+
+    String newPath = "";
+    const char* newDir = rel.data();
+    if (slash != StringView::npos) {
+        newPath = String(rel.data(), slash);
+        newDir = rel.data() + slash + 1;
     }
 
-    char* newDir = p[size - 1];
-
     Array<BaseDriver*> FSDriver = ks->driverMan.GetDevices(DriverType::FilesystemDriver);
     for (size_t i = 0; i < FSDriver.size(); i++) {
         FilesystemDevice* bldev = static_cast<FilesystemDevice*>(FSDriver[i]);
@@ -272,7 +283,7 @@ File* VFS::mkdir(const char* path) {
 
         if (bldev->GetParentLayer()->SectorCount() == 0 || bldev->GetParentLayer()->SectorSize() == 0) continue;
 
-        FsNode* fsN = bldev->FindDir(bldev->GetParentLayer()->GetMountNode(), newPath);
+        FsNode* fsN = bldev->FindDir(bldev->GetParentLayer()->GetMountNode(), newPath.c_str());
 
         File* file = (File*)ks->heapAllocator.malloc(sizeof(File));
 
@@ -294,6 +305,7 @@ File* VFS::mkdir(const char* path) {
         file->path = rPath;
         file->position = 0;
         file->data = 0;
+        file->fsData = nullptr;
         return file;
     }
 
@@ -326,6 +338,7 @@ File* VFS::listdir(File* file) {
 
             File* newDir = (File*)ks->heapAllocator.malloc(sizeof(File));
             newDir->data = 0;
+            newDir->fsData = nullptr;
             newDir->flags = file->flags;
             newDir->node = LfsN[file->position];
             newDir->position = 0;
@@ -356,6 +369,7 @@ File* VFS::listdir(File* file) {
 
         File* newDir = (File*)ks->heapAllocator.malloc(sizeof(File));
         newDir->data = 0;
+        newDir->fsData = nullptr;
         newDir->flags = file->flags;
         newDir->node = LfsN[file->position];
         newDir->position = 0;
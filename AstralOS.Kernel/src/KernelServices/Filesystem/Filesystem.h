@@ -3,6 +3,8 @@
 #include <cstddef>
 #include "../../Utils/String/String.h"
 #include "../../Utils/Array/Array.h"
+#include "../../Utils/HashMap/HashMap.h"
+#include "../../Utils/StringView/StringView.h"
 #include "../DriverManager/DriverManager.h"
 #include "../File/File.h"
 
@@ -23,4 +25,13 @@ public:
 private:
     Path ResolvePath(const char* path);
     Array<Path*> mountpoints;
+
+    /*
+     * These point at the same Paths as
+     * mountpoints, but keyed by the mount
+     * path and by the device, so we don't
+     * have to walk every mount to find one.
+    */
+    HashMap<StringView, Path*> mountsByPath;
+    HashMap<StringView, Path*> mountsByDevice;
 };
@@ -1,36 +1,26 @@
 #include "IDT.h"
 #include "../KernelServices.h"
+#include "../../Utils/kprintf/kprintf.h"
 
 extern "C" void exception_handler(uint64_t vector, uint64_t errCode, InterruptFrame* frame) {
+    ks->serial.Panic();
+    ks->log.Render();
     ks->basicConsole.ClearLines(12);
     ks->basicConsole.CursorPosition = {0, 0};
     ks->basicConsole.Println("=== EXCEPTION ===");
-    ks->basicConsole.Println(((String)"Vector: " + to_hstring(vector)).c_str());
-    ks->basicConsole.Println(((String)"Error Code: " + to_hstring(errCode)).c_str());
-    ks->basicConsole.Println(((String)"RIP: " + to_hstring(frame->rip)).c_str());
-    ks->basicConsole.Println(((String)"CS: " + to_hstring(frame->cs)).c_str());
-    ks->basicConsole.Println(((String)"RFLAGS: " + to_hstring(frame->rflags_cpu)).c_str());
+    /*
+     * The heap might be what broke, so don't
+     * build Strings in here.
+    */
+    kprintf("Vector: 0x%lX\n", vector);
+    kprintf("Error Code: 0x%lX\n", errCode);
+    kprintf("RIP: 0x%lX\n", frame->rip);
+    kprintf("CS: 0x%lX\n", frame->cs);
+    kprintf("RFLAGS: 0x%lX\n", frame->rflags_cpu);
     ks->basicConsole.Println("=================");
     while (true) __asm__ volatile ("cli; hlt");
 }
 
-extern "C" void hardware_handler(uint64_t vector) {
-    if (vector == 0x20) {
-        ks->timer.g_ticks++;
-        ks->apic.WriteAPIC(APICRegs::EOI, 0);
-        return;
-    }
-    ks->basicConsole.Print("Hardware Interrupt at Vector: ");
-    ks->basicConsole.Println(to_hstring(vector));
-    ks->apic.WriteAPIC(APICRegs::EOI, 0);
-}
-
-extern "C" void apic_handler(uint64_t vector) {
-    ks->basicConsole.Print("APIC Interrupt at Vector: ");
-    ks->basicConsole.Println(to_hstring(vector));
-    ks->apic.WriteAPIC(APICRegs::EOI, 0);
-}
-
 void IDT::Initialize(BasicConsole* bc) {
     basicConsole = bc;
 }
@@ -62,7 +52,7 @@ void IDT::CreateIDT() {
     idtr.base = (uintptr_t)&idt[0];
     idtr.limit = (uint16_t)sizeof(IDT_ENTRY64) * IDT_MAX_DESCRIPTORS - 1;
 
-    for (uint8_t vector = 0; vector < 255; vector++) {
+    for (uint32_t vector = 0; vector < IDT_MAX_DESCRIPTORS; vector++) {
         SetDescriptor(vector, isr_stub_table[vector], 0x8E);
         vectors[vector] = true;
     }
@@ -74,8 +74,6 @@ struct InterruptFrame {
 };
 
 extern "C" void exception_handler(uint64_t vector, uint64_t errCode, InterruptFrame* frame);
-extern "C" void hardware_handler(uint64_t vector);
-extern "C" void apic_handler(uint64_t vector);
 
 class IDT {
 public:
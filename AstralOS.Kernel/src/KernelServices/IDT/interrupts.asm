@@ -95,53 +95,38 @@ isr_stub_%+%1:
     iretq
 %endmacro
 
-%macro isr_hardware_stub 1
-isr_stub_%+%1:
-    cli
+; Every vector from 0x20 up comes through here.
+; The C side only needs the registers it is allowed
+; to trash saved (rax, rcx, rdx, rsi, rdi, r8 - r11),
+; since it saves the others itself if it uses them.
+; The interrupt gate already cleared IF and iretq puts
+; RFLAGS back, so there is no cli/sti/pushfq either.
+; 9 pushes on top of the CPU's 5 keeps rsp 16 byte
+; aligned for the call.
+irq_common:
     push rax
     push rcx
     push rdx
-    push rbx
-    push rsp
-    push rbp
     push rsi
-    push rdi
     push r8
     push r9
     push r10
     push r11
-    push r12
-    push r13
-    push r14
-    push r15
-    pushfq
-    mov rdi, %1
-    lea rdx, [rsp + 8]
-    call hardware_handler
-    popfq
-    pop r15
-    pop r14
-    pop r13
-    pop r12
+    cld
+    call irq_dispatch
     pop r11
     pop r10
     pop r9
     pop r8
-    pop rdi
     pop rsi
-    pop rbp
-    pop rsp
-    pop rbx
     pop rdx
     pop rcx
     pop rax
-    sti
+    pop rdi
     iretq
-%endmacro
 
 extern exception_handler
-extern hardware_handler
-extern apic_handler
+extern irq_dispatch
 isr_no_err_stub 0
 isr_no_err_stub 1
 isr_no_err_stub 2
@@ -174,47 +159,15 @@ isr_no_err_stub 28
 isr_no_err_stub 29
 isr_err_stub    30
 isr_no_err_stub 31
-isr_hardware_stub 32
-isr_hardware_stub 33
-isr_hardware_stub 34
-isr_hardware_stub 35
-isr_hardware_stub 36
-isr_hardware_stub 37
-isr_hardware_stub 38
-isr_hardware_stub 39
-isr_hardware_stub 40
-isr_hardware_stub 41
-isr_hardware_stub 42
-isr_hardware_stub 43
-isr_hardware_stub 44
-isr_hardware_stub 45
-isr_hardware_stub 46
-isr_hardware_stub 47
-
-%assign start_vec 0x30
-%assign end_vec 0xFF
-
-%assign vec start_vec
-%rep end_vec - start_vec + 1
-    isr_stub_%+vec:
-        mov rdi, vec
-        call apic_handler
-        iretq
+%assign vec 32
+%rep 256 - 32
+isr_stub_%+vec:
+    push rdi
+    mov edi, vec
+    jmp irq_common
 %assign vec vec + 1
 %endrep
 
-global irq_stub
-extern irq1_handler
-irq_stub:
-    push rax
-    push rcx
-    push rdx
-    call irq1_handler
-    pop rdx
-    pop rcx
-    pop rax
-    iretq
-
 global isr_stub_table
 isr_stub_table:
 %assign i 0 
@@ -0,0 +1,446 @@
+#include "IOScheduler.h"
+#include "../KernelServices.h"
+#include "../../Utils/kprintf/kprintf.h"
+
+/*
+ * Out here for the same reason as the buffer
+ * cache's pool, KernelServices starts out on
+ * a small stack.
+*/
+static IOQueue Queues[IOSCHED_QUEUES];
+static IORequest RequestPool[IOSCHED_REQUESTS];
+
+/*
+ * inFlight goes down in the completion, which
+ * can be an IRQ handler, so going up has to
+ * happen with interrupts off.
+*/
+uint64_t IOScheduler::Lock() {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+void IOScheduler::Unlock(uint64_t flags) {
+    if (flags & (1 << 9)) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+IOQueue* IOScheduler::QueueFor(PartitionDevice* dev) {
+    IOQueue* free = nullptr;
+    for (size_t i = 0; i < IOSCHED_QUEUES; i++) {
+        if (Queues[i].dev == dev) {
+            return &Queues[i];
+        }
+        if (!Queues[i].dev && !free) {
+            free = &Queues[i];
+        }
+    }
+
+    if (free) {
+        free->dev = dev;
+    }
+    return free;
+}
+
+/*
+ * Same as QueueFor, but it never hands out a
+ * new queue, for callers that only look.
+*/
+IOQueue* IOScheduler::FindQueue(PartitionDevice* dev) {
+    for (size_t i = 0; i < IOSCHED_QUEUES; i++) {
+        if (Queues[i].dev == dev) {
+            return &Queues[i];
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * Called by the controller when a request we
+ * sent out is done, maybe from an IRQ handler.
+ * Every request that got merged into it gets
+ * finished with the same status.
+*/
+static void RequestDone(BlockRequest* req) {
+    IORequest* io = (IORequest*)req->ctx;
+    BlockStatus status = req->status;
+
+    for (uint32_t i = 0; i < io->partCount; i++) {
+        BlockRequest* part = io->parts[i];
+        part->status = status;
+        if (part->done) {
+            part->done(part);
+        }
+    }
+
+    io->queue->inFlight--;
+    io->inUse = false;
+}
+
+IORequest* IOScheduler::Find(BlockRequest* req) {
+    for (size_t i = 0; i < IOSCHED_REQUESTS; i++) {
+        IORequest* io = &RequestPool[i];
+        if (!io->inUse) {
+            continue;
+        }
+        for (uint32_t p = 0; p < io->partCount; p++) {
+            if (io->parts[p] == req) {
+                return io;
+            }
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * Gets a free IORequest. If they're all taken
+ * we push every queue out and wait for one of
+ * them to finish.
+*/
+IORequest* IOScheduler::Allocate() {
+    while (true) {
+        for (size_t i = 0; i < IOSCHED_REQUESTS; i++) {
+            if (!RequestPool[i].inUse) {
+                return &RequestPool[i];
+            }
+        }
+
+        for (size_t i = 0; i < IOSCHED_QUEUES; i++) {
+            if (Queues[i].dev) {
+                Dispatch(&Queues[i], true);
+            }
+        }
+
+        for (size_t i = 0; i < IOSCHED_REQUESTS; i++) {
+            IORequest* io = &RequestPool[i];
+            if (io->inUse && io->dispatched) {
+                io->queue->dev->Wait(&io->req);
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Tries to tack req onto the end (back merge)
+ * or the front (front merge) of a request that
+ * is still waiting in the queue.
+*/
+bool IOScheduler::Merge(IOQueue* q, BlockRequest* req) {
+    for (IORequest* io = q->queued; io; io = io->next) {
+        if (io->write != req->write) {
+            continue;
+        }
+        if (io->partCount == IOSCHED_MAX_PARTS) {
+            continue;
+        }
+        if (io->req.segCount + req->segCount > IOSCHED_MAX_SEGS) {
+            continue;
+        }
+        if (io->count + req->count > IOSCHED_MAX_SECTORS) {
+            continue;
+        }
+
+        if (io->lba + io->count == req->lba) {
+            for (size_t i = 0; i < req->segCount; i++) {
+                io->segs[io->req.segCount + i] = req->segs[i];
+            }
+            io->req.segCount += req->segCount;
+            io->parts[io->partCount++] = req;
+            io->count += req->count;
+            q->stats.backMerges++;
+            return true;
+        }
+
+        if (req->lba + req->count == io->lba) {
+            for (size_t i = io->req.segCount; i > 0; i--) {
+                io->segs[i - 1 + req->segCount] = io->segs[i - 1];
+            }
+            for (size_t i = 0; i < req->segCount; i++) {
+                io->segs[i] = req->segs[i];
+            }
+            io->req.segCount += req->segCount;
+            io->parts[io->partCount++] = req;
+            io->lba = req->lba;
+            io->count += req->count;
+            q->stats.frontMerges++;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * A merge (or a new request) can fill the gap
+ * between two queued requests, so this joins
+ * any that are next to each other now. The
+ * queue is sorted, so they can only be next to
+ * the one after them.
+*/
+void IOScheduler::Coalesce(IOQueue* q) {
+    IORequest* io = q->queued;
+    while (io && io->next) {
+        IORequest* next = io->next;
+        if (io->write != next->write || io->lba + io->count != next->lba ||
+            io->partCount + next->partCount > IOSCHED_MAX_PARTS ||
+            io->req.segCount + next->req.segCount > IOSCHED_MAX_SEGS ||
+            io->count + next->count > IOSCHED_MAX_SECTORS) {
+            io = next;
+            continue;
+        }
+
+        for (size_t i = 0; i < next->req.segCount; i++) {
+            io->segs[io->req.segCount + i] = next->segs[i];
+        }
+        io->req.segCount += next->req.segCount;
+        for (uint32_t i = 0; i < next->partCount; i++) {
+            io->parts[io->partCount++] = next->parts[i];
+        }
+        io->count += next->count;
+        if (next->deadline < io->deadline) {
+            io->deadline = next->deadline;
+        }
+        q->stats.backMerges += next->partCount;
+
+        io->next = next->next;
+        next->next = nullptr;
+        next->partCount = 0;
+        next->inUse = false;
+    }
+}
+
+void IOScheduler::Insert(IOQueue* q, IORequest* io) {
+    IORequest** link = &q->queued;
+    while (*link && (*link)->lba <= io->lba) {
+        link = &(*link)->next;
+    }
+    io->next = *link;
+    *link = io;
+}
+
+/*
+ * Picks what goes out next. Anything past its
+ * deadline goes first (the oldest one). Then
+ * reads, unless writes have been passed over
+ * too often. Then whichever one of those comes
+ * next going up from the head, wrapping back
+ * around to the lowest lba at the end.
+*/
+IORequest* IOScheduler::PickNext(IOQueue* q) {
+    IORequest* expired = nullptr;
+    bool reads = false;
+    bool writes = false;
+    for (IORequest* io = q->queued; io; io = io->next) {
+        if (io->deadline <= q->clock && (!expired || io->deadline < expired->deadline)) {
+            expired = io;
+        }
+        reads |= !io->write;
+        writes |= io->write;
+    }
+
+    if (expired) {
+        q->stats.expired++;
+        return expired;
+    }
+
+    bool write = !reads || (writes && q->readBatches >= IOSCHED_WRITES_STARVED);
+    if (write) {
+        q->readBatches = 0;
+    } else if (writes) {
+        q->readBatches++;
+    }
+
+    IORequest* first = nullptr;
+    for (IORequest* io = q->queued; io; io = io->next) {
+        if (io->write != write) {
+            continue;
+        }
+        if (io->lba >= q->head) {
+            return io;
+        }
+        if (!first) {
+            first = io;
+        }
+    }
+    return first;
+}
+
+/*
+ * Sends requests out until the device has
+ * IOSCHED_DEPTH in flight. `force` sends out
+ * everything, even if the queue is plugged.
+*/
+void IOScheduler::Dispatch(IOQueue* q, bool force) {
+    if (q->plugged && !force) {
+        return;
+    }
+
+    while (q->queued && (force || q->inFlight < IOSCHED_DEPTH)) {
+        IORequest* io = PickNext(q);
+
+        IORequest** link = &q->queued;
+        while (*link != io) {
+            link = &(*link)->next;
+        }
+        *link = io->next;
+        io->next = nullptr;
+
+        io->req.lba = io->lba;
+        io->req.count = io->count;
+        io->req.segs = io->segs;
+        io->req.write = io->write;
+        io->req.done = RequestDone;
+        io->req.ctx = io;
+        io->dispatched = true;
+
+        q->clock++;
+        q->head = io->lba + io->count;
+        q->stats.dispatched++;
+        q->stats.sectors += io->count;
+
+        uint64_t flags = Lock();
+        q->inFlight++;
+        Unlock(flags);
+
+        /*
+         * Some controllers finish before Submit
+         * even returns, so io might be free again
+         * after this.
+        */
+        if (!q->dev->Submit(&io->req)) {
+            io->req.status = BLOCK_ERROR;
+            RequestDone(&io->req);
+        }
+    }
+}
+
+/*
+ * Same deal as PartitionDevice::Submit. If the
+ * request is too big to go through the queue,
+ * or there's no queue left for dev, it goes
+ * straight to the device.
+*/
+bool IOScheduler::Submit(PartitionDevice* dev, BlockRequest* req) {
+    if (req->count == 0 || req->segCount == 0) {
+        req->status = BLOCK_ERROR;
+        return false;
+    }
+
+    IOQueue* q = QueueFor(dev);
+    if (!q || req->segCount > IOSCHED_MAX_SEGS || req->count > IOSCHED_MAX_SECTORS) {
+        return dev->Submit(req);
+    }
+
+    req->status = BLOCK_PENDING;
+    q->stats.submitted++;
+
+    if (!Merge(q, req)) {
+        IORequest* io = Allocate();
+        io->inUse = true;
+        io->dispatched = false;
+        io->queue = q;
+        io->lba = req->lba;
+        io->count = req->count;
+        io->write = req->write;
+        io->deadline = q->clock + (req->write ? IOSCHED_WRITE_EXPIRE : IOSCHED_READ_EXPIRE);
+        for (size_t i = 0; i < req->segCount; i++) {
+            io->segs[i] = req->segs[i];
+        }
+        io->req.segCount = req->segCount;
+        io->req.status = BLOCK_PENDING;
+        io->parts[0] = req;
+        io->partCount = 1;
+        Insert(q, io);
+    }
+
+    Coalesce(q);
+    Dispatch(q, false);
+    return true;
+}
+
+/*
+ * If req is still sitting in the queue, the
+ * whole queue goes out first, since there's no
+ * point holding anything back while someone
+ * waits.
+*/
+bool IOScheduler::Wait(PartitionDevice* dev, BlockRequest* req) {
+    while (req->status == BLOCK_PENDING) {
+        IORequest* io = Find(req);
+        if (!io) {
+            return dev->Wait(req);
+        }
+
+        if (!io->dispatched) {
+            Dispatch(io->queue, true);
+        } else {
+            io->queue->dev->Wait(&io->req);
+        }
+    }
+    return req->status == BLOCK_OK;
+}
+
+/*
+ * Submit and Wait in one, for `count` sectors
+ * at the physical address `buffer`.
+*/
+bool IOScheduler::Transfer(PartitionDevice* dev, uint64_t lba, uint32_t count, void* buffer, bool write) {
+    DMASegment seg = { (uint64_t)buffer, count * dev->SectorSize() };
+
+    BlockRequest req;
+    req.lba = lba;
+    req.count = count;
+    req.segs = &seg;
+    req.segCount = 1;
+    req.write = write;
+    req.done = nullptr;
+    req.ctx = nullptr;
+    req.status = BLOCK_PENDING;
+
+    if (!Submit(dev, &req)) {
+        return false;
+    }
+    return Wait(dev, &req);
+}
+
+void IOScheduler::Plug(PartitionDevice* dev) {
+    IOQueue* q = QueueFor(dev);
+    if (q) {
+        q->plugged++;
+    }
+}
+
+void IOScheduler::Unplug(PartitionDevice* dev) {
+    IOQueue* q = FindQueue(dev);
+    if (q && q->plugged) {
+        q->plugged--;
+        Dispatch(q, false);
+    }
+}
+
+/*
+ * nullptr if dev never went through us.
+*/
+const IOQueueStats* IOScheduler::Stats(PartitionDevice* dev) {
+    IOQueue* q = FindQueue(dev);
+    return q ? &q->stats : nullptr;
+}
+
+/*
+ * For the `iosched` command.
+*/
+void IOScheduler::DumpStats() {
+    kprintf("Device      Submitted  Back merges  Front merges  Dispatched  Expired  Sectors\n");
+    for (size_t i = 0; i < IOSCHED_QUEUES; i++) {
+        IOQueue* q = &Queues[i];
+        if (!q->dev) {
+            continue;
+        }
+
+        const IOQueueStats& s = q->stats;
+        kprintf("%-10s  %-9lu  %-11lu  %-12lu  %-10lu  %-7lu  %lu\n", q->dev->name(), s.submitted,
+            s.backMerges, s.frontMerges, s.dispatched, s.expired, s.sectors);
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "../DriverManager/DriverManager.h"
+
+/*
+ * IOSCHED_QUEUES is how many devices can have
+ * a queue, and IOSCHED_REQUESTS is how many
+ * (merged) requests there can be between all
+ * of them, queued or in flight.
+ *
+ * A merged request can grow up to
+ * IOSCHED_MAX_SEGS segments, IOSCHED_MAX_PARTS
+ * original requests and IOSCHED_MAX_SECTORS
+ * sectors, which every controller we have can
+ * do in one go. IOSCHED_DEPTH is how many we
+ * let a device have in flight at once, the
+ * rest wait in the queue so they can still
+ * get merged and sorted.
+*/
+#define IOSCHED_QUEUES          8
+#define IOSCHED_REQUESTS        64
+#define IOSCHED_MAX_SEGS        128
+#define IOSCHED_MAX_PARTS       64
+#define IOSCHED_MAX_SECTORS     2048
+#define IOSCHED_DEPTH           4
+
+/*
+ * The deadlines are counted in dispatches on
+ * that device, not in time, since the timer
+ * doesn't tick once we're up. A read that got
+ * passed over IOSCHED_READ_EXPIRE times goes
+ * next no matter where it is, same for writes
+ * with IOSCHED_WRITE_EXPIRE. And reads only
+ * get to go first IOSCHED_WRITES_STARVED times
+ * in a row while writes are waiting.
+*/
+#define IOSCHED_READ_EXPIRE     8
+#define IOSCHED_WRITE_EXPIRE    32
+#define IOSCHED_WRITES_STARVED  2
+
+struct IOQueue;
+
+/*
+ * What actually goes down to the device: one
+ * run of sectors, made out of one or more of
+ * the requests that were Submitted to us.
+*/
+struct IORequest {
+    BlockRequest req;
+    DMASegment segs[IOSCHED_MAX_SEGS];
+    BlockRequest* parts[IOSCHED_MAX_PARTS];
+    uint32_t partCount;
+
+    uint64_t lba;
+    uint32_t count;
+    bool write;
+    uint64_t deadline;
+
+    IOQueue* queue;
+    IORequest* next;
+    bool dispatched;
+    volatile bool inUse;
+};
+
+struct IOQueueStats {
+    uint64_t submitted;
+    uint64_t backMerges;
+    uint64_t frontMerges;
+    uint64_t dispatched;
+    uint64_t expired;
+    uint64_t sectors;
+};
+
+/*
+ * `queued` is sorted by lba. `head` is where
+ * the last request we sent out ended, so the
+ * elevator knows where to carry on from.
+*/
+struct IOQueue {
+    PartitionDevice* dev;
+    IORequest* queued;
+    uint32_t plugged;
+    volatile uint32_t inFlight;
+    uint64_t head;
+    uint64_t clock;
+    uint32_t readBatches;
+    IOQueueStats stats;
+};
+
+/*
+ * The I/O scheduler sits between the buffer
+ * cache and PartitionDevice::Submit, with a
+ * queue for each device.
+ *
+ * A request that starts right where a queued
+ * one ends (or ends right where it starts)
+ * gets merged into it, so a lot of small
+ * requests for blocks next to each other go
+ * out as one command. What's left is sent out
+ * like a deadline elevator: reads before
+ * writes, in lba order from where the disk
+ * head is, unless something has waited too
+ * long.
+ *
+ * Plug holds everything for a device in the
+ * queue until the matching Unplug, so a batch
+ * gets the chance to merge before any of it
+ * goes out.
+ *
+ * Requests only ever get sent out from here
+ * (Submit, Unplug and Wait), never from the
+ * completion, since that can be an IRQ
+ * handler. Submit and done work the same as
+ * they do on PartitionDevice, and Wait is the
+ * way to wait for something you Submitted
+ * here.
+*/
+class IOScheduler {
+public:
+    bool Submit(PartitionDevice* dev, BlockRequest* req);
+    bool Wait(PartitionDevice* dev, BlockRequest* req);
+    bool Transfer(PartitionDevice* dev, uint64_t lba, uint32_t count, void* buffer, bool write);
+
+    void Plug(PartitionDevice* dev);
+    void Unplug(PartitionDevice* dev);
+
+    const IOQueueStats* Stats(PartitionDevice* dev);
+    void DumpStats();
+private:
+    uint64_t Lock();
+    void Unlock(uint64_t flags);
+
+    IOQueue* QueueFor(PartitionDevice* dev);
+    IOQueue* FindQueue(PartitionDevice* dev);
+    IORequest* Allocate();
+    IORequest* Find(BlockRequest* req);
+    bool Merge(IOQueue* q, BlockRequest* req);
+    void Coalesce(IOQueue* q);
+    void Insert(IOQueue* q, IORequest* io);
+    IORequest* PickNext(IOQueue* q);
+    void Dispatch(IOQueue* q, bool force);
+};
@@ -0,0 +1,214 @@
+#include "IRQ.h"
+#include "../KernelServices.h"
+#include "../../Utils/kprintf/kprintf.h"
+
+/*
+ * These live out here instead of in
+ * IRQManager, since KernelServices starts
+ * out on a small stack.
+*/
+static IRQAction* IRQChains[256];
+static IRQStats IRQStatTable[256];
+static IRQAction IRQActionPool[IRQ_MAX_ACTIONS];
+
+/*
+ * Only the interrupt ever walks the chains,
+ * so turning interrupts off is enough to
+ * change them safely (we only run on one
+ * CPU for now).
+*/
+uint64_t IRQManager::Lock() {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+void IRQManager::Unlock(uint64_t flags) {
+    if (flags & (1 << 9)) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+/*
+ * The handler gets added to the end of the
+ * chain, so handlers run in the order they
+ * were registered.
+*/
+bool IRQManager::RequestIRQ(uint8_t vector, IRQHandler handler, void* ctx) {
+    if (vector < IRQ_FIRST_VECTOR || vector == IRQ_SPURIOUS_VECTOR || !handler) {
+        return false;
+    }
+
+    uint64_t flags = Lock();
+
+    IRQAction* action = freeActions;
+    if (action) {
+        freeActions = action->next;
+    } else if (poolUsed < IRQ_MAX_ACTIONS) {
+        action = &IRQActionPool[poolUsed++];
+    } else {
+        Unlock(flags);
+        klog(LOG_ERROR, "IRQ: out of actions for vector 0x%X", vector);
+        return false;
+    }
+
+    action->handler = handler;
+    action->ctx = ctx;
+    action->next = nullptr;
+
+    IRQAction** link = &IRQChains[vector];
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = action;
+
+    allocated[vector / 64] |= 1ULL << (vector % 64);
+
+    Unlock(flags);
+    return true;
+}
+
+bool IRQManager::FreeIRQ(uint8_t vector, IRQHandler handler, void* ctx) {
+    uint64_t flags = Lock();
+
+    IRQAction** link = &IRQChains[vector];
+    while (*link) {
+        IRQAction* action = *link;
+        if (action->handler == handler && action->ctx == ctx) {
+            *link = action->next;
+            action->next = freeActions;
+            freeActions = action;
+
+            Unlock(flags);
+            return true;
+        }
+        link = &action->next;
+    }
+
+    Unlock(flags);
+    return false;
+}
+
+/*
+ * Gives you a vector nobody else is using
+ * (no handlers and not handed out before),
+ * or 0 if they are all gone.
+*/
+uint8_t IRQManager::AllocateVector() {
+    uint64_t flags = Lock();
+
+    for (uint32_t vector = IRQ_FIRST_DYNAMIC; vector <= IRQ_LAST_DYNAMIC; vector++) {
+        uint64_t bit = 1ULL << (vector % 64);
+        if (!(allocated[vector / 64] & bit) && !IRQChains[vector]) {
+            allocated[vector / 64] |= bit;
+            Unlock(flags);
+            return (uint8_t)vector;
+        }
+    }
+
+    Unlock(flags);
+    return 0;
+}
+
+void IRQManager::FreeVector(uint8_t vector) {
+    uint64_t flags = Lock();
+    allocated[vector / 64] &= ~(1ULL << (vector % 64));
+    Unlock(flags);
+}
+
+/*
+ * Points IOAPIC pin `irq` at `vector` and
+ * unmasks it. This is edge triggered and
+ * active high, which is what all the ISA
+ * IRQs are.
+*/
+bool IRQManager::RouteIRQ(uint8_t irq, uint8_t vector) {
+    if (irq >= ks->ioapic.redirectionEntries()) {
+        return false;
+    }
+
+    RedirectionEntry entry = {};
+    entry.vector = vector;
+    entry.delvMode = 0;
+    entry.destMode = 0;
+    entry.mask = 0;
+    entry.triggerMode = 0;
+    entry.pinPolarity = 0;
+    entry.destination = 0;
+    ks->ioapic.writeRedirEntry(irq, &entry);
+    return true;
+}
+
+bool IRQManager::MaskIRQ(uint8_t irq) {
+    if (irq >= ks->ioapic.redirectionEntries()) {
+        return false;
+    }
+
+    RedirectionEntry entry = {};
+    entry.vector = IRQ_FIRST_VECTOR + irq;
+    entry.mask = 1;
+    ks->ioapic.writeRedirEntry(irq, &entry);
+    return true;
+}
+
+/*
+ * The spurious vector doesn't get an EOI,
+ * the LAPIC never marked it as in service.
+ *
+ * An interrupt that no handler wanted only
+ * gets logged the first time, otherwise a
+ * stuck line would flood the log.
+*/
+void IRQManager::Dispatch(uint8_t vector) {
+    IRQStats& stats = IRQStatTable[vector];
+    uint64_t start = rdtsc();
+
+    bool handled = false;
+    for (IRQAction* action = IRQChains[vector]; action; action = action->next) {
+        handled |= action->handler(vector, action->ctx);
+    }
+
+    if (!handled && vector != IRQ_SPURIOUS_VECTOR) {
+        if (stats.unhandled++ == 0) {
+            klog(LOG_WARN, "IRQ: nobody handled vector 0x%X", vector);
+        }
+    }
+
+    if (vector != IRQ_SPURIOUS_VECTOR) {
+        ks->apic.WriteAPIC(APICRegs::EOI, 0);
+    }
+
+    stats.count++;
+    stats.cycles += rdtsc() - start;
+}
+
+const IRQStats& IRQManager::Stats(uint8_t vector) {
+    return IRQStatTable[vector];
+}
+
+/*
+ * For the `irqs` command. Only vectors that
+ * have handlers or fired at least once.
+*/
+void IRQManager::DumpStats() {
+    kprintf("Vector  Handlers  Count         Avg Cycles  Unhandled\n");
+    for (uint32_t vector = IRQ_FIRST_VECTOR; vector < 256; vector++) {
+        const IRQStats& stats = IRQStatTable[vector];
+
+        size_t handlers = 0;
+        for (IRQAction* action = IRQChains[vector]; action; action = action->next) {
+            handlers++;
+        }
+
+        if (!handlers && !stats.count) {
+            continue;
+        }
+
+        uint64_t avg = stats.count ? stats.cycles / stats.count : 0;
+        kprintf("0x%02X    %-8zu  %-12lu  %-10lu  %lu\n", vector, handlers, stats.count, avg, stats.unhandled);
+    }
+}
+
+extern "C" void irq_dispatch(uint64_t vector) {
+    ks->irq.Dispatch((uint8_t)vector);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Vectors 0x20 - 0x3F belong to the IOAPIC
+ * pins (pin i is 0x20 + i), and 0xFF is the
+ * LAPIC's spurious vector. AllocateVector
+ * hands out the ones in between.
+*/
+#define IRQ_FIRST_VECTOR      0x20
+#define IRQ_FIRST_DYNAMIC     0x40
+#define IRQ_LAST_DYNAMIC      0xEF
+#define IRQ_SPURIOUS_VECTOR   0xFF
+#define IRQ_MAX_ACTIONS       128
+
+/*
+ * Return true if your device actually raised
+ * the interrupt. On a shared vector every
+ * handler gets called anyway, this is only
+ * used to count interrupts nobody wanted.
+*/
+typedef bool (*IRQHandler)(uint8_t vector, void* ctx);
+
+struct IRQAction {
+    IRQHandler handler;
+    void* ctx;
+    IRQAction* next;
+};
+
+struct IRQStats {
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t unhandled;
+};
+
+/*
+ * Every interrupt from 0x20 up ends up in
+ * Dispatch, which calls every handler that
+ * was registered for that vector and sends
+ * the EOI afterwards, so handlers don't have
+ * to know about the LAPIC at all.
+ *
+ * More than one handler can sit on the same
+ * vector (PCI INTx lines are shared a lot),
+ * they just get chained together.
+ *
+ * The actions come out of a fixed pool instead
+ * of the heap, so you can register a handler
+ * before the heap is up, and Dispatch never
+ * has to touch the heap.
+*/
+class IRQManager {
+public:
+    bool RequestIRQ(uint8_t vector, IRQHandler handler, void* ctx);
+    bool FreeIRQ(uint8_t vector, IRQHandler handler, void* ctx);
+
+    uint8_t AllocateVector();
+    void FreeVector(uint8_t vector);
+
+    bool RouteIRQ(uint8_t irq, uint8_t vector);
+    bool MaskIRQ(uint8_t irq);
+
+    void Dispatch(uint8_t vector);
+
+    const IRQStats& Stats(uint8_t vector);
+    void DumpStats();
+private:
+    uint64_t Lock();
+    void Unlock(uint64_t flags);
+
+    IRQAction* freeActions = nullptr;
+    size_t poolUsed = 0;
+    uint64_t allocated[4] = {};
+};
+
+extern "C" void irq_dispatch(uint64_t vector);
@@ -17,23 +17,25 @@ static uint32_t parse_hex(const char* str, size_t len = 8) {
 }
 
 /*
- * This function is generated from ChatGPT.
+ * Checks if the path `name` is inside `dir`
+ * by walking both of them part by part. If
+ * it is, `rest` gets whatever is left of
+ * `name` after the dir.
 */
-size_t split_path(const char* origPath, char* parts[], size_t maxParts) {
-    size_t count = 0;
-    char* pathCopy = strdup(origPath); // Copy the original path to avoid modifying it
-    char* token;
-    char* delim = "/";  // Delimiter for splitting the path
-
-    // Split by "/"
-    token = strtok(pathCopy, delim);
-    while (token != NULL && count < maxParts) {
-        parts[count++] = strdup(token); // Store the token (path part)
-        token = strtok(NULL, delim);    // Continue splitting
+static bool in_dir(StringView name, StringView dir, StringView& rest) {
+    PathIterator nameIt(name);
+    PathIterator dirIt(dir);
+    StringView namePart;
+    StringView dirPart;
+
+    while (dirIt.Next(dirPart)) {
+        if (!nameIt.Next(namePart) || namePart != dirPart) {
+            return false;
+        }
     }
 
-    free(pathCopy); // Free the copy of the original path
-    return count;   // Return the number of parts
+    rest = nameIt.Rest();
+    return true;
 }
 
 /*
@@ -51,19 +53,19 @@ size_t split_path(const char* origPath, char* parts[], size_t maxParts) {
  * If the name is `TRAILER!!!` we can stop parsing
  * because that marks the end of the CPIO archive.
  * 
- * We can then check the mode of the entry to see
- * if it is a directory or a file.
+ * Every entry gets added to `entries`, keyed
+ * by its full name, so that we don't need to
+ * walk the whole archive every time we want
+ * to know if a file exists. The names are
+ * NUL terminated inside the archive itself,
+ * so we can point straight at them.
 */
 void InitialRamFS::Initialize(void* bas, uint64_t siz) {
     base = bas;
     size = siz;
-}
 
-/* 
- * We can then split `name` (which includes the 
- * path) and check if both parts are the same.
-*/
-bool InitialRamFS::file_exists(char* name) {
+    entries.clear();
+
     uint64_t ptr = (uint64_t)base;
     while (true) {
         CPIOHeader* header = (CPIOHeader*)ptr;
@@ -78,79 +80,45 @@ bool InitialRamFS::file_exists(char* name) {
 
         const char* filename = (const char*)(ptr + sizeof(CPIOHeader));
 
-        if (strcmp(filename, "TRAILER!!!") == 0) {
-            break;
-        }
-
-        if (strcmp(filename, ".") == 0) {
-            uintptr_t name_ptr = ptr + sizeof(CPIOHeader);
-            uintptr_t file_ptr = (name_ptr + nameSize + 3) & ~3;
-            uintptr_t next_ptr = (file_ptr + fileSize + 3) & ~3;
-
-            ptr = next_ptr;
-            continue;
-        }
-
-        uint32_t mode = parse_hex(header->mode, 8); 
-        bool is_dir = (mode & 0xF000) == 0x4000;
-
-        if (!is_dir && strcmp(filename, name) == 0) {
-            return true;
-        }
-
         uintptr_t name_ptr = ptr + sizeof(CPIOHeader);
         uintptr_t file_ptr = (name_ptr + nameSize + 3) & ~3;
         uintptr_t next_ptr = (file_ptr + fileSize + 3) & ~3;
 
-        ptr = next_ptr;
-    }
-    
-    return false;
-}
-
-bool InitialRamFS::dir_exists(char* name) {
-    uint64_t ptr = (uint64_t)base;
-    while (true) {
-        CPIOHeader* header = (CPIOHeader*)ptr;
-
-        if (memcmp(header->magic, "070701", 6) != 0) {
-            ks->basicConsole.Println("Invalid CPIO magic number!");
-            break;
-        }
-
-        uint32_t nameSize = parse_hex(header->namesize, 8);
-        uint32_t fileSize = parse_hex(header->filesize, 8);
-
-        const char* filename = (const char*)(ptr + sizeof(CPIOHeader));
-
         if (strcmp(filename, "TRAILER!!!") == 0) {
             break;
         }
 
-        if (strcmp(filename, ".") == 0) {
-            uintptr_t name_ptr = ptr + sizeof(CPIOHeader);
-            uintptr_t file_ptr = (name_ptr + nameSize + 3) & ~3;
-            uintptr_t next_ptr = (file_ptr + fileSize + 3) & ~3;
-
-            ptr = next_ptr;
-            continue;
+        if (strcmp(filename, ".") != 0) {
+            entries.insert(filename, header);
         }
 
-        uint32_t mode = parse_hex(header->mode, 8); 
-        bool is_dir = (mode & 0xF000) == 0x4000;
+        ptr = next_ptr;
+    }
+}
 
-        if (is_dir && strcmp(filename, name) == 0) {
-            return true;
-        }
+/* 
+ * We can then look up `name` (which includes
+ * the path) and check the mode of the entry to
+ * see if it is a directory or a file.
+*/
+bool InitialRamFS::file_exists(char* name) {
+    CPIOHeader** header = entries.find(name);
+    if (!header) {
+        return false;
+    }
 
-        uintptr_t name_ptr = ptr + sizeof(CPIOHeader);
-        uintptr_t file_ptr = (name_ptr + nameSize + 3) & ~3;
-        uintptr_t next_ptr = (file_ptr + fileSize + 3) & ~3;
+    uint32_t mode = parse_hex((*header)->mode, 8);
+    return (mode & 0xF000) != 0x4000;
+}
 
-        ptr = next_ptr;
+bool InitialRamFS::dir_exists(char* name) {
+    CPIOHeader** header = entries.find(name);
+    if (!header) {
+        return false;
     }
-    
-    return false;
+
+    uint32_t mode = parse_hex((*header)->mode, 8);
+    return (mode & 0xF000) == 0x4000;
 }
 
 Array<char*> InitialRamFS::list(char* dir) {
@@ -188,21 +156,17 @@ Array<char*> InitialRamFS::list(char* dir) {
             continue;
         }
 
-        char* parts[10];
-        size_t partSize = split_path(filenameBuf, parts, 10);
-        char* Dirparts[10];
-        size_t DirpartSize = split_path(dir, Dirparts, 10);
-
-        bool isFound = true;
-
-        for (size_t i = 0; i < DirpartSize; i++) {
-            if (strcmp(parts[i], Dirparts[i]) != 0) {
-                isFound = false;
-            }
-        }
-
-        if (isFound && partSize == DirpartSize + 1) {
-            output.push_back(parts[partSize - 1]);
+        /*
+         * We only want the direct children of
+         * `dir`, so there should be exactly one
+         * part left. That part is the end of the
+         * name in the archive, which is already
+         * null terminated, so we can just hand
+         * out a pointer to it.
+        */
+        StringView rest;
+        if (in_dir(filenameBuf, dir, rest) && !rest.empty() && rest.find('/') == StringView::npos) {
+            output.push_back((char*)rest.data());
         }
 
         ptr = next_ptr;
@@ -244,52 +208,25 @@ void* InitialRamFS::read(char* dir, char* name) {
             continue;
         }
 
-        char* parts[10];
-        size_t partSize = split_path(filenameBuf, parts, 10);
-        char* Dirparts[10];
-        size_t DirpartSize = split_path(dir, Dirparts, 10);
-
-        if (partSize > (DirpartSize + 1)) {
-            for (int i = 0; i < partSize; i++) {
-                free(parts[i]);
-            }
-            for (int i = 0; i < DirpartSize; i++) {
-                free(Dirparts[i]);
-            }
-            ptr = next_ptr;
-            continue;
-        }
-
-        bool isFound = true;
-
-        for (size_t i = 0; i < DirpartSize; i++) {
-            if (i == DirpartSize) {
-                break;
-            }
-            if (strcmp(parts[i], Dirparts[i]) != 0) {
-                isFound = false;
-            }
-        }
-
-        if (isFound) {
-            if (strcmp(parts[partSize - 1], name) == 0){
-                if (file_exists(filenameBuf)) {
-                    if (fileSize == 0x0) {
-                        ks->basicConsole.Println("Size = 0");
-                        return nullptr;
-                    }
-                    void* buffer = malloc(fileSize);
-                    if (!buffer) {
-                        ks->basicConsole.Print(to_hstring((uint64_t)buffer));
-                        ks->basicConsole.Println("malloc failed!");
-                        return nullptr;
-                    }
-                    memcpy(buffer, (void*)file_ptr, fileSize);
-                    return buffer;
+        StringView rest;
+        if (in_dir(filenameBuf, dir, rest) && rest == name) {
+            if (file_exists(filenameBuf)) {
+                if (fileSize == 0x0) {
+                    ks->basicConsole.Println("Size = 0");
+                    return nullptr;
+                }
+                void* buffer = malloc(fileSize);
+                if (!buffer) {
+                    ks->basicConsole.Print(to_hstring((uint64_t)buffer));
+                    ks->basicConsole.Println("malloc failed!");
+                    return nullptr;
                 }
+                memcpy(buffer, (void*)file_ptr, fileSize);
+                return buffer;
             }
         }
 
         ptr = next_ptr;
     }
+    return nullptr;
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "../../Utils/cpu.h"
 #include "../../Utils/utils.h"
 #include "../../Utils/Array/Array.h"
+#include "../../Utils/HashMap/HashMap.h"
+#include "../../Utils/StringView/StringView.h"
 
 struct CPIOHeader {
     char magic[6];
@@ -37,4 +39,6 @@ public:
 private:    
     void* base;
     uint64_t size;
+
+    HashMap<const char*, CPIOHeader*> entries;
 };
\ No newline at end of file
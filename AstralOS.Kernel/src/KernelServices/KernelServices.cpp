@@ -2,7 +2,7 @@
 
 KernelServices* ks;
 
-KernelServices::KernelServices(BootInfo* bootinfo) : basicConsole(bootinfo->pFramebuffer) {
+KernelServices::KernelServices(BootInfo* bootinfo) : basicConsole(bootinfo->pFramebuffer, &serial) {
 	pageFrameAllocator.Initialise(&basicConsole);
 	gdt.Initialize(&basicConsole);
 	ks = this;
@@ -1,4 +1,7 @@
 #pragma once
+#include "Serial/Serial.h"
+#include "Log/Log.h"
+#include "Keyboard/Keyboard.h"
 #include "BasicConsole/BasicConsole.h"
 #include "Paging/PageFrameAllocator/PageFrameAllocator.h"
 #include "Paging/PageTableManager/PageTableManager.h"
@@ -7,6 +10,7 @@
 #include "APIC/APIC.h"
 #include "PIC/PIC.h"
 #include "IOAPIC/IOAPIC.h"
+#include "IRQ/IRQ.h"
 #include "ACPI/ACPI.h"
 #include "Paging/MemoryAlloc/Heap.h"
 #include "PCI/PCI.h"
@@ -15,6 +19,8 @@
 #include "DriverManager/DriverManager.h"
 #include "Timer/Timer.h"
 #include "Filesystem/Filesystem.h"
+#include "IOScheduler/IOScheduler.h"
+#include "BufferCache/BufferCache.h"
 
 struct BootInfo {
 	FrameBuffer pFramebuffer;
@@ -30,6 +36,12 @@ class KernelServices {
 public:
 	KernelServices(BootInfo* bootinfo);
 	
+	/*
+	 * serial has to come before basicConsole,
+	 * since the console writes to it.
+	*/
+	SerialPort serial;
+	KernelLog log;
 	BasicConsole basicConsole;
 	PageFrameAllocator pageFrameAllocator;
 	PageTableManager pageTableManager;
@@ -39,6 +51,7 @@ public:
 	APIC apic;
 	PIC pic;
 	IOAPIC ioapic;
+	IRQManager irq;
 	ACPI acpi;
 	HeapAllocator heapAllocator;
 	PCI pci;
@@ -49,6 +62,9 @@ public:
 	APICTimer timer;
 	PIT pit;
 	VFS vfs;
+	IOScheduler iosched;
+	BufferCache bcache;
+	Keyboard keyboard;
 };
 
 extern KernelServices* ks;
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "Keyboard.h"
+#include "../KernelServices.h"
+
+/*
+ * Scancode set 1. 2 is backspace and 3 is
+ * enter, 0 means we ignore the key.
+*/
+static const char ScancodeKeys[59] = {
+    0, 0, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', 2,
+    0, 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', 3, 
+    0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`', 0,
+    '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0, 0, 0, ' '
+};
+static const char ShiftScancodeKeys[59] = {
+    0, 0, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', 2,
+    0, 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', 3, 
+    0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~', 0,
+    '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0, 0, 0, ' '
+};
+
+#define KEY_BACKSPACE 2
+#define KEY_ENTER     3
+
+void Keyboard::Initialize(uint8_t vector) {
+    ks->irq.RequestIRQ(vector, [](uint8_t, void* ctx) {
+        ((Keyboard*)ctx)->HandleInterrupt();
+        return true;
+    }, this);
+    ks->irq.RouteIRQ(KEYBOARD_IRQ, vector);
+}
+
+/*
+ * This is all the IRQ does now. If the ring is
+ * full we drop the key, since nobody is reading
+ * them anyway.
+*/
+void Keyboard::HandleInterrupt() {
+    uint8_t scancode = inb(0x60);
+
+    uint32_t h = head;
+    if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= RingSize) {
+        dropped++;
+        return;
+    }
+    ring[h & (RingSize - 1)] = scancode;
+    __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+}
+
+bool Keyboard::ReadScancode(uint8_t& scancode) {
+    uint32_t t = tail;
+    if (t == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    scancode = ring[t & (RingSize - 1)];
+    __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * Sleeps until a key comes in. We check the
+ * ring with interrupts off, and `sti; hlt`
+ * can't be interrupted in between (sti only
+ * takes effect after the next instruction), so
+ * a key can't sneak in after we checked and
+ * leave us asleep.
+ *
+ * Any interrupt wakes us up, so this is also
+ * where the kernel log gets rendered while the
+ * shell is idle.
+*/
+void Keyboard::WaitForScancode() {
+    while (true) {
+        ks->log.Render();
+        ks->basicConsole.Flush();
+
+        asm volatile("cli" : : : "memory");
+        if (tail != head) {
+            asm volatile("sti" : : : "memory");
+            return;
+        }
+        asm volatile("sti; hlt" : : : "memory");
+    }
+}
+
+/*
+ * The line discipline. Reads keys until enter,
+ * echoing them as we go, and gives back the
+ * line (which the caller owns).
+*/
+char* Keyboard::ReadLine() {
+    char line[MaxLine];
+    size_t len = 0;
+
+    while (true) {
+        uint8_t scancode;
+        if (!ReadScancode(scancode)) {
+            WaitForScancode();
+            continue;
+        }
+
+        if (scancode == 0x2A || scancode == 0x36) {
+            shift = true;
+            continue;
+        } else if (scancode == 0xAA || scancode == 0xB6) {
+            shift = false;
+            continue;
+        }
+        if (scancode >= sizeof(ScancodeKeys)) {
+            continue;
+        }
+
+        char key = shift ? ShiftScancodeKeys[scancode] : ScancodeKeys[scancode];
+        if (key == 0) {
+            continue;
+        } else if (key == KEY_BACKSPACE) {
+            if (len > 0) {
+                len--;
+                ks->basicConsole.Backspace();
+            }
+        } else if (key == KEY_ENTER) {
+            ks->basicConsole.Print("\n");
+            line[len] = '\0';
+            return strdup(line);
+        } else if (len < MaxLine - 1) {
+            line[len++] = key;
+            char str[2] = { key, '\0' };
+            ks->basicConsole.Print(str);
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+#define KEYBOARD_IRQ    1
+#define KEYBOARD_VECTOR 0x21
+
+/*
+ * The PS/2 keyboard.
+ *
+ * The IRQ handler only reads the scancode and
+ * puts it in a ring. Everything else (shift,
+ * echoing, building the line) happens in
+ * ReadLine, outside of the interrupt.
+ *
+ * There's exactly one producer (the IRQ) and
+ * one consumer (whoever is reading input), so
+ * the ring doesn't need a lock, just the right
+ * order of loads and stores.
+*/
+class Keyboard {
+public:
+    void Initialize(uint8_t vector);
+    void HandleInterrupt();
+
+    bool ReadScancode(uint8_t& scancode);
+    char* ReadLine();
+private:
+    static constexpr size_t RingSize = 256;
+    static constexpr size_t MaxLine = 256;
+
+    void WaitForScancode();
+
+    uint8_t ring[RingSize];
+    volatile uint32_t head = 0;
+    volatile uint32_t tail = 0;
+    uint64_t dropped = 0;
+
+    bool shift = false;
+};
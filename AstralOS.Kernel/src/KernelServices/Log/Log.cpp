@@ -0,0 +1,187 @@
+#include "Log.h"
+#include "../KernelServices.h"
+#include "../../Utils/kprintf/kprintf.h"
+
+/*
+ * 512 lines, 64KB. It has to be a power of 2.
+ * It lives here instead of in KernelLog, since
+ * KernelServices starts out on a small stack.
+*/
+static constexpr uint64_t LogRingSize = 512;
+static LogRecord LogRing[LogRingSize];
+
+static const char* LevelNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+static const unsigned int LevelColours[] = { 0xff808080, 0xffffffff, 0xffffff00, 0xffff4040 };
+
+KernelLog::KernelLog() {
+    bootTSC = rdtsc();
+    sinkLevels[LOG_SINK_CONSOLE] = LOG_INFO;
+    sinkLevels[LOG_SINK_SERIAL] = LOG_DEBUG;
+}
+
+/*
+ * Grabbing a slot is one atomic add, so any
+ * number of CPUs (or interrupts) can log at
+ * the same time. The seq store at the end is
+ * what tells Render the record is finished.
+*/
+void KernelLog::Write(LogLevel level, const char* fmt, va_list args) {
+    uint64_t slot = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    LogRecord& rec = LogRing[slot & (LogRingSize - 1)];
+
+    __atomic_store_n(&rec.seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    rec.tsc = rdtsc();
+    rec.level = level;
+    kvsnprintf(rec.text, sizeof(rec.text), fmt, args);
+
+    __atomic_store_n(&rec.seq, slot + 1, __ATOMIC_RELEASE);
+
+    /*
+     * Errors go out right away, unless we came
+     * in from an interrupt in the middle of a
+     * Draw. Then the next tick (or Input) picks
+     * the record up, same as TimerTick does.
+    */
+    if (level >= LOG_ERROR && !ks->basicConsole.drawing) {
+        Render();
+    }
+}
+
+void KernelLog::SetSinkLevel(LogSink sink, LogLevel level) {
+    if (sink < LOG_SINK_COUNT) {
+        sinkLevels[sink] = level;
+    }
+}
+
+/*
+ * Until this gets set, timestamps are just
+ * raw TSC ticks since boot.
+*/
+void KernelLog::SetTSCPerMs(uint64_t ticks) {
+    tscPerMs = ticks;
+}
+
+void KernelLog::FormatLine(const LogRecord& rec, char* buf, size_t size) {
+    uint64_t ticks = rec.tsc - bootTSC;
+    const char* level = rec.level <= LOG_ERROR ? LevelNames[rec.level] : "?";
+
+    if (tscPerMs == 0) {
+        ksnprintf(buf, size, "[%12lu] %-5s %s\n", ticks, level, rec.text);
+        return;
+    }
+
+    uint64_t us = ticks / (tscPerMs / 1000 ? tscPerMs / 1000 : 1);
+    ksnprintf(buf, size, "[%5lu.%06lu] %-5s %s\n", us / 1000000, us % 1000000, level, rec.text);
+}
+
+void KernelLog::Emit(const LogRecord& rec, bool force) {
+    char line[160];
+    FormatLine(rec, line, sizeof(line));
+
+    unsigned int colour = rec.level <= LOG_ERROR ? LevelColours[rec.level] : 0xffffffff;
+    if (force || rec.level >= sinkLevels[LOG_SINK_CONSOLE]) {
+        ks->basicConsole.Draw(line, colour);
+    }
+    if (force || rec.level >= sinkLevels[LOG_SINK_SERIAL]) {
+        ks->serial.Write(line);
+    }
+}
+
+/*
+ * Copies a record out of the ring, and gives
+ * back false if it isn't finished yet. If it
+ * got overwritten while we were copying, seq
+ * will have changed and we try again.
+*/
+static bool ReadRecord(uint64_t pos, LogRecord& out, uint64_t& seq) {
+    const LogRecord& rec = LogRing[pos & (LogRingSize - 1)];
+    while (true) {
+        seq = __atomic_load_n(&rec.seq, __ATOMIC_ACQUIRE);
+        if (seq != pos + 1) {
+            return false;
+        }
+
+        memcpy(&out, (const void*)&rec, sizeof(LogRecord));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&rec.seq, __ATOMIC_RELAXED) == seq) {
+            return true;
+        }
+    }
+}
+
+/*
+ * Sends every finished record we haven't sent
+ * yet to the sinks that want it. Only one of
+ * these runs at a time, and we don't render
+ * from the timer if it interrupted the console
+ * in the middle of drawing.
+*/
+void KernelLog::Render() {
+    if (__atomic_exchange_n(&rendering, true, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    uint64_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    while (rendered < end) {
+        /*
+         * If producers lapped us, the oldest ones
+         * are gone. Skip to what's still there.
+        */
+        if (end - rendered > LogRingSize) {
+            lost += end - rendered - LogRingSize;
+            rendered = end - LogRingSize;
+        }
+
+        LogRecord rec;
+        uint64_t seq;
+        if (!ReadRecord(rendered, rec, seq)) {
+            if (seq > rendered + 1) {
+                lost++;
+                rendered++;
+                continue;
+            }
+
+            /*
+             * Someone is still writing this one,
+             * we'll get it next time.
+            */
+            break;
+        }
+
+        Emit(rec, false);
+        rendered++;
+    }
+
+    if (lost) {
+        kprintf("[log: %lu lines were lost]\n", lost);
+        lost = 0;
+    }
+
+    __atomic_store_n(&rendering, false, __ATOMIC_RELEASE);
+}
+
+/*
+ * Prints every line that is still in the ring,
+ * no matter what level the sinks are set to.
+*/
+void KernelLog::Dump() {
+    uint64_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint64_t pos = end > LogRingSize ? end - LogRingSize : 0;
+
+    for (; pos < end; pos++) {
+        LogRecord rec;
+        uint64_t seq;
+        if (ReadRecord(pos, rec, seq)) {
+            Emit(rec, true);
+        }
+    }
+}
+
+void klog(LogLevel level, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    ks->log.Write(level, fmt, args);
+    va_end(args);
+}
@@ -940,13 +940,28 @@ char* PCI::GetDeviceCode(uint8_t ClassCode, uint8_t SubClass, uint8_t ProgIF) {
             return "Unassigned Class";
             break;
         default:
-            return (char*)((String)"Unknown Class Code: " + to_hstring(ClassCode) + ", " + " SubClass: " + to_hstring(SubClass) + " ProgIF: " + to_hstring(ProgIF)).c_str();
+        {
+            /*
+             * We return a char*, so the text can't
+             * live in a String that dies when we
+             * return. It goes in a static buffer,
+             * just like to_hstring does.
+            */
+            static char unknown[64];
+            StringBuilder sb;
+            sb.Append("Unknown Class Code: ").Append(to_hstring(ClassCode))
+              .Append(",  SubClass: ").Append(to_hstring(SubClass))
+              .Append(" ProgIF: ").Append(to_hstring(ProgIF));
+            strncpy(unknown, sb.c_str(), sizeof(unknown));
+            return unknown;
+        }
             break;
     };
 }
 
 void PCI::Initialize() {
     Devices.clear();
+    FoundDevices.clear();
     checkAllBuses();
 }
 
@@ -958,15 +973,17 @@ uint8_t PCI::getHeaderType(uint8_t bus, uint8_t device, uint8_t function) {
     return ConfigReadWord(bus, device, function, 0x0E);
 }
 
+/*
+ * The bus, device and function fit into
+ * 16 bits (8 + 5 + 3), so we can use that
+ * as the key into FoundDevices.
+*/
+static uint16_t DeviceLocation(uint8_t bus, uint8_t device, uint8_t function) {
+    return ((uint16_t)bus << 8) | ((uint16_t)(device & 0x1F) << 3) | (function & 0x7);
+}
+
 bool PCI::deviceAlreadyFound(uint8_t bus, uint8_t device, uint8_t function) {
-    for (size_t i = 0; i < Devices.size(); i++) {
-        if (Devices[i].bus == bus &&
-            Devices[i].device == device &&
-            Devices[i].function == function) {
-            return true;
-        }
-    }
-    return false;
+    return FoundDevices.contains(DeviceLocation(bus, device, function));
 }
 
 void PCI::addDevice(uint8_t bus, uint8_t device, uint8_t function, bool hasMSI, uint16_t vendorID, uint8_t classCode, uint8_t subClass, uint8_t progIF) {
@@ -990,6 +1007,7 @@ void PCI::addDevice(uint8_t bus, uint8_t device, uint8_t function, bool hasMSI,
     }
 
     Devices.push_back(dev);
+    FoundDevices.insert(DeviceLocation(bus, device, function), true);
 }
 
 /*
@@ -1027,13 +1045,12 @@ void PCI::checkFunction(uint8_t bus, uint8_t device, uint8_t function) {
 
     addDevice(bus, device, function, hasMSI, vendorID, classCode, subclass, progIF);
 
-    ks->basicConsole.Println(GetDeviceCode(classCode, subclass, progIF));
+    klog(LOG_INFO, "PCI %02X:%02X.%X %s", bus, device, function, GetDeviceCode(classCode, subclass, progIF));
 
     if (classCode == 0x06 && subclass == 0x04) {
-        ks->basicConsole.Println("Checking Bus: ");
         uint8_t secondaryBus = ConfigReadWord(bus, device, function, 0x19) & 0xFF;
+        klog(LOG_DEBUG, "Checking Bus %02X", secondaryBus);
         checkBus(secondaryBus);
-        ks->basicConsole.Println("Checked Bus");
     }
 }
 
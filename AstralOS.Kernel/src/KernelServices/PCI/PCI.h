@@ -2,6 +2,7 @@
 #include <tuple>
 #include "../../Utils/cpu.h"
 #include "../../Utils/Array/Array.h"
+#include "../../Utils/HashMap/HashMap.h"
 
 /*
  * This code is from the OSDev Wiki:
@@ -569,6 +570,7 @@ public:
     Array<DeviceKey> GetDevices();
 private:
     Array<DeviceKey> Devices;
+    HashMap<uint16_t, bool> FoundDevices;
 
     bool deviceAlreadyFound(uint8_t bus, uint8_t device, uint8_t function);
     void addDevice(uint8_t bus, uint8_t device, uint8_t function, bool hasMSI, uint16_t vendorID, uint8_t classCode, uint8_t subClass, uint8_t progIF);
@@ -1,6 +1,8 @@
 #include "PCIe.h"
 #include "../KernelServices.h"
 
+#define HIGHER_VIRT_ADDR 0xFFFFFFFF00000000
+
 void PCIe::Initialize() {
     numSegments = (mcfgTable->Length - sizeof(MCFG)) / sizeof(MCFGEntry);
     checkAllSegments();
@@ -9,6 +11,7 @@ void PCIe::Initialize() {
 void PCIe::InitializePCIe(MCFG* mcfg) {
     mcfgTable = mcfg;
     Devices.clear();
+    FoundDevices.clear();
 }
 
 /*
@@ -119,7 +122,7 @@ void PCIe::checkFunction(uint64_t baseAddress, uint16_t segment, uint8_t bus, ui
     uint8_t subclass = hdr->Subclass;
     uint8_t progIF = hdr->ProgIF;
 
-    ks->basicConsole.Println(GetDeviceCode(classCode, subclass, progIF));
+    klog(LOG_INFO, "PCIe %02X:%02X.%X %s", bus, device, function, GetDeviceCode(classCode, subclass, progIF));
 
     addDevice(segment, bus, device, function, hasMSIx, vendorID, classCode, subclass, progIF);
 
@@ -988,16 +991,18 @@ uint8_t PCIe::getHeaderType(uint16_t segment, uint8_t bus, uint8_t device, uint8
     return ConfigReadWord(segment, bus, device, function, 0x0E);
 }
 
+/*
+ * The segment, bus, device and function
+ * fit into 32 bits (16 + 8 + 5 + 3), so we
+ * can use that as the key into FoundDevices
+ * instead of walking the whole Devices list.
+*/
+static uint32_t DeviceLocation(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function) {
+    return ((uint32_t)segment << 16) | ((uint32_t)bus << 8) | ((uint32_t)(device & 0x1F) << 3) | (function & 0x7);
+}
+
 bool PCIe::deviceAlreadyFound(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function) {
-    for (int i = 0; i < Devices.size(); i++) {
-        if (Devices[i].segment == segment &&
-            Devices[i].bus == bus &&
-            Devices[i].device == device &&
-            Devices[i].function == function) {
-            return true;
-        }
-    }
-    return false;
+    return FoundDevices.contains(DeviceLocation(segment, bus, device, function));
 }
 
 void PCIe::addDevice(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, bool hasMSIx, uint16_t vendorID, uint8_t classCode, uint8_t subClass, uint8_t progIF) {
@@ -1021,6 +1026,7 @@ void PCIe::addDevice(uint16_t segment, uint8_t bus, uint8_t device, uint8_t func
     }
 
     Devices.push_back(dev);
+    FoundDevices.insert(DeviceLocation(segment, bus, device, function), true);
 }
 
 /*
@@ -1030,6 +1036,253 @@ Array<DeviceKey> PCIe::GetDevices() {
     return Devices;
 }
 
+uint8_t PCIe::FindCapability(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint8_t id) {
+    if (!((ConfigReadWord(segment, bus, device, function, 0x06) >> 4) & 1)) {
+        return 0;
+    }
+
+    uint8_t capPtr = ConfigReadByte(segment, bus, device, function, 0x34) & ~0x3;
+    while (capPtr != 0) {
+        if (ConfigReadByte(segment, bus, device, function, capPtr) == id) {
+            return capPtr;
+        }
+        capPtr = ConfigReadByte(segment, bus, device, function, capPtr + 1) & ~0x3;
+    }
+    return 0;
+}
+
+/*
+ * Finds the MSI-X capability, maps the table
+ * out of whatever BAR it lives in and turns
+ * MSI-X on with every entry masked. We only
+ * do this once per device, after that we just
+ * hand back what we saved.
+ *
+ * Turning MSI-X on also means the device stops
+ * using its INTx pin, and it needs bus mastering
+ * since an MSI is just a memory write.
+*/
+MSIXState* PCIe::SetupMSIx(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function) {
+    uint32_t loc = DeviceLocation(segment, bus, device, function);
+    if (MSIXState* msix = MSIXDevices.find(loc)) {
+        return msix;
+    }
+
+    uint8_t capPtr = FindCapability(segment, bus, device, function, 0x11);
+    if (capPtr == 0) {
+        return nullptr;
+    }
+
+    uint16_t mc = ConfigReadWord(segment, bus, device, function, capPtr + 2);
+    uint32_t tableReg = ConfigReadDWord(segment, bus, device, function, capPtr + 4);
+    uint8_t bir = tableReg & 0x7;
+    uint32_t tableOffset = tableReg & ~0x7;
+    uint16_t tableSize = (mc & 0x7FF) + 1;
+
+    if (bir > 5) {
+        return nullptr;
+    }
+
+    uint32_t bar = ConfigReadDWord(segment, bus, device, function, 0x10 + bir * 4);
+    if (bar & 1) {
+        klog(LOG_WARN, "PCIe %02X:%02X.%X MSI-X table is in an I/O BAR", bus, device, function);
+        return nullptr;
+    }
+
+    uint64_t barPhys = bar & ~0xFULL;
+    if (((bar >> 1) & 0x3) == 0x2 && bir < 5) {
+        barPhys |= (uint64_t)ConfigReadDWord(segment, bus, device, function, 0x10 + (bir + 1) * 4) << 32;
+    }
+
+    /*
+     * BARs under 4GB go in the higher half like
+     * every other MMIO we map, anything above
+     * that just gets mapped where it is.
+    */
+    uint64_t tablePhys = barPhys + tableOffset;
+    uint64_t base = tablePhys < 0x100000000ULL ? HIGHER_VIRT_ADDR : 0;
+    uint64_t firstPage = tablePhys & ~0xFFFULL;
+    uint64_t lastPage = (tablePhys + tableSize * sizeof(MSIXEntry) - 1) & ~0xFFFULL;
+    for (uint64_t page = firstPage; page <= lastPage; page += 0x1000) {
+        ks->pageTableManager.MapMemory((void*)(base + page), (void*)page, false);
+    }
+
+    MSIXState state;
+    state.capPtr = capPtr;
+    state.tableSize = tableSize;
+    state.table = (volatile MSIXEntry*)(base + tablePhys);
+    state.count = 0;
+    state.vectors = nullptr;
+    state.entry0Taken = false;
+
+    ConfigWriteWord(segment, bus, device, function, capPtr + 2, mc | MSIX_MC_ENABLE | MSIX_MC_FUNC_MASK);
+    for (uint16_t i = 0; i < tableSize; i++) {
+        state.table[i].VectorControl |= MSIX_ENTRY_MASKED;
+    }
+
+    uint16_t cmd = ConfigReadWord(segment, bus, device, function, 0x04);
+    cmd |= (1 << 2) | (1 << 10);
+    ConfigWriteWord(segment, bus, device, function, 0x04, cmd);
+
+    mc = ConfigReadWord(segment, bus, device, function, capPtr + 2);
+    ConfigWriteWord(segment, bus, device, function, capPtr + 2, mc & ~MSIX_MC_FUNC_MASK);
+
+    MSIXDevices.insert(loc, state);
+    klog(LOG_DEBUG, "PCIe %02X:%02X.%X MSI-X table at 0x%lX, %u entries", bus, device, function, tablePhys, tableSize);
+    return MSIXDevices.find(loc);
+}
+
+/*
+ * Fixed delivery, edge triggered, physical
+ * destination. The entry has to be masked
+ * while we change it, or the device could
+ * send half of the old and half of the new
+ * message, so we mask it and put the mask
+ * back the way it was afterwards.
+*/
+void PCIe::WriteMSIxEntry(MSIXState* msix, uint16_t entry, uint8_t vector, uint8_t apicID) {
+    volatile MSIXEntry* e = &msix->table[entry];
+    uint32_t ctrl = e->VectorControl;
+
+    e->VectorControl = ctrl | MSIX_ENTRY_MASKED;
+    e->MessageAddrLow = 0xFEE00000 | ((uint32_t)apicID << 12);
+    e->MessageAddrHigh = 0;
+    e->MessageData = vector;
+    e->VectorControl = ctrl;
+}
+
+static uint8_t CurrentAPICID() {
+    return ks->apic.ReadAPIC(APICRegs::lapicID) >> 24;
+}
+
+/*
+ * The old single vector version, which just
+ * points entry 0 at `vector` and unmasks it.
+ * The vector stays yours, FreeMSIx won't free
+ * it.
+ *
+ * Entry 0 counts as taken after this, so it
+ * can't be mixed with AllocateMSIx on the same
+ * function until FreeMSIx.
+*/
 bool PCIe::EnableMSIx(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint8_t vector) {
-    ks->basicConsole.Println("MSI-X isn't implemented yet!");
+    MSIXState* msix = SetupMSIx(segment, bus, device, function);
+    if (!msix || msix->count != 0) {
+        return false;
+    }
+
+    WriteMSIxEntry(msix, 0, vector, CurrentAPICID());
+    msix->table[0].VectorControl &= ~MSIX_ENTRY_MASKED;
+    msix->entry0Taken = true;
+    return true;
+}
+
+/*
+ * Gives table entries 0 to count - 1 a vector
+ * each (from the IRQ layer) and points them at
+ * this CPU. The vectors get written to
+ * `vectors`, and you get back how many you
+ * actually got, which can be less than you
+ * asked for if the table is smaller or we ran
+ * out of vectors.
+ *
+ * Every entry starts out masked. Hang your
+ * handlers on the vectors with RequestIRQ,
+ * then unmask them with MaskMSIx.
+*/
+uint16_t PCIe::AllocateMSIx(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t count, uint8_t* vectors) {
+    MSIXState* msix = SetupMSIx(segment, bus, device, function);
+    if (!msix || msix->count != 0 || msix->entry0Taken) {
+        return 0;
+    }
+
+    if (count > msix->tableSize) {
+        count = msix->tableSize;
+    }
+
+    msix->vectors = (uint8_t*)malloc(count);
+    if (!msix->vectors) {
+        return 0;
+    }
+
+    uint8_t apicID = CurrentAPICID();
+    uint16_t got = 0;
+    while (got < count) {
+        uint8_t vector = ks->irq.AllocateVector();
+        if (vector == 0) {
+            break;
+        }
+
+        msix->table[got].VectorControl |= MSIX_ENTRY_MASKED;
+        WriteMSIxEntry(msix, got, vector, apicID);
+        msix->vectors[got] = vector;
+        vectors[got] = vector;
+        got++;
+    }
+
+    msix->count = got;
+    if (got == 0) {
+        free(msix->vectors);
+        msix->vectors = nullptr;
+    }
+    return got;
+}
+
+/*
+ * Masks everything, turns MSI-X off and gives
+ * the vectors back. The table stays mapped,
+ * in case the driver wants them again.
+ * Free your handlers first.
+*/
+void PCIe::FreeMSIx(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function) {
+    uint32_t loc = DeviceLocation(segment, bus, device, function);
+    MSIXState* msix = MSIXDevices.find(loc);
+    if (!msix) {
+        return;
+    }
+
+    for (uint16_t i = 0; i < msix->tableSize; i++) {
+        msix->table[i].VectorControl |= MSIX_ENTRY_MASKED;
+    }
+
+    uint16_t mc = ConfigReadWord(segment, bus, device, function, msix->capPtr + 2);
+    ConfigWriteWord(segment, bus, device, function, msix->capPtr + 2, mc & ~MSIX_MC_ENABLE);
+
+    for (uint16_t i = 0; i < msix->count; i++) {
+        ks->irq.FreeVector(msix->vectors[i]);
+    }
+    free(msix->vectors);
+
+    MSIXDevices.remove(loc);
+}
+
+/*
+ * Sends entry `entry` to the LAPIC with the
+ * ID `apicID` from now on. This is how a
+ * driver with a queue per CPU gets each
+ * queue's completions on its own CPU.
+*/
+bool PCIe::SetMSIxAffinity(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t entry, uint8_t apicID) {
+    MSIXState* msix = MSIXDevices.find(DeviceLocation(segment, bus, device, function));
+    if (!msix || entry >= msix->tableSize) {
+        return false;
+    }
+
+    uint8_t vector = msix->table[entry].MessageData & 0xFF;
+    WriteMSIxEntry(msix, entry, vector, apicID);
+    return true;
+}
+
+bool PCIe::MaskMSIx(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t entry, bool mask) {
+    MSIXState* msix = MSIXDevices.find(DeviceLocation(segment, bus, device, function));
+    if (!msix || entry >= msix->tableSize) {
+        return false;
+    }
+
+    if (mask) {
+        msix->table[entry].VectorControl |= MSIX_ENTRY_MASKED;
+    } else {
+        msix->table[entry].VectorControl &= ~MSIX_ENTRY_MASKED;
+    }
+    return true;
 }
\ No newline at end of file
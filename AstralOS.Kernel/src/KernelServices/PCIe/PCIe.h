@@ -1,6 +1,7 @@
 #pragma once
 #include "../PCI/PCI.h"
 #include "../ACPI/ACPI.h"
+#include "../../Utils/HashMap/HashMap.h"
 
 struct PCIDeviceHeader {
     uint16_t VendorID;
@@ -64,6 +65,39 @@ struct MSIX {
     }
 } __attribute__((packed));
 
+/*
+ * One entry in a device's MSI-X table.
+ * Each one is a separate interrupt with its
+ * own vector, target CPU and mask bit.
+*/
+struct MSIXEntry {
+    uint32_t MessageAddrLow;
+    uint32_t MessageAddrHigh;
+    uint32_t MessageData;
+    uint32_t VectorControl;
+} __attribute__((packed));
+
+#define MSIX_ENTRY_MASKED   (1 << 0)
+#define MSIX_MC_ENABLE      (1 << 15)
+#define MSIX_MC_FUNC_MASK   (1 << 14)
+
+/*
+ * What we know about a device once its MSI-X
+ * table is mapped. vectors[i] is the vector
+ * we gave table entry i (count of them),
+ * those are ours to free again. entry0Taken
+ * means EnableMSIx is using entry 0 with a
+ * vector the driver owns.
+*/
+struct MSIXState {
+    uint8_t capPtr;
+    uint16_t tableSize;
+    volatile MSIXEntry* table;
+    uint16_t count;
+    uint8_t* vectors;
+    bool entry0Taken;
+};
+
 class PCIe {
 public:
     PCIe() {}
@@ -80,6 +114,10 @@ public:
     void checkBus(uint64_t baseAddr, uint16_t segment, uint8_t bus);
 
     bool EnableMSIx(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint8_t vector);
+    uint16_t AllocateMSIx(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t count, uint8_t* vectors);
+    void FreeMSIx(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function);
+    bool SetMSIxAffinity(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t entry, uint8_t apicID);
+    bool MaskMSIx(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t entry, bool mask);
 
     Array<DeviceKey> GetDevices();
 
@@ -90,11 +128,17 @@ public:
     uint32_t ConfigReadDWord(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
 private:
     Array<DeviceKey> Devices;
+    HashMap<uint32_t, bool> FoundDevices;
+    HashMap<uint32_t, MSIXState> MSIXDevices;
     MCFG* mcfgTable;
     int numSegments;
 
     volatile uint32_t* GetECAMBase(uint16_t segment);
 
+    uint8_t FindCapability(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint8_t id);
+    MSIXState* SetupMSIx(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function);
+    void WriteMSIxEntry(MSIXState* msix, uint16_t entry, uint8_t vector, uint8_t apicID);
+
     bool deviceAlreadyFound(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function);
     void addDevice(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, bool hasMSIx, uint16_t vendorID, uint8_t classCode, uint8_t subClass, uint8_t progIF);
     
@@ -33,13 +33,5 @@ uint64_t GetMemorySize(EFI_MEMORY_DESCRIPTOR* mMap, uint64_t mMapEntries, uint64
 }
 
 extern "C" void memsetC(void* start, uint8_t value, uint64_t num) {
-    for (uint64_t i = 0; i < num; i++) {
-        *(uint8_t*)((uint64_t)start + i) = value;
-    }
-}
-
-void memset(void* start, uint8_t value, uint64_t num) {
-    for (uint64_t i = 0; i < num; i++) {
-        *(uint8_t*)((uint64_t)start + i) = value;
-    }
+    memset(start, value, num);
 }
\ No newline at end of file
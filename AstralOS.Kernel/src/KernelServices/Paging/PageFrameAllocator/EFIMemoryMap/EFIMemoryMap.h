@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include "../../../../Utils/utils.h"
 
 /*
 * EFI_MEMORY_DESCRIPTOR
@@ -44,5 +45,4 @@ extern const char* EFI_MEMORY_TYPE_STRINGS[];
 
 uint64_t GetMemorySize(EFI_MEMORY_DESCRIPTOR* mMap, uint64_t mMapEntries, uint64_t mMapDescSize);
 
-extern "C" void memsetC(void* start, uint8_t value, uint64_t num);
-void memset(void* start, uint8_t value, uint64_t num);
\ No newline at end of file
+extern "C" void memsetC(void* start, uint8_t value, uint64_t num);
\ No newline at end of file
@@ -183,4 +183,37 @@ void* PageFrameAllocator::RequestPage() {
 
     basicConsole->Println("Failed to RequestPage");
     return NULL;
-}
\ No newline at end of file
+}
+
+/*
+ * Finds pageCount free pages in a row, for
+ * things like DMA buffers where the device
+ * needs one physically contiguous block.
+*/
+void* PageFrameAllocator::RequestPages(uint64_t pageCount) {
+    if (pageCount == 0) {
+        return NULL;
+    }
+
+    uint64_t runStart = 0;
+    uint64_t runLength = 0;
+    for (uint64_t index = 0; index < total_pages && index < page_bitmap.size * 8; index++) {
+        if (page_bitmap[index] == true) {
+            runLength = 0;
+            continue;
+        }
+
+        if (runLength == 0) {
+            runStart = index;
+        }
+        runLength++;
+
+        if (runLength == pageCount) {
+            LockPages((void*)(runStart * 4096), pageCount);
+            return (void*)(runStart * 4096);
+        }
+    }
+
+    basicConsole->Println("Failed to RequestPages");
+    return NULL;
+}
@@ -20,6 +20,7 @@ public:
     void FreePage(void* address);
     void FreePages(void* address, uint64_t pageCount);
     void* RequestPage();
+    void* RequestPages(uint64_t pageCount);
 
     uint64_t GetFreeRAM();
     uint64_t GetUsedRAM();
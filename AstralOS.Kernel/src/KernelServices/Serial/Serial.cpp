@@ -0,0 +1,182 @@
+#include "Serial.h"
+#include "../KernelServices.h"
+
+/*
+ * There's only one COM1, so the ring can just
+ * live here. It has to be a power of 2.
+*/
+static constexpr size_t TxRingSize = 16 * 1024;
+static constexpr size_t TxFIFOSize = 16;
+static char TxRing[TxRingSize];
+
+enum UARTRegs {
+    UART_DATA = 0,
+    UART_IER  = 1,
+    UART_IIR  = 2,
+    UART_FCR  = 2,
+    UART_LCR  = 3,
+    UART_MCR  = 4,
+    UART_LSR  = 5
+};
+
+#define UART_LSR_THRE 0x20
+#define UART_IER_THRE 0x02
+
+static bool TransmitEmpty() {
+    return inb(COM1_PORT + UART_LSR) & UART_LSR_THRE;
+}
+
+static void WritePolling(char c) {
+    while (!TransmitEmpty());
+    outb(COM1_PORT + UART_DATA, c);
+}
+
+/*
+ * 38400 baud (divisor 3), 8N1, FIFOs on. The MCR turns on
+ * OUT2 as well, which is what actually lets the
+ * UART's interrupt out to the IOAPIC on a PC.
+*/
+SerialPort::SerialPort() {
+    outb(COM1_PORT + UART_IER, 0x00);
+    outb(COM1_PORT + UART_LCR, 0x80);
+    outb(COM1_PORT + UART_DATA, 0x03);
+    outb(COM1_PORT + UART_IER, 0x00);
+    outb(COM1_PORT + UART_LCR, 0x03);
+    outb(COM1_PORT + UART_FCR, 0xC7);
+    outb(COM1_PORT + UART_MCR, 0x0B);
+}
+
+/*
+ * The ring gets touched by Write and by the
+ * interrupt, so we turn interrupts off while
+ * we hold the lock. The spinning is just for
+ * when we have more than one CPU.
+*/
+uint64_t SerialPort::Lock() {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    while (__atomic_exchange_n(&lock, true, __ATOMIC_ACQUIRE)) {
+        asm volatile("pause");
+    }
+    return flags;
+}
+
+void SerialPort::Unlock(uint64_t flags) {
+    __atomic_store_n(&lock, false, __ATOMIC_RELEASE);
+    if (flags & (1 << 9)) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+/*
+ * If the ring is full, we send the oldest byte
+ * ourselves to make room. That's slow, but it
+ * only happens if someone logs more than 16KB
+ * faster than the UART can keep up, and it
+ * means we never lose any output.
+*/
+void SerialPort::Push(char c) {
+    if (head - tail >= TxRingSize) {
+        WritePolling(TxRing[tail & (TxRingSize - 1)]);
+        tail++;
+    }
+    TxRing[head & (TxRingSize - 1)] = c;
+    head++;
+}
+
+/*
+ * If the UART's FIFO is empty, fill it back up
+ * from the ring. The UART interrupts us again
+ * once it has sent all of it.
+*/
+void SerialPort::Pump() {
+    if (!TransmitEmpty()) {
+        return;
+    }
+
+    for (size_t i = 0; i < TxFIFOSize && tail != head; i++) {
+        outb(COM1_PORT + UART_DATA, TxRing[tail & (TxRingSize - 1)]);
+        tail++;
+    }
+}
+
+void SerialPort::Write(const char* str) {
+    Write(str, strlen(str));
+}
+
+void SerialPort::Write(const char* buf, size_t len) {
+    if (!irqEnabled || panicking) {
+        for (size_t i = 0; i < len; i++) {
+            if (buf[i] == '\n') {
+                WritePolling('\r'); // so newlines look right
+            }
+            WritePolling(buf[i]);
+        }
+        return;
+    }
+
+    uint64_t flags = Lock();
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == '\n') {
+            Push('\r');
+        }
+        Push(buf[i]);
+    }
+    Pump();
+    Unlock(flags);
+}
+
+static bool SerialIRQ(uint8_t, void* ctx) {
+    return ((SerialPort*)ctx)->HandleInterrupt();
+}
+
+/*
+ * IRQ 4 goes through the IOAPIC to `vector`,
+ * and the IRQ layer calls HandleInterrupt.
+*/
+bool SerialPort::EnableInterrupts(uint8_t vector) {
+    if (!ks->irq.RequestIRQ(vector, SerialIRQ, this)) {
+        return false;
+    }
+    if (!ks->irq.RouteIRQ(COM1_IRQ, vector)) {
+        ks->irq.FreeIRQ(vector, SerialIRQ, this);
+        return false;
+    }
+
+    irqEnabled = true;
+    outb(COM1_PORT + UART_IER, UART_IER_THRE);
+    return true;
+}
+
+/*
+ * Reading the IIR tells the UART we saw the
+ * interrupt. Then we just keep the FIFO fed.
+ * Bit 0 of the IIR is clear if the UART
+ * actually wanted something.
+*/
+bool SerialPort::HandleInterrupt() {
+    uint8_t iir = inb(COM1_PORT + UART_IIR);
+
+    uint64_t flags = Lock();
+    Pump();
+    Unlock(flags);
+    return !(iir & 1);
+}
+
+/*
+ * Once we panic, interrupts are off for good,
+ * so we send whatever is still in the ring and
+ * go back to waiting on the UART for every byte.
+ *
+ * We don't take the lock here, because whoever
+ * was holding it might be what just crashed.
+*/
+void SerialPort::Panic() {
+    panicking = true;
+    outb(COM1_PORT + UART_IER, 0x00);
+
+    while (tail != head) {
+        WritePolling(TxRing[tail & (TxRingSize - 1)]);
+        tail++;
+    }
+}
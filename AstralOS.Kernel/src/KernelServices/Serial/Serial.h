@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+#define COM1_PORT   0x3F8
+#define COM1_IRQ    4
+#define COM1_VECTOR 0x24
+
+/*
+ * COM1, which is where all of our logging
+ * ends up (besides the screen).
+ *
+ * Sending a byte at 38400 baud takes about
+ * 260us, so waiting for the UART on every
+ * byte makes every log line stall the CPU
+ * for milliseconds. Instead, Write just
+ * copies into a ring buffer, and the UART
+ * interrupt (THRE, "the transmit buffer is
+ * empty") sends the next 16 bytes whenever
+ * the FIFO runs dry.
+ *
+ * Until EnableInterrupts gets called (and
+ * after a panic), Write sends the bytes
+ * itself and waits for the UART like it
+ * always did.
+*/
+class SerialPort {
+public:
+    SerialPort();
+
+    void Write(const char* str);
+    void Write(const char* buf, size_t len);
+
+    bool EnableInterrupts(uint8_t vector);
+    bool HandleInterrupt();
+    void Panic();
+
+    bool InterruptsEnabled() const { return irqEnabled; }
+private:
+    void Pump();
+    void Push(char c);
+
+    uint64_t Lock();
+    void Unlock(uint64_t flags);
+
+    /*
+     * head is where Write puts the next byte,
+     * tail is the next byte we send. They only
+     * ever go up, and we mask them when we
+     * index the ring.
+    */
+    volatile uint64_t head = 0;
+    volatile uint64_t tail = 0;
+    volatile bool lock = false;
+    bool irqEnabled = false;
+    volatile bool panicking = false;
+};
@@ -25,6 +25,12 @@ void APICTimer::sleep(uint64_t ms) {
         return;
     }
 
+    /*
+     * Start the count over, a Wakeup (or the
+     * count from Calibrate) might have already
+     * run down to 0, and then it doesn't move.
+    */
+    ks->apic.WriteAPIC(APICRegs::ICT, 0xFFFFFFFF);
     uint32_t start = ks->apic.ReadAPIC(APICRegs::CCT);
     uint32_t ticks_needed = ms * ticks_per_ms;
 
@@ -33,6 +39,22 @@ void APICTimer::sleep(uint64_t ms) {
     }
 }
 
+/*
+ * The timer is one-shot, so nothing ticks on
+ * its own. A driver that's about to hlt for its
+ * IRQ calls this first, so that if the IRQ gets
+ * lost we still wake up in `ms` and can poll.
+*/
+void APICTimer::Wakeup(uint64_t ms) {
+    if (ticks_per_ms == 0) {
+        return;
+    }
+
+    uint64_t count = ms * ticks_per_ms;
+    if (count > 0xFFFFFFFF) count = 0xFFFFFFFF;
+    ks->apic.WriteAPIC(APICRegs::ICT, (uint32_t)count);
+}
+
 void APICTimer::Calibrate() {
     const uint32_t pit_delay_ms = 50;
 
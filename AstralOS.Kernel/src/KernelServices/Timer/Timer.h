@@ -9,6 +9,7 @@ public:
     void Initialize(uint32_t vector, bool periodic, uint32_t initial_count, uint8_t divide_config);
 
     void sleep(uint64_t ms);
+    void Wakeup(uint64_t ms);
     void Calibrate();
 public:
     volatile uint64_t g_ticks = 0;
@@ -134,8 +134,24 @@ extern "C" void InitializePaging(KernelServices* kernelServices, BootInfo* pBoot
 }
 
 IDTR64 idtr;
+
+/*
+ * The APIC timer. Besides counting ticks, this
+ * is where the log and the console's shadow
+ * buffer get pushed out to the screen.
+*/
+static bool TimerTick(uint8_t, void*) {
+    ks->timer.g_ticks++;
+    if (!ks->basicConsole.drawing) {
+        ks->log.Render();
+    }
+    ks->basicConsole.Tick();
+    return true;
+}
+
 extern "C" void InitializeIDT(KernelServices* kernelServices, BootInfo* pBootInfo) {
     kernelServices->idt.CreateIDT();
+    kernelServices->irq.RequestIRQ(0x20, TimerTick, nullptr);
     kernelServices->basicConsole.Println("Interrupts Initialized.");
     if (kernelServices->apic.CheckAPIC()) {
         kernelServices->basicConsole.Println("APIC is Supported.");
@@ -154,6 +170,15 @@ extern "C" void InitializeIDT(KernelServices* kernelServices, BootInfo* pBootInf
          */
         kernelServices->ioapic.Initialize(&kernelServices->basicConsole, (HIGHER_VIRT_ADDR + kernelServices->acpi.GetIOAPIC()->IOAPIC_Addr), kernelServices->acpi.GetIOAPIC()->IOAPIC_ID, kernelServices->acpi.GetIOAPIC()->GSI_Base);
         kernelServices->basicConsole.Println("APIC is Enabled.");
+
+        /*
+         * Now serial output can go through
+         * the UART's interrupt instead of
+         * us waiting on it.
+        */
+        if (!kernelServices->serial.EnableInterrupts(COM1_VECTOR)) {
+            kernelServices->basicConsole.Println("Serial interrupts not available, polling COM1.");
+        }
     }
 
     __asm__ volatile ("sti");
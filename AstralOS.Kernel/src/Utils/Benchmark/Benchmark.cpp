@@ -0,0 +1,830 @@
+#include "Benchmark.h"
+#include "../../KernelServices/KernelServices.h"
+#include "../kprintf/kprintf.h"
+
+/*
+ * Every test moves at least this much data,
+ * so that small sizes run enough times to
+ * get a number that means something.
+*/
+static constexpr uint64_t BenchBytes = 64 * 1024 * 1024;
+static constexpr uint64_t BenchMaxSize = 8 * 1024 * 1024;
+
+static const uint64_t BenchSizes[] = {
+    64,
+    4 * 1024,
+    64 * 1024,
+    1024 * 1024,
+    BenchMaxSize
+};
+
+uint64_t TSCTicksPerMs() {
+    static uint64_t ticksPerMs = 0;
+    if (ticksPerMs) {
+        return ticksPerMs;
+    }
+
+    const uint64_t delay = 50;
+    uint64_t start = rdtsc();
+    ks->timer.sleep(delay);
+    ticksPerMs = (rdtsc() - start) / delay;
+    return ticksPerMs;
+}
+
+/*
+ * Prints something like:
+ *   memcpy      4096 B: 9000 MiB/s
+*/
+static void Report(const char* name, uint64_t size, uint64_t bytes, uint64_t ticks) {
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    uint64_t mibPerSec = (bytes * TSCTicksPerMs() * 1000 / ticks) >> 20;
+
+    StringBuilder sb;
+    sb.Append(name);
+    for (uint64_t i = strlen(name); i < 12; i++) {
+        sb.Append(' ');
+    }
+    sb.Append(to_string(size)).Append(" B: ");
+    sb.Append(to_string(mibPerSec)).Append(" MiB/s");
+    ks->basicConsole.Println(sb.c_str());
+}
+
+/*
+ * The old byte at a time loop, so we can
+ * see how much faster the new one is.
+*/
+static void ByteCopy(void* dest, const void* src, size_t n) {
+    volatile uint8_t* d = (volatile uint8_t*)dest;
+    const volatile uint8_t* s = (const volatile uint8_t*)src;
+    for (size_t i = 0; i < n; i++) {
+        d[i] = s[i];
+    }
+}
+
+/*
+ * Times memcpy, memmove, memset and memcmp
+ * (and the byte loop) at a few sizes, from
+ * tiny copies up to ones that use the non
+ * temporal path.
+*/
+void BenchMemory() {
+    uint8_t* src = (uint8_t*)malloc(BenchMaxSize + 64);
+    uint8_t* dst = (uint8_t*)malloc(BenchMaxSize + 64);
+    if (!src || !dst) {
+        ks->basicConsole.Println("bench: Failed to allocate buffers");
+        free(src);
+        free(dst);
+        return;
+    }
+
+    for (uint64_t i = 0; i < BenchMaxSize + 64; i++) {
+        src[i] = (uint8_t)i;
+    }
+
+    StringBuilder sb;
+    sb.Append("TSC: ").Append(to_string(TSCTicksPerMs())).Append(" ticks/ms, ERMS: ");
+    sb.Append(cpuFeatures.erms ? "yes" : "no").Append(", SSE2: ");
+    sb.Append(cpuFeatures.sse2 ? "yes" : "no");
+    ks->basicConsole.Println(sb.c_str());
+
+    for (size_t s = 0; s < sizeof(BenchSizes) / sizeof(BenchSizes[0]); s++) {
+        uint64_t size = BenchSizes[s];
+        uint64_t iters = BenchBytes / size;
+        if (iters == 0) {
+            iters = 1;
+        }
+
+        uint64_t start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            memcpy(dst, src, size);
+        }
+        Report("memcpy", size, iters * size, rdtsc() - start);
+
+        start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            memmove(src + 1, src, size);
+        }
+        Report("memmove", size, iters * size, rdtsc() - start);
+
+        start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            memset(dst, (uint8_t)i, size);
+        }
+        Report("memset", size, iters * size, rdtsc() - start);
+
+        memcpy(dst, src, size);
+        start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            if (memcmp(dst, src, size) != 0) {
+                ks->basicConsole.Println("bench: memcmp mismatch!");
+                break;
+            }
+        }
+        Report("memcmp", size, iters * size, rdtsc() - start);
+
+        /*
+         * The byte loop is really slow, so
+         * it only gets to move 1/16th as much.
+        */
+        uint64_t byteIters = iters / 16 ? iters / 16 : 1;
+        start = rdtsc();
+        for (uint64_t i = 0; i < byteIters; i++) {
+            ByteCopy(dst, src, size);
+        }
+        Report("byte loop", size, byteIters * size, rdtsc() - start);
+    }
+
+    free(src);
+    free(dst);
+}
+
+/*
+ * Byte at a time versions, which are obviously
+ * right. BenchStrings checks the fast ones
+ * against these before it times anything.
+*/
+static size_t RefStrlen(const char* s) {
+    size_t n = 0;
+    while (s[n]) {
+        n++;
+    }
+    return n;
+}
+
+static int RefStrcmp(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+static int RefStrncmp(const char* a, const char* b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i]) {
+            return (unsigned char)a[i] - (unsigned char)b[i];
+        }
+        if (!a[i]) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static const char* RefStrchr(const char* s, int c) {
+    while (true) {
+        if (*s == (char)c) {
+            return s;
+        }
+        if (!*s) {
+            return nullptr;
+        }
+        s++;
+    }
+}
+
+static int Sign(int x) {
+    return x < 0 ? -1 : (x > 0 ? 1 : 0);
+}
+
+/*
+ * Tries every alignment (0-7) for both strings
+ * and every length up to 40, with the strings
+ * differing at every possible spot. The fast
+ * versions read 8 bytes at a time, so most of
+ * their bugs would show up at the edges.
+*/
+static bool CheckStrings(char* bufA, char* bufB) {
+    for (size_t alignA = 0; alignA < 8; alignA++) {
+        for (size_t alignB = 0; alignB < 8; alignB++) {
+            for (size_t len = 0; len < 40; len++) {
+                char* a = bufA + alignA;
+                char* b = bufB + alignB;
+
+                /*
+                 * Put a 0 before the strings, so
+                 * that anything which reads the bytes
+                 * before the start gets caught.
+                */
+                bufA[0] = 0;
+                bufB[0] = 0;
+
+                for (size_t i = 0; i < len; i++) {
+                    a[i] = 'a' + (i % 26);
+                    b[i] = a[i];
+                }
+                a[len] = 0;
+                b[len] = 0;
+
+                if (strlen(a) != RefStrlen(a) || strlen(b) != RefStrlen(b)) {
+                    ks->basicConsole.Println("bench: strlen is wrong!");
+                    return false;
+                }
+
+                for (size_t diff = 0; diff <= len; diff++) {
+                    char saved = b[diff];
+                    b[diff] = (diff == len) ? 'z' : 1;
+
+                    if (Sign(strcmp(a, b)) != Sign(RefStrcmp(a, b))) {
+                        ks->basicConsole.Println("bench: strcmp is wrong!");
+                        return false;
+                    }
+                    for (size_t n = 0; n <= len + 1; n++) {
+                        if (Sign(strncmp(a, b, n)) != Sign(RefStrncmp(a, b, n))) {
+                            ks->basicConsole.Println("bench: strncmp is wrong!");
+                            return false;
+                        }
+                    }
+                    b[diff] = saved;
+                }
+
+                const char chars[] = { 'a', 'h', 'z', 1, 0 };
+                for (size_t c = 0; c < sizeof(chars); c++) {
+                    if (strchr(a, chars[c]) != RefStrchr(a, chars[c])) {
+                        ks->basicConsole.Println("bench: strchr is wrong!");
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static const char* BenchPaths[] = {
+    "Drivers",
+    "Drivers/AHCI/driver.elf",
+    "/AstralOS/System64/kernel.elf",
+    "/AstralOS/System64/Drivers/Storage/AHCI/Controllers/0/Ports/3/driver.elf",
+    "/AstralOS/System64/a/really/long/path/that/goes/on/and/on/because/someone/put/their/files/way/too/deep/inside/of/a/whole/lot/of/folders/file.txt"
+};
+
+static void ReportCall(const char* name, size_t len, uint64_t fastTicks, uint64_t refTicks, uint64_t iters) {
+    StringBuilder sb;
+    sb.Append(name);
+    for (uint64_t i = strlen(name); i < 8; i++) {
+        sb.Append(' ');
+    }
+    sb.Append(to_string((uint64_t)len)).Append(" B: ");
+    sb.Append(to_string(fastTicks / iters)).Append(" ticks/call (byte loop: ");
+    sb.Append(to_string(refTicks / iters)).Append(")");
+    ks->basicConsole.Println(sb.c_str());
+}
+
+/*
+ * Checks strlen, strcmp, strncmp and strchr
+ * against the byte loops, then times them on
+ * paths like the ones the VFS and initrd see.
+*/
+void BenchStrings() {
+    char* bufA = (char*)malloc(64);
+    char* bufB = (char*)malloc(64);
+    if (!bufA || !bufB) {
+        ks->basicConsole.Println("bench: Failed to allocate buffers");
+        free(bufA);
+        free(bufB);
+        return;
+    }
+
+    bool ok = CheckStrings(bufA, bufB);
+    free(bufA);
+    free(bufB);
+    if (!ok) {
+        return;
+    }
+    ks->basicConsole.Println("String funcs match the byte loops");
+
+    const uint64_t iters = 100000;
+    for (size_t p = 0; p < sizeof(BenchPaths) / sizeof(BenchPaths[0]); p++) {
+        const char* path = BenchPaths[p];
+        char* copy = strdup(path);
+        size_t len = RefStrlen(path);
+
+        uint64_t start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            strlen(path);
+        }
+        uint64_t fast = rdtsc() - start;
+        start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            RefStrlen(path);
+        }
+        ReportCall("strlen", len, fast, rdtsc() - start, iters);
+
+        start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            strcmp(path, copy);
+        }
+        fast = rdtsc() - start;
+        start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            RefStrcmp(path, copy);
+        }
+        ReportCall("strcmp", len, fast, rdtsc() - start, iters);
+
+        start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            strchr(path, '\0');
+        }
+        fast = rdtsc() - start;
+        start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            RefStrchr(path, '\0');
+        }
+        ReportCall("strchr", len, fast, rdtsc() - start, iters);
+
+        free(copy);
+    }
+}
+
+static uint64_t PrintLines(uint64_t lines) {
+    const char* line = "The quick brown fox jumps over the lazy dog 0123456789 !@#$%^&*()";
+
+    uint64_t start = rdtsc();
+    for (uint64_t i = 0; i < lines; i++) {
+        ks->basicConsole.Println(line);
+    }
+    ks->basicConsole.Flush();
+    return rdtsc() - start;
+}
+
+/*
+ * Prints a bunch of lines straight into the
+ * framebuffer, then again through the shadow
+ * buffer, and shows how many chars per second
+ * each one managed. Both include scrolling.
+ *
+ * Println also writes to the serial port,
+ * which is slow, so the numbers are more
+ * about how much the console adds on top.
+*/
+void BenchConsole() {
+    const uint64_t lines = 200;
+    const uint64_t chars = lines * 66;
+    uint64_t tpms = TSCTicksPerMs();
+
+    bool wasEnabled = ks->basicConsole.shadowEnabled;
+
+    ks->basicConsole.DisableShadowBuffer();
+    uint64_t direct = PrintLines(lines);
+
+    if (!ks->basicConsole.EnableShadowBuffer()) {
+        ks->basicConsole.Println("bench: Failed to enable the shadow buffer");
+        return;
+    }
+    uint64_t shadowed = PrintLines(lines);
+
+    if (!wasEnabled) {
+        ks->basicConsole.DisableShadowBuffer();
+    }
+
+    if (direct == 0 || shadowed == 0) {
+        return;
+    }
+    kprintf("Console direct: %lu chars/s\n", chars * tpms * 1000 / direct);
+    kprintf("Console shadow: %lu chars/s\n", chars * tpms * 1000 / shadowed);
+}
+
+/*
+ * How many 4KB random reads each queue depth
+ * gets, and the deepest queue we try.
+*/
+static constexpr uint32_t BlockBenchIOs = 2048;
+static constexpr uint32_t BlockBenchDepth = 32;
+
+struct BlockBenchState {
+    volatile uint32_t completed;
+    volatile uint32_t failed;
+};
+
+static void BlockBenchDone(BlockRequest* req) {
+    BlockBenchState* state = (BlockBenchState*)req->ctx;
+    if (req->status != BLOCK_OK) {
+        state->failed++;
+    }
+    state->completed++;
+}
+
+/*
+ * Gives every segment a page of its own. If
+ * we run out partway, the pages we did get go
+ * back and we return false, so nothing ends up
+ * reading into physical page 0.
+*/
+static bool AllocateBenchPages(DMASegment* segs, uint32_t n, uint32_t size) {
+    for (uint32_t i = 0; i < n; i++) {
+        segs[i].phys = (uint64_t)ks->pageFrameAllocator.RequestPage();
+        segs[i].size = size;
+        if (segs[i].phys == 0) {
+            for (uint32_t j = 0; j < i; j++) {
+                ks->pageFrameAllocator.FreePage((void*)segs[j].phys);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+static void FreeBenchPages(DMASegment* segs, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        ks->pageFrameAllocator.FreePage((void*)segs[i].phys);
+    }
+}
+
+/*
+ * Keeps `depth` reads in flight until all
+ * of them are done, and returns how long
+ * that took (or 0 if something failed).
+ *
+ * There's no way to wait for "any" request,
+ * so we wait on the first one that's still
+ * running and then refill every free slot.
+*/
+static uint64_t RandomReads(BlockDevice* dev, uint32_t depth, BlockRequest* reqs, DMASegment* segs, uint32_t count) {
+    uint64_t blocks = dev->SectorCount() / count;
+    uint64_t seed = rdtsc() | 1;
+    BlockBenchState state = { 0, 0 };
+
+    for (uint32_t i = 0; i < depth; i++) {
+        reqs[i].status = BLOCK_OK;
+    }
+
+    uint32_t issued = 0;
+    bool failed = false;
+    uint64_t start = rdtsc();
+    while (state.completed < issued || (issued < BlockBenchIOs && !failed)) {
+        for (uint32_t i = 0; i < depth && issued < BlockBenchIOs && !failed; i++) {
+            if (reqs[i].status == BLOCK_PENDING) {
+                continue;
+            }
+
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+
+            reqs[i].lba = (seed % blocks) * count;
+            reqs[i].count = count;
+            reqs[i].segs = &segs[i];
+            reqs[i].segCount = 1;
+            reqs[i].write = false;
+            reqs[i].done = BlockBenchDone;
+            reqs[i].ctx = &state;
+            if (!dev->Submit(&reqs[i])) {
+                failed = true;
+                break;
+            }
+            issued++;
+        }
+
+        for (uint32_t i = 0; i < depth; i++) {
+            if (reqs[i].status == BLOCK_PENDING) {
+                dev->Wait(&reqs[i]);
+                break;
+            }
+        }
+    }
+    uint64_t ticks = rdtsc() - start;
+
+    if (failed || state.failed) {
+        return 0;
+    }
+    return ticks ? ticks : 1;
+}
+
+/*
+ * Random 4KB reads from the first disk, once
+ * with one request at a time and once with
+ * 32 in flight, to see what NCQ buys us.
+*/
+void BenchBlock() {
+    Array<BaseDriver*> disks = ks->driverMan.GetDevices(DriverType::BlockDevice);
+    if (disks.size() == 0) {
+        kprintf("bench: No block devices\n");
+        return;
+    }
+
+    BlockDevice* dev = (BlockDevice*)disks[0];
+    uint32_t sectorSize = dev->SectorSize();
+    if (sectorSize == 0 || sectorSize > 4096 || dev->SectorCount() < 4096 / sectorSize) {
+        kprintf("bench: %s can't do 4KB reads\n", dev->name());
+        return;
+    }
+    uint32_t count = 4096 / sectorSize;
+
+    BlockRequest reqs[BlockBenchDepth];
+    DMASegment segs[BlockBenchDepth];
+    if (!AllocateBenchPages(segs, BlockBenchDepth, count * sectorSize)) {
+        kprintf("bench: out of memory\n");
+        return;
+    }
+
+    uint64_t tpms = TSCTicksPerMs();
+    const uint32_t depths[] = { 1, BlockBenchDepth };
+    for (uint32_t d = 0; d < 2; d++) {
+        uint64_t ticks = RandomReads(dev, depths[d], reqs, segs, count);
+        if (ticks == 0) {
+            kprintf("bench: %s random reads failed at QD%u\n", dev->name(), depths[d]);
+            break;
+        }
+        kprintf("%s random 4K QD%u: %lu IOPS\n", dev->name(), depths[d], (uint64_t)BlockBenchIOs * tpms * 1000 / ticks);
+    }
+
+    FreeBenchPages(segs, BlockBenchDepth);
+}
+
+/*
+ * How many 4KB blocks the scheduler bench
+ * reads, all of them next to each other.
+*/
+static constexpr uint32_t SchedBenchBlocks = 256;
+
+static BlockRequest SchedBenchReqs[SchedBenchBlocks];
+static DMASegment SchedBenchSegs[SchedBenchBlocks];
+static uint32_t SchedBenchOrder[SchedBenchBlocks];
+
+/*
+ * A copy of dev's queue stats, all zeros if
+ * it doesn't have a queue yet.
+*/
+static IOQueueStats SchedSnapshot(PartitionDevice* dev) {
+    const IOQueueStats* stats = ks->iosched.Stats(dev);
+    if (stats) {
+        return *stats;
+    }
+
+    IOQueueStats zero;
+    memset(&zero, 0, sizeof(zero));
+    return zero;
+}
+
+/*
+ * Reads the first 1MB of the first partition
+ * as 4KB blocks in a shuffled order, once
+ * straight to the device a block at a time,
+ * and once through the I/O scheduler with the
+ * queue plugged, which should merge them back
+ * into a few big requests.
+*/
+void BenchScheduler() {
+    Array<BaseDriver*> parts = ks->driverMan.GetDevices(DriverType::PartitionDevice);
+    if (parts.size() == 0) {
+        kprintf("bench: No partitions\n");
+        return;
+    }
+
+    PartitionDevice* dev = (PartitionDevice*)parts[0];
+    uint32_t sectorSize = dev->SectorSize();
+    if (sectorSize == 0 || sectorSize > 4096 || dev->SectorCount() < SchedBenchBlocks * (4096 / sectorSize)) {
+        kprintf("bench: %s is too small for the scheduler bench\n", dev->name());
+        return;
+    }
+    uint32_t count = 4096 / sectorSize;
+
+    uint64_t seed = rdtsc() | 1;
+    if (!AllocateBenchPages(SchedBenchSegs, SchedBenchBlocks, count * sectorSize)) {
+        kprintf("bench: out of memory\n");
+        return;
+    }
+    for (uint32_t i = 0; i < SchedBenchBlocks; i++) {
+        SchedBenchOrder[i] = i;
+    }
+    for (uint32_t i = SchedBenchBlocks - 1; i > 0; i--) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+
+        uint32_t j = seed % (i + 1);
+        uint32_t tmp = SchedBenchOrder[i];
+        SchedBenchOrder[i] = SchedBenchOrder[j];
+        SchedBenchOrder[j] = tmp;
+    }
+
+    uint64_t tpms = TSCTicksPerMs();
+    bool failed = false;
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < SchedBenchBlocks && !failed; i++) {
+        uint32_t b = SchedBenchOrder[i];
+        failed = !dev->ReadSectors((uint64_t)b * count, count, (void*)SchedBenchSegs[b].phys);
+    }
+    uint64_t direct = rdtsc() - start;
+
+    IOQueueStats before = SchedSnapshot(dev);
+
+    /*
+     * Everything that got submitted gets waited
+     * on, even after a failure, since the pages
+     * get freed below and a read still in the
+     * queue would land in them.
+    */
+    uint32_t submitted = 0;
+    start = rdtsc();
+    ks->iosched.Plug(dev);
+    for (uint32_t i = 0; i < SchedBenchBlocks && !failed; i++) {
+        uint32_t b = SchedBenchOrder[i];
+        BlockRequest* req = &SchedBenchReqs[b];
+        req->lba = (uint64_t)b * count;
+        req->count = count;
+        req->segs = &SchedBenchSegs[b];
+        req->segCount = 1;
+        req->write = false;
+        req->done = nullptr;
+        req->ctx = nullptr;
+        failed = !ks->iosched.Submit(dev, req);
+        if (!failed) {
+            submitted++;
+        }
+    }
+    ks->iosched.Unplug(dev);
+    for (uint32_t i = 0; i < submitted; i++) {
+        if (!ks->iosched.Wait(dev, &SchedBenchReqs[SchedBenchOrder[i]])) {
+            failed = true;
+        }
+    }
+    uint64_t scheduled = rdtsc() - start;
+
+    FreeBenchPages(SchedBenchSegs, SchedBenchBlocks);
+
+    if (failed) {
+        kprintf("bench: %s scheduler reads failed\n", dev->name());
+        return;
+    }
+    if (direct == 0) direct = 1;
+    if (scheduled == 0) scheduled = 1;
+
+    uint64_t bytes = (uint64_t)SchedBenchBlocks * 4096;
+    kprintf("%s shuffled 4K direct:    %lu MiB/s\n", dev->name(), bytes * tpms * 1000 / direct / (1024 * 1024));
+    IOQueueStats after = SchedSnapshot(dev);
+    kprintf("%s shuffled 4K scheduled: %lu MiB/s (%lu merges, %lu requests)\n", dev->name(),
+        bytes * tpms * 1000 / scheduled / (1024 * 1024),
+        after.backMerges + after.frontMerges - before.backMerges - before.frontMerges,
+        after.dispatched - before.dispatched);
+}
+
+/*
+ * Prints what the scheduler did between two
+ * snapshots of the same queue.
+*/
+static void ReportSched(const char* what, PartitionDevice* dev, const IOQueueStats& before, const IOQueueStats& after, uint64_t ticks) {
+    uint64_t tpms = TSCTicksPerMs();
+    uint64_t us = tpms ? ticks * 1000 / tpms : 0;
+    kprintf("%s %s: %lu us, %lu submitted, %lu back / %lu front merges, %lu dispatched, %lu expired\n",
+        dev->name(), what, us,
+        after.submitted - before.submitted,
+        after.backMerges - before.backMerges,
+        after.frontMerges - before.frontMerges,
+        after.dispatched - before.dispatched,
+        after.expired - before.expired);
+}
+
+/*
+ * The mixed bench lays its blocks out in
+ * pairs, MixedBenchStride blocks apart, so
+ * the two blocks of a pair can merge but the
+ * pairs can't.
+*/
+static constexpr uint32_t MixedBenchBlocks = 128;
+static constexpr uint32_t MixedBenchStride = 4;
+static constexpr uint32_t MixedBenchDirty = 64;
+static constexpr uint32_t MixedBenchRA = 64;
+
+static BlockRequest MixedBenchReqs[MixedBenchBlocks];
+static DMASegment MixedBenchSegs[MixedBenchBlocks];
+static uint32_t MixedBenchOrder[MixedBenchBlocks];
+
+static uint64_t MixedBlock(uint32_t i) {
+    return (uint64_t)(i / 2) * MixedBenchStride + (i % 2);
+}
+
+/*
+ * Reads and writes mixed together, so the
+ * deadlines and the write starvation limit
+ * actually get used. Every write puts back
+ * exactly what was read from that block, so
+ * nothing on the disk changes.
+ *
+ * The first pass goes straight to the I/O
+ * scheduler: half the pairs get read, half get
+ * written back, all in a shuffled order with
+ * the queue plugged.
+ *
+ * The second pass is the way the filesystem
+ * uses it: scattered blocks get read through
+ * the buffer cache and marked dirty like
+ * metadata, readahead goes out for another
+ * part of the disk, and then Sync writes the
+ * dirty blocks back while those reads are
+ * still queued.
+*/
+void BenchMixed() {
+    Array<BaseDriver*> parts = ks->driverMan.GetDevices(DriverType::PartitionDevice);
+    if (parts.size() == 0) {
+        kprintf("bench: No partitions\n");
+        return;
+    }
+
+    PartitionDevice* dev = (PartitionDevice*)parts[0];
+    uint32_t sectorSize = dev->SectorSize();
+    uint64_t span = (uint64_t)MixedBenchDirty * MixedBenchStride * 2 + MixedBenchRA;
+    if (sectorSize == 0 || sectorSize > 4096 || dev->SectorCount() < span * (4096 / sectorSize)) {
+        kprintf("bench: %s is too small for the mixed bench\n", dev->name());
+        return;
+    }
+    uint32_t count = 4096 / sectorSize;
+
+    /*
+     * Anything dirty in the cache goes out
+     * first, so what we read back and write
+     * again really is what's on the disk.
+    */
+    ks->bcache.Sync(dev);
+
+    if (!AllocateBenchPages(MixedBenchSegs, MixedBenchBlocks, count * sectorSize)) {
+        kprintf("bench: out of memory\n");
+        return;
+    }
+
+    bool failed = false;
+    for (uint32_t i = 0; i < MixedBenchBlocks && !failed; i++) {
+        failed = !dev->ReadSectors(MixedBlock(i) * count, count, (void*)MixedBenchSegs[i].phys);
+    }
+    if (failed) {
+        FreeBenchPages(MixedBenchSegs, MixedBenchBlocks);
+        kprintf("bench: %s mixed reads failed\n", dev->name());
+        return;
+    }
+
+    uint64_t seed = rdtsc() | 1;
+    for (uint32_t i = 0; i < MixedBenchBlocks; i++) {
+        MixedBenchOrder[i] = i;
+    }
+    for (uint32_t i = MixedBenchBlocks - 1; i > 0; i--) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+
+        uint32_t j = seed % (i + 1);
+        uint32_t tmp = MixedBenchOrder[i];
+        MixedBenchOrder[i] = MixedBenchOrder[j];
+        MixedBenchOrder[j] = tmp;
+    }
+
+    IOQueueStats before = SchedSnapshot(dev);
+    uint32_t submitted = 0;
+    uint64_t start = rdtsc();
+    ks->iosched.Plug(dev);
+    for (uint32_t i = 0; i < MixedBenchBlocks && !failed; i++) {
+        uint32_t b = MixedBenchOrder[i];
+        BlockRequest* req = &MixedBenchReqs[b];
+        req->lba = MixedBlock(b) * count;
+        req->count = count;
+        req->segs = &MixedBenchSegs[b];
+        req->segCount = 1;
+        req->write = (b / 2) % 2 == 0;
+        req->done = nullptr;
+        req->ctx = nullptr;
+        failed = !ks->iosched.Submit(dev, req);
+        if (!failed) {
+            submitted++;
+        }
+    }
+    ks->iosched.Unplug(dev);
+    for (uint32_t i = 0; i < submitted; i++) {
+        if (!ks->iosched.Wait(dev, &MixedBenchReqs[MixedBenchOrder[i]])) {
+            failed = true;
+        }
+    }
+    uint64_t ticks = rdtsc() - start;
+    FreeBenchPages(MixedBenchSegs, MixedBenchBlocks);
+
+    if (failed) {
+        kprintf("bench: %s mixed reads/writes failed\n", dev->name());
+        return;
+    }
+    ReportSched("mixed 4K read/write", dev, before, SchedSnapshot(dev), ticks);
+
+    before = SchedSnapshot(dev);
+    start = rdtsc();
+    for (uint32_t i = 0; i < MixedBenchDirty; i++) {
+        BlockBuffer* buf = ks->bcache.Read(dev, (uint64_t)i * MixedBenchStride * 2, 4096);
+        if (!buf) {
+            failed = true;
+            break;
+        }
+        ks->bcache.MarkDirty(buf);
+        ks->bcache.Release(buf);
+    }
+    ks->bcache.ReadAhead(dev, (uint64_t)MixedBenchDirty * MixedBenchStride * 2, MixedBenchRA, 4096);
+    if (!ks->bcache.Sync(dev)) {
+        failed = true;
+    }
+    ticks = rdtsc() - start;
+
+    if (failed) {
+        kprintf("bench: %s bcache sync pass failed\n", dev->name());
+        return;
+    }
+    ReportSched("bcache dirty sync + readahead", dev, before, SchedSnapshot(dev), ticks);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Small benchmarks that you can run from
+ * the shell with the `bench` command.
+ *
+ * They time things with the TSC, which we
+ * calibrate against the APIC timer, so the
+ * timer needs to be calibrated first.
+*/
+uint64_t TSCTicksPerMs();
+
+void BenchMemory();
+void BenchStrings();
+void BenchConsole();
+void BenchBlock();
+void BenchScheduler();
+void BenchMixed();
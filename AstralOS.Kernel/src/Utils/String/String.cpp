@@ -1,44 +1,201 @@
 #include "String.h"
+#include <utility>
+
+String::String() {}
 
 String::String(const char* str) {
-    size_t len = strlen(str);
-    data = new char[len + 1];
-    strcpy(data, str);
+    if (str) {
+        assign(str, strlen(str));
+    }
 }
 
 String::String(const char* buf, size_t length) {
-    data = new char[length + 1];
+    assign(buf, length);
+}
+
+String::String(const String& other) {
+    assign(other.c_str(), other.length);
+}
+
+/*
+ * If the other String has a heap buffer,
+ * we just take it. If it's inline we have
+ * to copy it, but that's at most 24 bytes.
+*/
+String::String(String&& other) {
+    if (other.capacity) {
+        heap = other.heap;
+        capacity = other.capacity;
+        length = other.length;
+
+        other.capacity = 0;
+        other.length = 0;
+        other.local[0] = '\0';
+    } else {
+        memcpy(local, other.local, other.length + 1);
+        length = other.length;
+    }
+}
+
+String::~String() {
+    release();
+}
+
+String& String::operator=(const String& other) {
+    if (this != &other) {
+        assign(other.c_str(), other.length);
+    }
+    return *this;
+}
+
+String& String::operator=(String&& other) {
+    if (this == &other) {
+        return *this;
+    }
+
+    release();
+    if (other.capacity) {
+        heap = other.heap;
+        capacity = other.capacity;
+        length = other.length;
+
+        other.capacity = 0;
+        other.length = 0;
+        other.local[0] = '\0';
+    } else {
+        memcpy(local, other.local, other.length + 1);
+        length = other.length;
+    }
+    return *this;
+}
 
-    if (buf && length > 0)
-        memcpy(data, buf, length);
+String& String::operator=(const char* str) {
+    if (!str) {
+        clear();
+        return *this;
+    }
+    assign(str, strlen(str));
+    return *this;
+}
+
+/*
+ * We know how long both sides are, so
+ * the result only gets one allocation.
+*/
+String String::operator+(const String& other) const & {
+    String result;
+    result.reserve(length + other.length);
+    result.append(c_str(), length);
+    result.append(other.c_str(), other.length);
+    return result;
+}
+
+/*
+ * This one gets picked for chains like
+ * (String)"a" + b + c, where the left
+ * side is a temporary. We can just append
+ * to it instead of making a new String
+ * for every +.
+*/
+String String::operator+(const String& other) && {
+    append(other.c_str(), other.length);
+    return std::move(*this);
+}
 
+String& String::operator+=(const String& other) {
+    append(other.c_str(), other.length);
+    return *this;
+}
+
+String& String::operator+=(const char* str) {
+    if (str) {
+        append(str, strlen(str));
+    }
+    return *this;
+}
+
+void String::append(const char* buf, size_t len) {
+    if (!buf || len == 0) {
+        return;
+    }
+
+    /*
+     * `buf` might be part of our own buffer
+     * (like s.append(s.c_str(), 3)), so we
+     * need to copy it before reserve frees it.
+    */
+    const char* cur = c_str();
+    if (buf >= cur && buf <= cur + length) {
+        String tmp(buf, len);
+        append(tmp.c_str(), len);
+        return;
+    }
+
+    size_t cap = capacity ? capacity : InlineCapacity;
+    if (length + len > cap) {
+        size_t newCap = cap * 2;
+        if (newCap < length + len) {
+            newCap = length + len;
+        }
+        reserve(newCap);
+    }
+
+    char* data = buffer();
+    memcpy(data + length, buf, len);
+    length += len;
     data[length] = '\0';
 }
 
-String String::operator+(const String& other) const {
-    size_t len = strlen(data) + strlen(other.data);
+void String::reserve(size_t len) {
+    if (len <= (capacity ? capacity : InlineCapacity)) {
+        return;
+    }
+
     char* newData = new char[len + 1];
-    strcpy(newData, data);
-    strcat(newData, other.data);
-    return String(newData);
+    memcpy(newData, c_str(), length + 1);
+
+    release();
+    heap = newData;
+    capacity = len;
+}
+
+void String::clear() {
+    length = 0;
+    buffer()[0] = '\0';
+}
+
+void String::assign(const char* buf, size_t len) {
+    const char* cur = c_str();
+    if (buf && buf >= cur && buf <= cur + length) {
+        String tmp(buf, len);
+        *this = std::move(tmp);
+        return;
+    }
+
+    clear();
+    append(buf, len);
+}
+
+void String::release() {
+    if (capacity) {
+        delete[] heap;
+        capacity = 0;
+        local[0] = '\0';
+    }
 }
 
 bool String::StartsWith(const String& prefix) const {
     if (size() < prefix.size())
         return false;
 
-    return memcmp(data, prefix.c_str(), prefix.size()) == 0;
-}
-
-uint64_t String::size() const {
-    return strlen(data);
+    return memcmp(c_str(), prefix.c_str(), prefix.size()) == 0;
 }
 
 String String::substring(size_t start) const {
     if (start >= size())
         return String("");
 
-    return String(data + start, size() - start);
+    return String(c_str() + start, size() - start);
 }
 
 String String::substring(size_t start, size_t length) const {
@@ -48,5 +205,5 @@ String String::substring(size_t start, size_t length) const {
     if (start + length > size())
         length = size() - start;
 
-    return String(data + start, length);
-}
\ No newline at end of file
+    return String(c_str() + start, length);
+}
@@ -3,23 +3,129 @@
 #include "../utils.h"
 
 /*
- * Sorry, but its GPT Generated, I will get back to this later
+ * Strings that are InlineCapacity chars or
+ * shorter are kept inside the String itself,
+ * so most of the small strings we make for
+ * logging never touch the heap at all. Longer
+ * ones get a heap buffer which grows by
+ * doubling, so appending in a loop doesn't
+ * allocate every time.
+ *
+ * A String that is all zeroes is a valid
+ * empty String. This matters because some
+ * structs with Strings in them (like Path)
+ * get malloc'd instead of constructed.
 */
 class String {
 public:
+    String();
     String(const char* str);
     String(const char* buf, size_t length);
+    String(const String& other);
+    String(String&& other);
+    ~String();
 
-    String operator+(const String& other) const;
+    String& operator=(const String& other);
+    String& operator=(String&& other);
+    String& operator=(const char* str);
+
+    String operator+(const String& other) const &;
+    String operator+(const String& other) &&;
+    String& operator+=(const String& other);
+    String& operator+=(const char* str);
+
+    void append(const char* buf, size_t length);
+    void reserve(size_t length);
+    void clear();
 
     bool StartsWith(const String& prefix) const;
-    uint64_t size() const;
+    uint64_t size() const {
+        return length;
+    }
     String substring(size_t start) const;
     String substring(size_t start, size_t length) const;
 
     const char* c_str() const {
-        return data;
+        return capacity ? heap : local;
+    }
+private:
+    static constexpr size_t InlineCapacity = 23;
+
+    char* buffer() {
+        return capacity ? heap : local;
+    }
+    void assign(const char* buf, size_t length);
+    void release();
+
+    size_t length = 0;
+
+    /*
+     * 0 means the chars are in `local`,
+     * otherwise it's the size of `heap`
+     * (not counting the null terminator).
+    */
+    size_t capacity = 0;
+    union {
+        char* heap;
+        char local[InlineCapacity + 1] = {};
+    };
+};
+
+/*
+ * Use this when you are gluing a lot of
+ * pieces together, like a log line. Every
+ * Append goes into the same buffer, so
+ * you only pay for one allocation (or none
+ * if it fits inline).
+ *
+ *   StringBuilder sb;
+ *   sb.Append("Drive ").Append(to_hstring(i));
+ *   ks->basicConsole.Println(sb.c_str());
+*/
+class StringBuilder {
+public:
+    StringBuilder() {}
+    StringBuilder(size_t capacity) {
+        str.reserve(capacity);
+    }
+
+    StringBuilder& Append(const char* s) {
+        if (s) {
+            str.append(s, strlen(s));
+        }
+        return *this;
+    }
+
+    StringBuilder& Append(const char* buf, size_t length) {
+        str.append(buf, length);
+        return *this;
+    }
+
+    StringBuilder& Append(const String& s) {
+        str += s;
+        return *this;
+    }
+
+    StringBuilder& Append(char c) {
+        str.append(&c, 1);
+        return *this;
+    }
+
+    void Clear() {
+        str.clear();
+    }
+
+    uint64_t size() const {
+        return str.size();
+    }
+
+    const char* c_str() const {
+        return str.c_str();
+    }
+
+    String ToString() const {
+        return str;
     }
 private:
-    char* data;
-};
\ No newline at end of file
+    String str;
+};
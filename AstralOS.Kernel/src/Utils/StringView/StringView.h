@@ -0,0 +1,177 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * A StringView is just a pointer and a
+ * length. It doesn't own the chars and it
+ * doesn't need them to be null terminated,
+ * so we can point at part of a path (or
+ * a name inside the initrd) without
+ * copying it.
+ *
+ * Whatever it points to has to outlive it.
+ *
+ * This header doesn't depend on anything
+ * in the kernel, so drivers get a copy of
+ * it as well.
+*/
+class StringView {
+public:
+    static constexpr size_t npos = (size_t)-1;
+
+    constexpr StringView() : ptr(nullptr), len(0) {}
+    constexpr StringView(const char* buf, size_t length) : ptr(buf), len(length) {}
+    StringView(const char* str) : ptr(str), len(0) {
+        if (str) {
+            while (str[len]) {
+                len++;
+            }
+        }
+    }
+
+    const char* data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    char operator[](size_t idx) const { return ptr[idx]; }
+
+    StringView substring(size_t start, size_t length = npos) const {
+        if (start >= len) {
+            return StringView();
+        }
+        if (length > len - start) {
+            length = len - start;
+        }
+        return StringView(ptr + start, length);
+    }
+
+    size_t find(char c, size_t start = 0) const {
+        for (size_t i = start; i < len; i++) {
+            if (ptr[i] == c) {
+                return i;
+            }
+        }
+        return npos;
+    }
+
+    size_t rfind(char c) const {
+        for (size_t i = len; i > 0; i--) {
+            if (ptr[i - 1] == c) {
+                return i - 1;
+            }
+        }
+        return npos;
+    }
+
+    bool StartsWith(StringView prefix) const {
+        return prefix.len <= len && substring(0, prefix.len) == prefix;
+    }
+
+    bool operator==(StringView other) const {
+        if (len != other.len) {
+            return false;
+        }
+        for (size_t i = 0; i < len; i++) {
+            if (ptr[i] != other.ptr[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator!=(StringView other) const {
+        return !(*this == other);
+    }
+
+    /*
+     * For when something really needs a null
+     * terminated string. It copies as much as
+     * fits in `buf` and returns false if it
+     * had to cut it short.
+    */
+    bool CopyTo(char* buf, size_t bufSize) const {
+        if (bufSize == 0) {
+            return false;
+        }
+
+        size_t n = len < bufSize - 1 ? len : bufSize - 1;
+        for (size_t i = 0; i < n; i++) {
+            buf[i] = ptr[i];
+        }
+        buf[n] = '\0';
+        return n == len;
+    }
+private:
+    const char* ptr;
+    size_t len;
+};
+
+/*
+ * Walks through the parts of a path one at a
+ * time, without allocating anything:
+ *
+ *   PathIterator it("/Drivers/AHCI/driver.elf");
+ *   StringView part;
+ *   while (it.Next(part)) {
+ *       // "Drivers", then "AHCI", then "driver.elf"
+ *   }
+ *
+ * Empty parts (from `//` or a leading or
+ * trailing `/`) get skipped, which is the
+ * same thing strtok used to do for us.
+ *
+ * You can also pass a different separator,
+ * like 'p' to split `sdap1`.
+*/
+class PathIterator {
+public:
+    PathIterator(StringView path, char separator = '/') : path(path), pos(0), sep(separator) {}
+
+    bool Next(StringView& part) {
+        while (pos < path.size() && path[pos] == sep) {
+            pos++;
+        }
+        if (pos >= path.size()) {
+            return false;
+        }
+
+        size_t end = path.find(sep, pos);
+        if (end == StringView::npos) {
+            end = path.size();
+        }
+
+        part = path.substring(pos, end - pos);
+        pos = end;
+        return true;
+    }
+
+    /*
+     * Everything we haven't walked through
+     * yet, without the leading separators.
+    */
+    StringView Rest() const {
+        size_t p = pos;
+        while (p < path.size() && path[p] == sep) {
+            p++;
+        }
+        return path.substring(p);
+    }
+
+    /*
+     * Counts the parts without moving the
+     * iterator.
+    */
+    size_t Count() const {
+        PathIterator it = *this;
+        StringView part;
+        size_t count = 0;
+        while (it.Next(part)) {
+            count++;
+        }
+        return count;
+    }
+private:
+    StringView path;
+    size_t pos;
+    char sep;
+};
@@ -10,6 +10,37 @@ void cpuid(uint32_t code, uint32_t* eax, uint32_t* edx) {
                  : "a"(code));
 }
 
+void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    asm volatile("cpuid"
+                 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                 : "a"(leaf), "c"(subleaf));
+}
+
+CPUFeatures cpuFeatures;
+
+/*
+ * Leaf 1 has SSE2 and the TSC, but ERMS
+ * and FSRM are in leaf 7, which old CPUs
+ * don't have, so we need to check the max
+ * leaf (from leaf 0) first.
+*/
+void DetectCPUFeatures() {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t maxLeaf = eax;
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    cpuFeatures.sse2 = edx & CPUID_FEAT_EDX_SSE2;
+    cpuFeatures.tsc = edx & CPUID_FEAT_EDX_TSC;
+
+    if (maxLeaf >= 7) {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        cpuFeatures.erms = ebx & CPUID_FEAT7_EBX_ERMS;
+        cpuFeatures.fsrm = edx & CPUID_FEAT7_EDX_FSRM;
+    }
+}
+
 void outb(unsigned short port, unsigned char val) {
     asm volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
 }
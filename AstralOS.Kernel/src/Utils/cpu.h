@@ -59,8 +59,44 @@ enum {
     CPUID_FEAT_EDX_PBE          = 1 << 31, // Pend. Brk. EN. (wtf?)
 };
 
+/*
+ * CPUID.(EAX=07H, ECX=0H) feature bits
+*/
+enum {
+    CPUID_FEAT7_EBX_ERMS        = 1 << 9,  // enhanced rep movsb/stosb
+    CPUID_FEAT7_EDX_FSRM        = 1 << 4,  // fast short rep movsb
+};
+
+/*
+ * These get filled in once by DetectCPUFeatures,
+ * so that things like memcpy don't have to run
+ * cpuid every time they want to know what the
+ * CPU can do.
+ *
+ * Before DetectCPUFeatures runs, everything is
+ * false, so the code should always work without
+ * any of these.
+*/
+struct CPUFeatures {
+    bool sse2;
+    bool erms;
+    bool fsrm;
+    bool tsc;
+};
+
+extern CPUFeatures cpuFeatures;
+
+void DetectCPUFeatures();
+
 void cpuid(uint32_t code, uint32_t* eax, uint32_t* edx);
+void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx);
 void outb(unsigned short port, unsigned char val);
 uint8_t inb(uint16_t port);
 void outl(uint16_t port, uint32_t val);
-uint32_t inl(uint16_t port);
\ No newline at end of file
+uint32_t inl(uint16_t port);
+
+static inline uint64_t rdtsc() {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
\ No newline at end of file
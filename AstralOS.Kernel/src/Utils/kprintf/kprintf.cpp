@@ -0,0 +1,315 @@
+#include "kprintf.h"
+#include "../../KernelServices/KernelServices.h"
+
+/*
+ * Everything gets written through one of
+ * these. ksnprintf just stops writing when
+ * the buffer is full (but keeps counting),
+ * and kprintf passes a flush func which
+ * prints the buffer and starts it over.
+*/
+struct FormatSink {
+    char* buf;
+    size_t size;
+    size_t pos;
+    size_t total;
+    void (*flush)(FormatSink& sink);
+};
+
+static void Put(FormatSink& sink, char c) {
+    sink.total++;
+    if (sink.pos + 1 >= sink.size) {
+        if (!sink.flush) {
+            return;
+        }
+        sink.flush(sink);
+    }
+    sink.buf[sink.pos++] = c;
+}
+
+static void PutRepeat(FormatSink& sink, char c, int count) {
+    for (int i = 0; i < count; i++) {
+        Put(sink, c);
+    }
+}
+
+struct FormatSpec {
+    bool left = false;
+    bool zero = false;
+    int width = 0;
+    int precision = -1;
+};
+
+static void PutString(FormatSink& sink, const FormatSpec& spec, const char* str) {
+    if (!str) {
+        str = "(null)";
+    }
+
+    int len = 0;
+    while (str[len] && (spec.precision < 0 || len < spec.precision)) {
+        len++;
+    }
+
+    int pad = spec.width > len ? spec.width - len : 0;
+    if (!spec.left) {
+        PutRepeat(sink, ' ', pad);
+    }
+    for (int i = 0; i < len; i++) {
+        Put(sink, str[i]);
+    }
+    if (spec.left) {
+        PutRepeat(sink, ' ', pad);
+    }
+}
+
+/*
+ * The precision is the minimum number of
+ * digits (like C), and a precision of 0
+ * with a value of 0 prints no digits.
+ * The 0 flag is ignored if there's a
+ * precision or a `-`, like C does too.
+*/
+static void PutNumber(FormatSink& sink, const FormatSpec& spec, uint64_t value, bool negative, unsigned base, bool upper, const char* prefix) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    char tmp[24];
+    int len = 0;
+    while (value) {
+        tmp[len++] = digits[value % base];
+        value /= base;
+    }
+    if (len == 0 && spec.precision != 0) {
+        tmp[len++] = '0';
+    }
+
+    int prefixLen = 0;
+    if (negative) {
+        prefixLen = 1;
+    } else if (prefix) {
+        while (prefix[prefixLen]) {
+            prefixLen++;
+        }
+    }
+
+    int zeros = spec.precision > len ? spec.precision - len : 0;
+    int used = prefixLen + zeros + len;
+    int pad = spec.width > used ? spec.width - used : 0;
+
+    if (spec.zero && !spec.left && spec.precision < 0) {
+        zeros += pad;
+        pad = 0;
+    }
+
+    if (!spec.left) {
+        PutRepeat(sink, ' ', pad);
+    }
+    if (negative) {
+        Put(sink, '-');
+    } else if (prefix) {
+        for (int i = 0; i < prefixLen; i++) {
+            Put(sink, prefix[i]);
+        }
+    }
+    PutRepeat(sink, '0', zeros);
+    while (len > 0) {
+        Put(sink, tmp[--len]);
+    }
+    if (spec.left) {
+        PutRepeat(sink, ' ', pad);
+    }
+}
+
+enum FormatLength {
+    LengthInt,
+    LengthChar,
+    LengthShort,
+    LengthLong,
+    LengthLongLong,
+    LengthSize
+};
+
+static uint64_t ReadUnsigned(va_list& args, FormatLength length) {
+    switch (length) {
+        case LengthChar: return (unsigned char)va_arg(args, unsigned int);
+        case LengthShort: return (unsigned short)va_arg(args, unsigned int);
+        case LengthLong: return va_arg(args, unsigned long);
+        case LengthLongLong: return va_arg(args, unsigned long long);
+        case LengthSize: return va_arg(args, size_t);
+        default: return va_arg(args, unsigned int);
+    }
+}
+
+static int64_t ReadSigned(va_list& args, FormatLength length) {
+    switch (length) {
+        case LengthChar: return (signed char)va_arg(args, int);
+        case LengthShort: return (short)va_arg(args, int);
+        case LengthLong: return va_arg(args, long);
+        case LengthLongLong: return va_arg(args, long long);
+        case LengthSize: return (int64_t)va_arg(args, size_t);
+        default: return va_arg(args, int);
+    }
+}
+
+static void Format(FormatSink& sink, const char* fmt, va_list& args) {
+    while (*fmt) {
+        if (*fmt != '%') {
+            Put(sink, *fmt++);
+            continue;
+        }
+        fmt++;
+
+        FormatSpec spec;
+        while (*fmt == '-' || *fmt == '0') {
+            if (*fmt == '-') {
+                spec.left = true;
+            } else {
+                spec.zero = true;
+            }
+            fmt++;
+        }
+
+        if (*fmt == '*') {
+            spec.width = va_arg(args, int);
+            if (spec.width < 0) {
+                spec.left = true;
+                spec.width = -spec.width;
+            }
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9') {
+                spec.width = spec.width * 10 + (*fmt++ - '0');
+            }
+        }
+
+        if (*fmt == '.') {
+            fmt++;
+            spec.precision = 0;
+            if (*fmt == '*') {
+                spec.precision = va_arg(args, int);
+                fmt++;
+            } else {
+                while (*fmt >= '0' && *fmt <= '9') {
+                    spec.precision = spec.precision * 10 + (*fmt++ - '0');
+                }
+            }
+        }
+
+        FormatLength length = LengthInt;
+        if (*fmt == 'h') {
+            fmt++;
+            length = LengthShort;
+            if (*fmt == 'h') {
+                fmt++;
+                length = LengthChar;
+            }
+        } else if (*fmt == 'l') {
+            fmt++;
+            length = LengthLong;
+            if (*fmt == 'l') {
+                fmt++;
+                length = LengthLongLong;
+            }
+        } else if (*fmt == 'z') {
+            fmt++;
+            length = LengthSize;
+        }
+
+        switch (*fmt) {
+            case 'd':
+            case 'i': {
+                int64_t value = ReadSigned(args, length);
+                uint64_t mag = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+                PutNumber(sink, spec, mag, value < 0, 10, false, nullptr);
+                break;
+            }
+            case 'u':
+                PutNumber(sink, spec, ReadUnsigned(args, length), false, 10, false, nullptr);
+                break;
+            case 'x':
+            case 'X':
+                PutNumber(sink, spec, ReadUnsigned(args, length), false, 16, *fmt == 'X', nullptr);
+                break;
+            case 'p':
+                PutNumber(sink, spec, (uint64_t)va_arg(args, void*), false, 16, false, "0x");
+                break;
+            case 's':
+                PutString(sink, spec, va_arg(args, const char*));
+                break;
+            case 'c': {
+                char str[2] = { (char)va_arg(args, int), '\0' };
+                spec.precision = -1;
+                PutString(sink, spec, str);
+                break;
+            }
+            case '%':
+                Put(sink, '%');
+                break;
+            case '\0':
+                /*
+                 * A % at the very end, so there's
+                 * nothing left to format.
+                */
+                return;
+            default:
+                /*
+                 * We don't know this one, so just
+                 * print it as it was written.
+                */
+                Put(sink, '%');
+                Put(sink, *fmt);
+                break;
+        }
+        fmt++;
+    }
+}
+
+int kvsnprintf(char* buf, size_t size, const char* fmt, va_list args) {
+    FormatSink sink = { buf, size, 0, 0, nullptr };
+
+    va_list copy;
+    va_copy(copy, args);
+    Format(sink, fmt, copy);
+    va_end(copy);
+
+    if (size > 0) {
+        buf[sink.pos] = '\0';
+    }
+    return (int)sink.total;
+}
+
+int ksnprintf(char* buf, size_t size, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int ret = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return ret;
+}
+
+static void ConsoleFlush(FormatSink& sink) {
+    sink.buf[sink.pos] = '\0';
+    ks->basicConsole.Print(sink.buf);
+    sink.pos = 0;
+}
+
+int kvprintf(const char* fmt, va_list args) {
+    char buf[128];
+    FormatSink sink = { buf, sizeof(buf), 0, 0, ConsoleFlush };
+
+    va_list copy;
+    va_copy(copy, args);
+    Format(sink, fmt, copy);
+    va_end(copy);
+
+    if (sink.pos > 0) {
+        ConsoleFlush(sink);
+    }
+    return (int)sink.total;
+}
+
+int kprintf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int ret = kvprintf(fmt, args);
+    va_end(args);
+    return ret;
+}
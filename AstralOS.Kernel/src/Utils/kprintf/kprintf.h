@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <stdarg.h>
+
+/*
+ * printf for the kernel. None of these touch
+ * the heap, so they are fine to call from
+ * I/O paths (or when the heap is broken).
+ *
+ * Supported: %d %i %u %x %X %p %s %c %%
+ * with the flags `-` and `0`, a width and
+ * a precision (both can be `*`), and the
+ * length modifiers `hh`, `h`, `l`, `ll`
+ * and `z`.
+ *
+ * ksnprintf works like snprintf. It always
+ * null terminates (if size isn't 0) and
+ * returns how long the string would have
+ * been, so you can tell if it got cut off.
+ *
+ * kprintf formats into a small buffer on
+ * the stack and prints it every time it
+ * fills up, so the output can be as long
+ * as you want.
+*/
+int kvsnprintf(char* buf, size_t size, const char* fmt, va_list args);
+int ksnprintf(char* buf, size_t size, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+int kvprintf(const char* fmt, va_list args);
+int kprintf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
@@ -1,18 +1,223 @@
 #include "utils.h"
+#include "cpu.h"
 #include "../KernelServices/Paging/MemoryAlloc/Heap.h"
 
+typedef uint64_t __attribute__((may_alias)) uint64_alias_t;
+
+/*
+ * The string funcs below look at 8 bytes at a
+ * time (SWAR, SIMD Within A Register).
+ *
+ * HasZero gives back a mask with the top bit
+ * set in every byte of `v` that is 0. It can
+ * also mark a byte *after* a 0 by mistake
+ * (because of the borrow), but never one
+ * before it, so the lowest set bit is always
+ * the first 0, which is all we need.
+ *
+ * -- Page boundaries --
+ * We can only read past the end of a string
+ * if we can't cross into the next page, because
+ * that page might not be mapped. An aligned 8
+ * byte read can never cross a page, so strlen
+ * and strchr start by rounding down to 8 bytes
+ * (the bytes before the string are ignored).
+ * strcmp can only align one of its strings, so
+ * it checks the other one before every read.
+*/
+static constexpr uint64_t OnesMask = 0x0101010101010101ULL;
+static constexpr uint64_t HighsMask = 0x8080808080808080ULL;
+static constexpr uintptr_t StrPageSize = 4096;
+
+static inline uint64_t HasZero(uint64_t v) {
+    return (v - OnesMask) & ~v & HighsMask;
+}
+
+static inline bool CrossesPage(const void* ptr) {
+    return ((uintptr_t)ptr & (StrPageSize - 1)) > StrPageSize - 8;
+}
+
 int strcmp(const char* s1, const char* s2) {
-    while (*s1 && (*s1 == *s2)) {
+    while ((uintptr_t)s1 & 7) {
+        if (*s1 != *s2 || !*s1) {
+            return (unsigned char)(*s1) - (unsigned char)(*s2);
+        }
         ++s1;
         ++s2;
     }
-    return (unsigned char)(*s1) - (unsigned char)(*s2);
+
+    while (true) {
+        if (!CrossesPage(s2)) {
+            uint64_t a = *(const uint64_alias_t*)s1;
+            uint64_t b = *(const uint64_alias_t*)s2;
+            if (a == b && !HasZero(a)) {
+                s1 += 8;
+                s2 += 8;
+                continue;
+            }
+        }
+
+        /*
+         * Either they differ somewhere in these 8
+         * bytes, one of them ends here, or s2 is
+         * too close to the end of its page, so
+         * we go byte by byte.
+        */
+        for (int i = 0; i < 8; i++) {
+            if (*s1 != *s2 || !*s1) {
+                return (unsigned char)(*s1) - (unsigned char)(*s2);
+            }
+            ++s1;
+            ++s2;
+        }
+    }
+}
+
+/*
+ * Anything at least this big gets copied/set
+ * with non-temporal stores, which go straight
+ * to memory instead of filling up the cache.
+ * That's only worth it when the buffer is
+ * bigger than the cache anyway, otherwise
+ * whoever reads it next has to go to memory.
+*/
+static constexpr size_t NonTemporalThreshold = 4 * 1024 * 1024;
+
+/*
+ * We use movnti here instead of movntdq, because
+ * it stores straight from a normal register. Our
+ * interrupt stubs don't save the XMM registers, so
+ * if we used them here, an IRQ handler that calls
+ * memcpy would trash whatever we were in the middle
+ * of copying.
+ *
+ * `blocks` is the number of 32 byte blocks, and
+ * `dest` should be 8 byte aligned.
+*/
+static void copy_nt(uint8_t* dest, const uint8_t* src, size_t blocks) {
+    asm volatile(
+        "1:\n\t"
+        "movq (%[s]), %%rax\n\t"
+        "movq 8(%[s]), %%rcx\n\t"
+        "movq 16(%[s]), %%rdx\n\t"
+        "movq 24(%[s]), %%r8\n\t"
+        "movnti %%rax, (%[d])\n\t"
+        "movnti %%rcx, 8(%[d])\n\t"
+        "movnti %%rdx, 16(%[d])\n\t"
+        "movnti %%r8, 24(%[d])\n\t"
+        "add $32, %[s]\n\t"
+        "add $32, %[d]\n\t"
+        "dec %[n]\n\t"
+        "jnz 1b\n\t"
+        "sfence"
+        : [s]"+r"(src), [d]"+r"(dest), [n]"+r"(blocks)
+        :
+        : "rax", "rcx", "rdx", "r8", "memory");
+}
+
+static void set_nt(uint8_t* dest, uint64_t pattern, size_t blocks) {
+    asm volatile(
+        "1:\n\t"
+        "movnti %[p], (%[d])\n\t"
+        "movnti %[p], 8(%[d])\n\t"
+        "movnti %[p], 16(%[d])\n\t"
+        "movnti %[p], 24(%[d])\n\t"
+        "add $32, %[d]\n\t"
+        "dec %[n]\n\t"
+        "jnz 1b\n\t"
+        "sfence"
+        : [d]"+r"(dest), [n]"+r"(blocks)
+        : [p]"r"(pattern)
+        : "memory");
+}
+
+/*
+ * Plain forward copy using the string
+ * instructions.
+ *
+ * If the CPU has ERMS (Enhanced REP MOVSB),
+ * `rep movsb` is the fastest way to copy on
+ * its own, since the microcode picks the
+ * best way to move the data. If not, we move
+ * 8 bytes at a time with `rep movsq` and
+ * then do the last few bytes one by one.
+*/
+static void copy_forward(uint8_t* dest, const uint8_t* src, size_t n) {
+    if (cpuFeatures.erms) {
+        asm volatile("rep movsb"
+                     : "+D"(dest), "+S"(src), "+c"(n)
+                     :
+                     : "memory");
+        return;
+    }
+
+    size_t qwords = n >> 3;
+    size_t bytes = n & 7;
+    asm volatile("rep movsq\n\t"
+                 "mov %[b], %%rcx\n\t"
+                 "rep movsb"
+                 : "+D"(dest), "+S"(src), "+c"(qwords)
+                 : [b]"r"(bytes)
+                 : "memory");
+}
+
+/*
+ * Copies from the end to the start, for when
+ * dest overlaps the end of src.
+ *
+ * We could use `std; rep movsb` but if an
+ * interrupt comes in while the direction flag
+ * is set, every memcpy in the handler would go
+ * backwards, so we just use a normal loop.
+*/
+static void copy_backward(uint8_t* dest, const uint8_t* src, size_t n) {
+    dest += n;
+    src += n;
+
+    size_t qwords = n >> 3;
+    if (qwords) {
+        asm volatile(
+            "1:\n\t"
+            "sub $8, %[s]\n\t"
+            "sub $8, %[d]\n\t"
+            "movq (%[s]), %%rax\n\t"
+            "movq %%rax, (%[d])\n\t"
+            "dec %[n]\n\t"
+            "jnz 1b"
+            : [s]"+r"(src), [d]"+r"(dest), [n]"+r"(qwords)
+            :
+            : "rax", "memory");
+    }
+
+    n &= 7;
+    while (n--) {
+        *--dest = *--src;
+    }
 }
 
 int memcmp(const void* s1, const void* s2, size_t n) {
     const unsigned char* p1 = (const unsigned char*)s1;
     const unsigned char* p2 = (const unsigned char*)s2;
 
+    /*
+     * Compare 8 bytes at a time until we find
+     * a difference. x86 is little endian, so we
+     * have to byte swap the words to find out
+     * which one is bigger in memory order.
+    */
+    while (n >= 8) {
+        uint64_t a = *(const uint64_alias_t*)p1;
+        uint64_t b = *(const uint64_alias_t*)p2;
+        if (a != b) {
+            a = __builtin_bswap64(a);
+            b = __builtin_bswap64(b);
+            return a < b ? -1 : 1;
+        }
+        p1 += 8;
+        p2 += 8;
+        n -= 8;
+    }
+
     for (size_t i = 0; i < n; ++i) {
         if (p1[i] != p2[i])
             return p1[i] - p2[i];
@@ -21,12 +226,82 @@ int memcmp(const void* s1, const void* s2, size_t n) {
 }
 
 void* memcpy(void* dest, const void* src, size_t n) {
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+
+    if (n >= NonTemporalThreshold && cpuFeatures.sse2) {
+        size_t head = (-(uintptr_t)d) & 7;
+        copy_forward(d, s, head);
+        d += head;
+        s += head;
+        n -= head;
+
+        size_t blocks = n >> 5;
+        copy_nt(d, s, blocks);
+        d += blocks << 5;
+        s += blocks << 5;
+        n &= 31;
+    }
+
+    copy_forward(d, s, n);
+    return dest;
+}
+
+/*
+ * If dest is before src (or they don't overlap)
+ * a forward copy is fine, since we always read
+ * a byte before we write over it.
+*/
+void* memmove(void* dest, const void* src, size_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+
+    if (d == s || n == 0) {
+        return dest;
+    }
+
+    if (d < s || d >= s + n) {
+        return memcpy(dest, src, n);
+    }
+
+    copy_backward(d, s, n);
+    return dest;
+}
 
-    for (size_t i = 0; i < n; ++i)
-        d[i] = s[i];
+void* memset(void* dest, uint8_t value, size_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    uint64_t pattern = value * 0x0101010101010101ULL;
 
+    if (n >= NonTemporalThreshold && cpuFeatures.sse2) {
+        size_t head = (-(uintptr_t)d) & 7;
+        for (size_t i = 0; i < head; i++) {
+            d[i] = value;
+        }
+        d += head;
+        n -= head;
+
+        size_t blocks = n >> 5;
+        set_nt(d, pattern, blocks);
+        d += blocks << 5;
+        n &= 31;
+    }
+
+    if (cpuFeatures.erms) {
+        asm volatile("rep stosb"
+                     : "+D"(d), "+c"(n)
+                     : "a"(value)
+                     : "memory");
+        return dest;
+    }
+
+    size_t qwords = n >> 3;
+    size_t bytes = n & 7;
+    asm volatile("rep stosq\n\t"
+                 "mov %[b], %%rcx\n\t"
+                 "rep stosb"
+                 : "+D"(d), "+c"(qwords)
+                 : "a"(pattern), [b]"r"(bytes)
+                 : "memory");
     return dest;
 }
 
@@ -44,6 +319,17 @@ char* strncpy(char* dest, const char* src, size_t maxLen) {
 }
 
 int strncmp(const char* s1, const char* s2, size_t n) {
+    while (n >= 8 && !CrossesPage(s1) && !CrossesPage(s2)) {
+        uint64_t a = *(const uint64_alias_t*)s1;
+        uint64_t b = *(const uint64_alias_t*)s2;
+        if (a != b || HasZero(a)) {
+            break;
+        }
+        s1 += 8;
+        s2 += 8;
+        n -= 8;
+    }
+
     for (size_t i = 0; i < n; ++i) {
         if (s1[i] != s2[i]) {
             return (unsigned char)s1[i] - (unsigned char)s2[i];
@@ -56,36 +342,59 @@ int strncmp(const char* s1, const char* s2, size_t n) {
 }
 
 size_t strlen(const char* str) {
-    size_t len = 0;
-    while (str[len] != '\0') {
-        ++len;
+    uintptr_t off = (uintptr_t)str & 7;
+    const uint64_alias_t* w = (const uint64_alias_t*)(str - off);
+
+    /*
+     * Set the bytes before the string to 0xFF,
+     * so they can't look like the end.
+    */
+    uint64_t v = *w | ((1ULL << (off * 8)) - 1);
+
+    while (true) {
+        uint64_t zero = HasZero(v);
+        if (zero) {
+            return (const char*)w - str + (__builtin_ctzll(zero) >> 3);
+        }
+        v = *++w;
     }
-    return len;
 }
 
+/*
+ * Same idea as strlen, but we look for either
+ * `ch` or the 0 at the end, whichever comes
+ * first. Like the standard one, looking for 0
+ * gives back the end of the string.
+*/
 char* strchr(const char* str, int ch) {
-    while (*str) {
-        if (*str == (char)ch) {
-            return (char*)str;
+    uint8_t c = (uint8_t)ch;
+    uint64_t pattern = c * OnesMask;
+
+    uintptr_t off = (uintptr_t)str & 7;
+    const uint64_alias_t* w = (const uint64_alias_t*)(str - off);
+    uint64_t before = (1ULL << (off * 8)) - 1;
+    uint64_t v = *w;
+
+    while (true) {
+        uint64_t found = HasZero(v | before) | HasZero((v ^ pattern) | before);
+        if (found) {
+            const char* p = (const char*)w + (__builtin_ctzll(found) >> 3);
+            return (uint8_t)*p == c ? (char*)p : nullptr;
         }
-        ++str;
+        before = 0;
+        v = *++w;
     }
-    return nullptr;
 }
 
 char* strdup(const char* src) {
     if (!src) return nullptr;
 
-    size_t len = 0;
-    while (src[len] != '\0') len++;
+    size_t len = strlen(src);
 
     char* dst = (char*)malloc(len + 1);
     if (!dst) return nullptr;
 
-    for (size_t i = 0; i <= len; i++) {
-        dst[i] = src[i];
-    }
-
+    memcpy(dst, src, len + 1);
     return dst;
 }
 
@@ -5,6 +5,8 @@
 int strcmp(const char* s1, const char* s2);
 int memcmp(const void* s1, const void* s2, size_t n);
 void* memcpy(void* dest, const void* src, size_t n);
+void* memmove(void* dest, const void* src, size_t n);
+void* memset(void* dest, uint8_t value, size_t n);
 char* strncpy(char* dest, const char* src, size_t maxLen);
 int strncmp(const char* s1, const char* s2, size_t n);
 size_t strlen(const char* str);
@@ -4,6 +4,7 @@
 #include <cstddef>
 #include "Utils/utils.h"
 #include "KernelServices/ELF/elf.h"
+#include "Utils/Benchmark/Benchmark.h"
 
 /*
  * Want to Learn OSDev
@@ -11,52 +12,6 @@
  * how the kernel works.
  * Read the comments.
 */
-//static bool shiftHeld = false;
-const char scancodeKeys[200] = {
-                                                                   // backspace = `
-    0, 0, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', 2,
-    0, 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', 3, 
-    0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '"', 0, 0,
-    0, 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0, 0, 0, ' '
-};
-const char CAPSscancodeKeys[200] = {
-                                                                   // backspace = `
-    0, 0, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '_', '+', 2,
-    0, 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', 3, 
-    0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', 0, 0,
-    0, 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0, 0, 0, ' '
-};
-extern "C" void irq1_handler() {///Key press!
-    uint8_t scancode = inb(0x60);
-    if (scancode == 0x2A || scancode == 0x36) {
-        ks->basicConsole.shift = true;
-    } else if (scancode == 0xAA || scancode == 0xB6) {
-        ks->basicConsole.shift = false;
-    }
-    if (scancode > 58) {
-
-    } else if (scancodeKeys[scancode] == 2) {
-        ks->basicConsole.Backspace();
-    } else if (scancodeKeys[scancode] == 3) {
-        ks->basicConsole.FinishInput();
-        ks->basicConsole.Print("\n");
-    } else if (scancodeKeys[scancode] == 0) {
-    } else {
-        if (ks->basicConsole.shift) {
-            char str[2] = { CAPSscancodeKeys[scancode], 0 };
-            ks->basicConsole.Print(str);
-            ks->basicConsole.SubmitText(str);
-        } else {
-            char str[2] = { scancodeKeys[scancode], 0 };
-            ks->basicConsole.Print(str);
-            ks->basicConsole.SubmitText(str);
-        }
-    }
-    ks->apic.WriteAPIC(APICRegs::EOI, 0);
-}
-
-extern "C" void irq_stub();
-
 void Printks(const char* str) {
     ks->basicConsole.Println(str);
 }
@@ -140,6 +95,13 @@ extern "C" int start(KernelServices& kernelServices, BootInfo* pBootInfo) {
 
     kernelServices.basicConsole.pFramebuffer.BaseAddress = pBootInfo->pFramebuffer.BaseAddress;
 
+    /*
+     * Find out what the CPU supports, so
+     * memcpy and friends can pick the
+     * fastest way to do things.
+    */
+    DetectCPUFeatures();
+
     /*
      * Clear the framebuffer
     */
@@ -153,6 +115,13 @@ extern "C" int start(KernelServices& kernelServices, BootInfo* pBootInfo) {
     */
     kernelServices.heapAllocator.Initialize();
 
+    /*
+     * The console can draw into a buffer
+     * in RAM now, which is a lot faster
+     * than drawing into the framebuffer.
+    */
+    kernelServices.basicConsole.EnableShadowBuffer();
+
     /*
      * Initialize our Init RAM FS
      * after initializing our heap
@@ -226,21 +195,9 @@ extern "C" int start(KernelServices& kernelServices, BootInfo* pBootInfo) {
     kernelServices.basicConsole.Println("Freed remaining blocks");
 
     /*
-     * Test I/O APIC
+     * Keyboard on IRQ 1.
     */
-
-    RedirectionEntry entry = {};
-    
-    entry.vector = 0x21;         // vector = your IDT index
-    entry.delvMode = 0;          // fixed
-    entry.destMode = 0;          // physical
-    entry.mask = 0;              // ENABLED
-    entry.triggerMode = 0;       // edge-triggered for IRQ1
-    entry.pinPolarity = 0;       // high active
-    entry.destination = 0;       // LAPIC ID of current CPU
-    
-    kernelServices.ioapic.writeRedirEntry(1, &entry); // IRQ1 = GSI 1
-    kernelServices.idt.SetDescriptor(0x21, (void*)irq_stub, 0x8E); // Set IDT entry for IRQ1
+    kernelServices.keyboard.Initialize(KEYBOARD_VECTOR);
 
     /*
      * Test Array
@@ -284,6 +241,7 @@ extern "C" int start(KernelServices& kernelServices, BootInfo* pBootInfo) {
     }
 
     kernelServices.timer.Calibrate();
+    kernelServices.log.SetTSCPerMs(TSCTicksPerMs());
 
     kernelServices.basicConsole.Print("Waiting for 1s...");
     kernelServices.timer.sleep(1000);
@@ -555,7 +513,7 @@ extern "C" int start(KernelServices& kernelServices, BootInfo* pBootInfo) {
     kernelServices.vfs.close(newFile);
 
     while (true) {
-        kernelServices.basicConsole.Println("[Commands: read/write]");
+        kernelServices.basicConsole.Println("[Commands: read/write/create/bench/dmesg/irqs/bcache/iosched/sync]");
         kernelServices.basicConsole.Print(">>> ");
         char* inp = kernelServices.basicConsole.Input();
         if ((strcmp(inp, "READ") == 0) || (strcmp(inp, "read") == 0)) {
@@ -596,6 +554,25 @@ extern "C" int start(KernelServices& kernelServices, BootInfo* pBootInfo) {
             kernelServices.vfs.write(fR, (void*)dat, datasize);
 
             kernelServices.vfs.close(fR);
+        } else if ((strcmp(inp, "BENCH") == 0) || (strcmp(inp, "bench") == 0)) {
+            BenchMemory();
+            BenchStrings();
+            BenchConsole();
+            BenchBlock();
+            BenchScheduler();
+            BenchMixed();
+        } else if ((strcmp(inp, "DMESG") == 0) || (strcmp(inp, "dmesg") == 0)) {
+            kernelServices.log.Dump();
+        } else if ((strcmp(inp, "IRQS") == 0) || (strcmp(inp, "irqs") == 0)) {
+            kernelServices.irq.DumpStats();
+        } else if ((strcmp(inp, "BCACHE") == 0) || (strcmp(inp, "bcache") == 0)) {
+            kernelServices.bcache.DumpStats();
+        } else if ((strcmp(inp, "IOSCHED") == 0) || (strcmp(inp, "iosched") == 0)) {
+            kernelServices.iosched.DumpStats();
+        } else if ((strcmp(inp, "SYNC") == 0) || (strcmp(inp, "sync") == 0)) {
+            if (!kernelServices.bcache.Sync(nullptr)) {
+                kernelServices.basicConsole.Println("sync: some blocks failed to write back");
+            }
         }
     }
     return 0;
@@ -43,6 +43,22 @@ bool GenericAHCI::WriteSector(uint64_t lba, void* buffer) {
     return pdev->WriteSector(drive, lba, buffer);
 }
 
+bool GenericAHCI::ReadSectors(uint64_t lba, uint32_t count, void* buffer) {
+    return pdev->ReadSectors(drive, lba, count, buffer);
+}
+
+bool GenericAHCI::WriteSectors(uint64_t lba, uint32_t count, void* buffer) {
+    return pdev->WriteSectors(drive, lba, count, buffer);
+}
+
+bool GenericAHCI::Submit(BlockRequest* req) {
+    return pdev->Submit(drive, req);
+}
+
+bool GenericAHCI::Wait(BlockRequest* req) {
+    return pdev->Wait(drive, req);
+}
+
 uint64_t GenericAHCI::SectorCount() const {
     return pdev->SectorCount(drive);
 }
@@ -2,31 +2,8 @@
 #include "../global.h"
 #include <new>
 
-const char* to_hstridng(uint64_t value) {
-    static char buffer[19];
-    char* ptr = buffer + sizeof(buffer) - 1;
-    *ptr = '\0';
-
-    do {
-        uint8_t nibble = value & 0xF;
-        *--ptr = (nibble < 10) ? ('0' + nibble) : ('A' + nibble - 10);
-        value >>= 4;
-    } while (value > 0);
-
-    *--ptr = 'x';
-    *--ptr = '0';
-
-    return ptr;
-}
-
 void* memcpy(void* dest, const void* src, size_t n) {
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
-
-    for (size_t i = 0; i < n; ++i)
-        d[i] = s[i];
-
-    return dest;
+    return g_ds->memcpy(dest, src, n);
 }
 
 bool GenericAHCIControllerFactory::Supports(const DeviceKey& devKey) {
@@ -43,16 +20,26 @@ BlockController* GenericAHCIControllerFactory::CreateDevice() {
         return nullptr;
     }
 
-    GenericAHCIController* device = new(mem) GenericAHCIController();
+    /*
+     * No () here, or the compiler zeroes the
+     * whole (big) object with a memset call we
+     * don't have. Init clears what it needs.
+    */
+    GenericAHCIController* device = new(mem) GenericAHCIController;
     return device;
 }
 
 void* memset(void* dest, uint8_t value, size_t num) {
-    uint8_t* ptr = (uint8_t*)dest;
-    for (size_t i = 0; i < num; i++) {
-        ptr[i] = value;
-    }
-    return dest;
+    return g_ds->memset(dest, value, num);
+}
+
+/*
+ * Physical memory under 4GB gets mapped in the
+ * higher half like the rest of our MMIO, and
+ * anything above that is mapped where it is.
+*/
+static inline uint64_t DMAVirt(uint64_t phys) {
+    return phys < 0x100000000ULL ? 0xFFFFFFFF00000000 + phys : phys;
 }
 
 void GenericAHCIController::probe_port(HBA_MEM *abar) {
@@ -63,20 +50,15 @@ void GenericAHCIController::probe_port(HBA_MEM *abar) {
 			int dt = check_type(&abar->ports[i]);
 
 			if (dt == AHCI_DEV_SATA) {
-				_ds->Print("SATA drive found at port ");
-				_ds->Println(to_hstridng(i));
+				_ds->klog(LOG_INFO, "AHCI: SATA drive found at port %d", i);
 			} else if (dt == AHCI_DEV_SATAPI) {
-				_ds->Print("SATAPI drive found at port ");
-				_ds->Println(to_hstridng(i));
+				_ds->klog(LOG_INFO, "AHCI: SATAPI drive found at port %d", i);
 			} else if (dt == AHCI_DEV_SEMB) {
-				_ds->Print("SEMB drive found at port ");
-				_ds->Println(to_hstridng(i));
+				_ds->klog(LOG_INFO, "AHCI: SEMB drive found at port %d", i);
 			} else if (dt == AHCI_DEV_PM) {
-				_ds->Print("PM drive found at port ");
-				_ds->Println(to_hstridng(i));
+				_ds->klog(LOG_INFO, "AHCI: PM drive found at port %d", i);
 			} else {
-				_ds->Print("No drive found at port ");
-				_ds->Println(to_hstridng(i));
+				_ds->klog(LOG_DEBUG, "AHCI: No drive found at port %d", i);
 			}
 		}
 
@@ -109,47 +91,6 @@ int GenericAHCIController::check_type(HBA_PORT *port) {
 	}
 }
 
-void GenericAHCIController::port_rebase(HBA_PORT *port, int portno) {
-	stop_cmd(port);
-
-	/*
-     * Command list offset: 1K*portno
-	 * Command list entry size = 32
-	 * Command list entry maxim count = 32
-	 * Command list maxim size = 32*32 = 1K per port
-    */
-	port->clb = AHCI_BASE + (portno << 10);
-	port->clbu = 0;
-	memset((void*)(port->clb), 0, 1024);
-
-	/*
-     * FIS offset: 32K+256*portno
-	 * FIS entry size = 256 bytes per port
-    */
-	port->fb = AHCI_BASE + (32 << 10) + (portno << 8);
-	port->fbu = 0;
-	memset((void*)(port->fb), 0, 256);
-
-	/*
-     * Command table offset: 40K + 8K*portno
-	 * Command table size = 256*32 = 8K per port
-    */
-	HBA_CMD *cmdheader = (HBA_CMD*)(port->clb);
-	for (int i = 0; i < 32; i++) {
-        /*
-         * 8 prdt entries per command table
-         * 256 bytes per command table, 64 + 16 + 48 + 16 * 8
-         * Command table offset: 40K + 8K * portno + cmdheader_index * 256
-        */
-		cmdheader[i].prdtl = 8;
-		cmdheader[i].ctba = AHCI_BASE + (40 << 10) + (portno << 13) + (i << 8);
-		cmdheader[i].ctbau = 0;
-		memset((void*)cmdheader[i].ctba, 0, 256);
-	}
-
-	start_cmd(port);
-}
-
 void GenericAHCIController::start_cmd(HBA_PORT *port) {
 	/*
      * Wait until CR (bit15) is cleared
@@ -190,131 +131,654 @@ void GenericAHCIController::stop_cmd(HBA_PORT *port) {
 	}
 }
 
-bool GenericAHCIController::ahci_send_cmd(HBA_PORT* port, FIS_H2D* fis, void* buffer, uint32_t buf_size, uint16_t prdtl, bool write) {
-    uint32_t slot = 0xFFFFFFFF;
-    uint32_t timer = 100000;
-    while (slot == 0xFFFFFFFF) {
-        uint32_t slots = port->sact | port->ci;
-        for (int i = 0; i < 32; i++) {
-            if ((slots & (1 << i)) == 0) {
-                slot = i;
-                break;
-            }
+/*
+ * Turns interrupts off so the IRQ handler
+ * can't touch the port state while we do.
+ * Drivers only run on one CPU for now, so
+ * that's all the locking we need.
+*/
+static inline uint64_t AHCILock() {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void AHCIUnlock(uint64_t flags) {
+    if (flags & (1 << 9)) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+/*
+ * How many PRDT entries the segments need,
+ * or -1 if they don't fit in one command
+ * table. Segments bigger than 4MB get split
+ * over more than one entry.
+ *
+ * The HBA only does word sized transfers, so
+ * every segment has to start on an even
+ * address and have an even size. Without
+ * S64A it also has to be under 4GB.
+*/
+int32_t GenericAHCIController::CountPRDT(const DMASegment* segs, size_t segCount) {
+    int32_t entries = 0;
+    for (size_t i = 0; i < segCount; i++) {
+        if ((segs[i].phys & 1) || (segs[i].size & 1)) {
+            return -1;
         }
-        _ds->sleep(5);
-        if (timer-- == 0) {
-            return false;
+        if (!dma64 && segs[i].phys + segs[i].size > 0x100000000ULL) {
+            return -1;
         }
+        entries += (segs[i].size + AHCI_PRDT_MAX_BYTES - 1) / AHCI_PRDT_MAX_BYTES;
     }
 
-    int8_t status = port->tfd;
-
-    if (status & ATA_STATUS_BSY) {
-        _ds->Println("Device is busy");
-    }
-    if (status & ATA_STATUS_DRQ) {
-        _ds->Println("Device requesting data");
+    if (entries > AHCI_PRDT_ENTRIES) {
+        return -1;
     }
+    return entries;
+}
 
-    port->is = (uint32_t)-1;
+/*
+ * Fills in the command header and table for
+ * `slot`. This doesn't touch PxCI, so it's
+ * fine while other slots are in flight.
+ *
+ * Every segment becomes one or more PRDT
+ * entries, and only the last one asks for
+ * an interrupt. CountPRDT has to have said
+ * the segments fit already.
+ *
+ * ATAPI packets go in the ACMD area of the
+ * table, and the A bit tells the HBA to send
+ * them after the PACKET command.
+*/
+void GenericAHCIController::BuildCommand(HBA_PORT* port, uint32_t slot, FIS_H2D* fis, const DMASegment* segs, size_t segCount, bool write, uint8_t* packet, size_t packetLen) {
+    AHCIPortState& ps = portState[port - hba->ports];
+    HBA_CMD* cmdheader = ps.cmdList;
+    HBA_CMD_TBL* cmdtbl = &ps.tables[slot];
+
+    uint16_t entries = 0;
+    for (size_t i = 0; i < segCount; i++) {
+        uint64_t phys = segs[i].phys;
+        uint32_t left = segs[i].size;
+
+        while (left > 0) {
+            uint32_t size = left > AHCI_PRDT_MAX_BYTES ? AHCI_PRDT_MAX_BYTES : left;
+
+            HBA_PRDT_ENTRY& entry = cmdtbl->prdt_entry[entries++];
+            entry.dba = (uint32_t)(phys & 0xFFFFFFFF);
+            entry.dbau = (uint32_t)((phys >> 32) & 0xFFFFFFFF);
+            entry.rsv0 = 0;
+            entry.dbc = size - 1;
+            entry.i = 0;
+
+            phys += size;
+            left -= size;
+        }
+    }
 
-    HBA_CMD* cmdheader = (HBA_CMD*)port->clb;
-    HBA_CMD_TBL* cmdtbl = (HBA_CMD_TBL*)(0xFFFFFFFF00000000 + cmdheader[slot].ctba);
+    if (entries > 0) {
+        cmdtbl->prdt_entry[entries - 1].i = 1;
+    }
 
     cmdheader[slot].cfl = sizeof(FIS_H2D) / sizeof(uint32_t);
-    if (write) {
-        cmdheader[slot].w = 1;
-    } else {
-        cmdheader[slot].w = 0;
-    }
+    cmdheader[slot].w = write ? 1 : 0;
+    cmdheader[slot].a = packet ? 1 : 0;
     cmdheader[slot].c = 0;
-    cmdheader[slot].prdtl = prdtl;
+    cmdheader[slot].prdtl = entries;
     cmdheader[slot].prdbc = 0;
 
-    cmdtbl->prdt_entry[0].dba = (uint32_t)((uintptr_t)buffer & 0xFFFFFFFF);
-    cmdtbl->prdt_entry[0].dbau = (uint32_t)(((uintptr_t)buffer >> 32) & 0xFFFFFFFF);
-    cmdtbl->prdt_entry[0].dbc = buf_size - 1;
-    cmdtbl->prdt_entry[0].i = 1;
-
     memset(&cmdtbl->cfis, 0, sizeof(FIS_H2D));
     memcpy(&cmdtbl->cfis, fis, sizeof(FIS_H2D));
 
-    while (port->tfd & (ATA_STATUS_BSY | ATA_STATUS_DRQ)) {
-
+    if (packet) {
+        memset(cmdtbl->acmd, 0, sizeof(cmdtbl->acmd));
+        memcpy(cmdtbl->acmd, packet, packetLen > sizeof(cmdtbl->acmd) ? sizeof(cmdtbl->acmd) : packetLen);
     }
+}
 
-    port->ci = 1 << slot;
+/*
+ * Claims a slot, builds the command and hands
+ * it to the HBA without waiting for it. Once it
+ * finishes, done(ctx, ok) gets called from the
+ * IRQ handler (or from Poll, if we're polling),
+ * so keep it short.
+ *
+ * For NCQ the tag is just the slot number. It
+ * goes in the FIS's count field, and the slot
+ * has to be set in PxSACT before PxCI.
+ *
+ * A normal command can't be sent while NCQ
+ * commands are still running (the drive would
+ * abort all of them), so those wait for the
+ * port to go idle first.
+*/
+bool GenericAHCIController::Issue(uint32_t portNo, FIS_H2D* fis, const DMASegment* segs, size_t segCount, bool write, bool queued, AHCIDone done, void* ctx, uint8_t* packet, size_t packetLen) {
+    AHCIPortState& ps = portState[portNo];
+    volatile HBA_PORT* port = &hba->ports[portNo];
 
-    while ((port->ci & (1 << slot))) {
-        if (port->is & HBA_PxIS_TFES) {
-            _ds->Println("AHCI: Task file error");
-            return false;
-        }
+    if (CountPRDT(segs, segCount) < 0) {
+        _ds->klog(LOG_ERROR, "AHCI: port %u can't fit %zu segments in one command", portNo, segCount);
+        return false;
     }
 
-    if (port->is & HBA_PxIS_TFES) {
+    if (!queued) {
+        WaitIdle(portNo);
+    }
+
+    int32_t slot = ClaimSlot(portNo);
+    if (slot < 0) {
         return false;
     }
 
+    if (queued) {
+        fis->countl = (uint8_t)(slot << 3);
+        fis->counth = 0;
+    }
+
+    ps.slots[slot].done = done;
+    ps.slots[slot].ctx = ctx;
+
+    BuildCommand((HBA_PORT*)port, slot, fis, segs, segCount, write, packet, packetLen);
+
+    if (!queued) {
+        while (port->tfd & (ATA_STATUS_BSY | ATA_STATUS_DRQ)) {
+
+        }
+    }
+
+    uint32_t bit = 1U << slot;
+    uint64_t flags = AHCILock();
+    ps.issued |= bit;
+    if (queued) {
+        ps.queued |= bit;
+        port->sact = bit;
+    }
+    port->ci = bit;
+    AHCIUnlock(flags);
     return true;
 }
 
-bool GenericAHCIController::cd_send_cmd(HBA_PORT* port, FIS_H2D* fis, void* buffer, uint32_t bsize, uint8_t* packet, size_t len)  {
-    uint32_t slot = 0xFFFFFFFF;
-    uint32_t timer = 100000;
-    while (slot == 0xFFFFFFFF) {
-        uint32_t slots = port->sact | port->ci;
-        for (int i = 0; i < 32; i++) {
-            if ((slots & (1 << i)) == 0) {
-                slot = i;
-                break;
+/*
+ * Every port has a bitmap of its free command
+ * slots, so finding one is a tzcnt instead of
+ * scanning PxCI, and claiming it is a single
+ * compare and swap, which means two callers
+ * can't end up with the same slot.
+ *
+ * We only back off when every slot really is
+ * busy: first by spinning, then by sleeping
+ * a millisecond at a time, for about 5 seconds
+ * before we give up. Each time round we reap
+ * the port ourselves first, since without a
+ * working IRQ nobody else would hand the
+ * slots back.
+*/
+int32_t GenericAHCIController::ClaimSlot(uint32_t portNo) {
+    volatile uint32_t* freeSlots = &portState[portNo].freeSlots;
+    uint32_t tries = 0;
+    while (true) {
+        uint32_t free = __atomic_load_n(freeSlots, __ATOMIC_ACQUIRE);
+        if (free == 0) {
+            tries++;
+            if (tries > 5000 + SlotSpins) {
+                _ds->klog(LOG_ERROR, "AHCI: port %u has no free command slots", portNo);
+                return -1;
+            }
+
+            uint64_t flags = AHCILock();
+            Poll(portNo);
+            AHCIUnlock(flags);
+            if (__atomic_load_n(freeSlots, __ATOMIC_ACQUIRE) != 0) {
+                continue;
+            }
+
+            if (tries <= SlotSpins) {
+                asm volatile("pause");
+            } else {
+                _ds->sleep(1);
             }
+            continue;
         }
-        _ds->sleep(5);
-        if (timer-- == 0) {
-            return false;
+
+        uint32_t slot = __builtin_ctz(free);
+        if (__atomic_compare_exchange_n(freeSlots, &free, free & ~(1U << slot), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return (int32_t)slot;
         }
     }
+}
+
+void GenericAHCIController::ReleaseSlot(uint32_t portNo, uint32_t slot) {
+    __atomic_fetch_or(&portState[portNo].freeSlots, 1U << slot, __ATOMIC_RELEASE);
+}
 
+/*
+ * Clearing ST makes the HBA drop everything in
+ * PxCI and PxSACT, then we clear the errors and
+ * start it again. This doesn't do a COMRESET, so
+ * a drive that's stuck with BSY set stays stuck.
+*/
+void GenericAHCIController::RestartPort(uint32_t portNo) {
+    volatile HBA_PORT* port = &hba->ports[portNo];
+
+    port->cmd &= ~HBA_PxCMD_ST;
+    while (port->cmd & HBA_PxCMD_CR) {
+
+    }
+
+    port->serr = port->serr;
     port->is = (uint32_t)-1;
+    port->cmd |= HBA_PxCMD_ST;
+}
 
-    HBA_CMD* cmdheader = (HBA_CMD*)port->clb;
-    HBA_CMD_TBL* cmdtbl = (HBA_CMD_TBL*)(0xFFFFFFFF00000000 + cmdheader[slot].ctba);
+void GenericAHCIController::Complete(uint32_t portNo, uint32_t slots, bool ok) {
+    AHCIPortState& ps = portState[portNo];
+    while (slots) {
+        uint32_t slot = __builtin_ctz(slots);
+        slots &= slots - 1;
+
+        AHCIDone done = ps.slots[slot].done;
+        void* ctx = ps.slots[slot].ctx;
+        ReleaseSlot(portNo, slot);
+        if (done) {
+            done(ctx, ok);
+        }
+    }
+}
 
-    cmdheader[slot].cfl = sizeof(FIS_H2D) / sizeof(uint32_t);
-    cmdheader[slot].w = (buffer && bsize > 0) ? 0 : 1;
-    cmdheader[slot].prdtl = (buffer && bsize > 0) ? 1 : 0;
-    cmdheader[slot].prdbc = 0;
+/*
+ * Finishes whatever the HBA is done with. A
+ * slot is done once it's gone from both PxCI
+ * and PxSACT. For NCQ, the drive clears the
+ * PxSACT bits with a Set Device Bits FIS, in
+ * whatever order it finished them.
+ *
+ * If the port hit an error, the HBA stops, so
+ * everything in flight fails and we restart it.
+ *
+ * Has to be called with interrupts off.
+*/
+void GenericAHCIController::Reap(uint32_t portNo) {
+    AHCIPortState& ps = portState[portNo];
+    volatile HBA_PORT* port = &hba->ports[portNo];
+
+    uint32_t issued = ps.issued;
+    if (issued == 0) {
+        ps.errors = 0;
+        return;
+    }
 
-    if (buffer && bsize > 0) {
-        cmdtbl->prdt_entry[0].dba = (uint32_t)((uintptr_t)buffer & 0xFFFFFFFF);
-        cmdtbl->prdt_entry[0].dbau = (uint32_t)(((uintptr_t)buffer >> 32) & 0xFFFFFFFF);
-        cmdtbl->prdt_entry[0].dbc = bsize - 1;
-        cmdtbl->prdt_entry[0].i = 1;
+    if (ps.errors) {
+        _ds->klog(LOG_ERROR, "AHCI: port %u error, IS 0x%X TFD 0x%X", portNo, ps.errors, port->tfd);
+        ps.errors = 0;
+        ps.issued = 0;
+        ps.queued = 0;
+        RestartPort(portNo);
+        Complete(portNo, issued, false);
+        return;
     }
 
-    memset(&cmdtbl->cfis, 0, sizeof(FIS_H2D));
-    memcpy(&cmdtbl->cfis, fis, sizeof(FIS_H2D));
+    uint32_t finished = issued & ~(port->ci | port->sact);
+    if (finished == 0) {
+        return;
+    }
+
+    ps.issued = issued & ~finished;
+    ps.queued &= ~finished;
+    Complete(portNo, finished, true);
+}
+
+/*
+ * PxIS is write 1 to clear. Errors get saved in
+ * the port state for Reap, since we just wiped
+ * them from PxIS.
+*/
+void GenericAHCIController::AckPort(uint32_t portNo) {
+    volatile HBA_PORT* port = &hba->ports[portNo];
+    uint32_t is = port->is;
+    port->is = is;
+
+    if (is & HBA_PxIS_ERRORS) {
+        portState[portNo].errors |= is & HBA_PxIS_ERRORS;
+    }
+}
+
+/*
+ * What the IRQ handler does, for when we
+ * have to poll instead.
+*/
+void GenericAHCIController::Poll(uint32_t portNo) {
+    AckPort(portNo);
+    Reap(portNo);
+}
 
-    memcpy(((uint8_t*)&cmdtbl->cfis) + sizeof(FIS_H2D), packet, len);
+/*
+ * One step of waiting, called with interrupts
+ * off (flags is what AHCILock saved).
+ *
+ * Once we know the controller's interrupt works
+ * we hlt. The sti; hlt pair means an interrupt
+ * that comes in between our check and the hlt
+ * still wakes us up. If interrupts were off, or
+ * the controller hasn't sent one yet, we poll.
+ *
+ * We still poll after every hlt, and the timer
+ * makes sure we come out of it, so a lost or
+ * badly acked IRQ only costs AHCI_WAKEUP_MS.
+*/
+void GenericAHCIController::WaitStep(uint32_t portNo, uint64_t flags) {
+    if (irqWorking && (flags & (1 << 9))) {
+        _ds->ArmWakeup(AHCI_WAKEUP_MS);
+        asm volatile("sti; hlt" : : : "memory");
+
+        flags = AHCILock();
+        Poll(portNo);
+        AHCIUnlock(flags);
+    } else {
+        Poll(portNo);
+        AHCIUnlock(flags);
+        asm volatile("pause");
+    }
+}
+
+bool GenericAHCIController::WaitFor(uint32_t portNo, AHCIWait& wait) {
+    while (true) {
+        uint64_t flags = AHCILock();
+        if (wait.done) {
+            AHCIUnlock(flags);
+            return wait.ok;
+        }
+        WaitStep(portNo, flags);
+    }
+}
+
+void GenericAHCIController::WaitIdle(uint32_t portNo) {
+    while (true) {
+        uint64_t flags = AHCILock();
+        if (portState[portNo].issued == 0) {
+            AHCIUnlock(flags);
+            return;
+        }
+        WaitStep(portNo, flags);
+    }
+}
+
+static void WakeWaiter(void* ctx, bool ok) {
+    AHCIWait* wait = (AHCIWait*)ctx;
+    wait->ok = ok;
+    wait->done = true;
+}
+
+bool GenericAHCIController::ahci_send_cmd(HBA_PORT* port, FIS_H2D* fis, void* buffer, uint32_t buf_size, bool write) {
+    uint32_t portNo = port - hba->ports;
+    AHCIWait wait = { false, false };
+
+    DMASegment seg = { (uint64_t)buffer, buf_size };
+    if (!Issue(portNo, fis, &seg, buffer && buf_size ? 1 : 0, write, false, WakeWaiter, &wait)) {
+        return false;
+    }
+    if (!WaitFor(portNo, wait)) {
+        _ds->Println("AHCI: Task file error");
+        return false;
+    }
+    return true;
+}
 
-    while (port->tfd & (ATA_STATUS_BSY | ATA_STATUS_DRQ)) {
+bool GenericAHCIController::cd_send_cmd(HBA_PORT* port, FIS_H2D* fis, void* buffer, uint32_t bsize, uint8_t* packet, size_t len)  {
+    uint32_t portNo = port - hba->ports;
+    AHCIWait wait = { false, false };
 
+    DMASegment seg = { (uint64_t)buffer, bsize };
+    if (!Issue(portNo, fis, &seg, buffer && bsize ? 1 : 0, false, false, WakeWaiter, &wait, packet, len)) {
+        return false;
     }
+    return WaitFor(portNo, wait);
+}
 
-    port->ci = 1 << slot;
+/*
+ * Starts a read or write of `count` sectors
+ * and returns right away, done(ctx, ok) gets
+ * called when it's finished. With NCQ, up to
+ * the drive's queue depth of these can be in
+ * flight at once, and the drive finishes them
+ * in whatever order suits it.
+ *
+ * The segments say where the data goes, and
+ * they have to add up to exactly `count`
+ * sectors.
+ *
+ * NCQ puts the sector count in the features
+ * field, since the count field holds the tag.
+*/
+bool GenericAHCIController::TransferAsync(uint8_t drive, uint64_t lba, uint32_t count, const DMASegment* segs, size_t segCount, bool write, AHCIDone done, void* ctx) {
+    AHCIPortState& ps = portState[drive];
 
-    while ((port->ci & (1 << slot))) {
-        if (port->is & HBA_PxIS_TFES) {
-            port->is = (uint32_t)-1;
+    if (count == 0 || count > AHCI_MAX_SECTORS) {
+        return false;
+    }
+
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < segCount; i++) {
+        bytes += segs[i].size;
+    }
+    if (bytes != (uint64_t)count * SectorSize(drive)) {
+        _ds->klog(LOG_ERROR, "AHCI: segments are %lu bytes, but %u sectors were asked for", bytes, count);
+        return false;
+    }
+
+    FIS_H2D fis{};
+    fis.fis_type = FIS_TYPE_REG_H2D;
+    fis.c = 1;
+    fis.device = 1 << 6;
+
+    fis.lba0 = (uint8_t)(lba & 0xFF);
+    fis.lba1 = (uint8_t)((lba >> 8) & 0xFF);
+    fis.lba2 = (uint8_t)((lba >> 16) & 0xFF);
+    fis.lba3 = (uint8_t)((lba >> 24) & 0xFF);
+    fis.lba4 = (uint8_t)((lba >> 32) & 0xFF);
+    fis.lba5 = (uint8_t)((lba >> 40) & 0xFF);
+
+    if (ps.ncq) {
+        fis.command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+        fis.featurel = (uint8_t)(count & 0xFF);
+        fis.featureh = (uint8_t)((count >> 8) & 0xFF);
+    } else {
+        fis.command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+        fis.countl = (uint8_t)(count & 0xFF);
+        fis.counth = (uint8_t)((count >> 8) & 0xFF);
+    }
+
+    return Issue(drive, &fis, segs, segCount, write, ps.ncq, done, ctx);
+}
+
+/*
+ * The most sectors one command can move. The
+ * count field caps it at 65535, and the PRDT
+ * at AHCI_PRDT_ENTRIES * 4MB, in case that's
+ * ever less.
+*/
+uint32_t GenericAHCIController::MaxSectors(uint8_t drive) const {
+    uint32_t max = (uint32_t)(((uint64_t)AHCI_PRDT_ENTRIES * AHCI_PRDT_MAX_BYTES) / SectorSize(drive));
+    return max > AHCI_MAX_SECTORS ? AHCI_MAX_SECTORS : max;
+}
+
+/*
+ * For a physically contiguous buffer. This
+ * only splits it up when it's bigger than
+ * one command can take, so a 1MB read is a
+ * single command instead of 2048 of them.
+*/
+bool GenericAHCIController::Transfer(uint8_t drive, uint64_t lba, uint32_t count, uint64_t buffer, bool write) {
+    uint32_t sectorSize = SectorSize(drive);
+    uint32_t max = MaxSectors(drive);
+
+    while (count > 0) {
+        uint32_t chunk = count > max ? max : count;
+
+        DMASegment seg = { buffer, chunk * sectorSize };
+        AHCIWait wait = { false, false };
+        if (!TransferAsync(drive, lba, chunk, &seg, 1, write, WakeWaiter, &wait)) {
+            return false;
+        }
+        if (!WaitFor(drive, wait)) {
             return false;
         }
+
+        lba += chunk;
+        buffer += (uint64_t)chunk * sectorSize;
+        count -= chunk;
+    }
+    return true;
+}
+
+static void RequestDone(void* ctx, bool ok) {
+    BlockRequest* req = (BlockRequest*)ctx;
+    req->status = ok ? BLOCK_OK : BLOCK_ERROR;
+    if (req->done) {
+        req->done(req);
+    }
+}
+
+/*
+ * The whole request goes out as one command,
+ * so its segments have to fit in one command
+ * table, and done gets called from the IRQ
+ * handler (or whoever is polling).
+*/
+bool GenericAHCIController::Submit(uint8_t drive, BlockRequest* req) {
+    req->status = BLOCK_PENDING;
+    if (!TransferAsync(drive, req->lba, req->count, req->segs, req->segCount, req->write, RequestDone, req)) {
+        req->status = BLOCK_ERROR;
+        return false;
+    }
+    return true;
+}
+
+bool GenericAHCIController::Wait(uint8_t drive, BlockRequest* req) {
+    while (true) {
+        uint64_t flags = AHCILock();
+        if (req->status != BLOCK_PENDING) {
+            AHCIUnlock(flags);
+            return req->status == BLOCK_OK;
+        }
+        WaitStep(drive, flags);
     }
+}
 
-    if (port->is & HBA_PxIS_TFES) {
+/*
+ * One command for the whole list, so it has
+ * to fit in one command table.
+*/
+bool GenericAHCIController::TransferSG(uint8_t drive, uint64_t lba, uint32_t count, const DMASegment* segs, size_t segCount, bool write) {
+    AHCIWait wait = { false, false };
+    if (!TransferAsync(drive, lba, count, segs, segCount, write, WakeWaiter, &wait)) {
         return false;
     }
+    return WaitFor(drive, wait);
+}
 
+/*
+ * Every port's PxIS and the port's bit in the
+ * global IS are write 1 to clear, and the global
+ * one has to be cleared last.
+*/
+bool GenericAHCIController::HandleInterrupt() {
+    volatile HBA_MEM* vhba = hba;
+    uint32_t pending = vhba->is;
+    if (pending == 0) {
+        return false;
+    }
+
+    for (uint32_t portNo = 0; portNo < 32; portNo++) {
+        if (pending & (1U << portNo)) {
+            AckPort(portNo);
+            Reap(portNo);
+        }
+    }
+
+    vhba->is = pending;
+    irqWorking = true;
+    return true;
+}
+
+static bool AHCIInterrupt(uint8_t, void* ctx) {
+    return ((GenericAHCIController*)ctx)->HandleInterrupt();
+}
+
+/*
+ * We use MSI-X if the controller has it and
+ * MSI otherwise. INTx would need the PCI IRQ
+ * routing from ACPI (_PRT), which we don't
+ * parse, so without MSI we just keep polling.
+*/
+void GenericAHCIController::SetupInterrupts() {
+    vector = _ds->AllocateVector();
+    if (vector == 0) {
+        _ds->klog(LOG_WARN, "AHCI: no free vector, polling");
+        return;
+    }
+
+    if (!_ds->RequestIRQ(vector, AHCIInterrupt, this)) {
+        _ds->FreeVector(vector);
+        vector = 0;
+        return;
+    }
+
+    bool enabled = false;
+    if (devKey.PCIe && devKey.hasMSIx) {
+        enabled = _ds->EnableMSIx(devKey.segment, devKey.bus, devKey.device, devKey.function, vector);
+    }
+    if (!enabled) {
+        enabled = _ds->EnableMSI(devKey.bus, devKey.device, devKey.function, vector);
+    }
+
+    if (!enabled) {
+        _ds->klog(LOG_WARN, "AHCI: no MSI, polling");
+        _ds->FreeIRQ(vector, AHCIInterrupt, this);
+        _ds->FreeVector(vector);
+        vector = 0;
+        return;
+    }
+
+    _ds->klog(LOG_INFO, "AHCI: using vector 0x%X", vector);
+}
+
+/*
+ * One physically contiguous block per port:
+ * the first page has the command list (1KB,
+ * which has to be 1KB aligned) and then the
+ * received FIS area (256 bytes), and every
+ * slot gets the page after that as its
+ * command table.
+ *
+ * Without S64A the HBA can only reach the
+ * first 4GB, so memory above that is no use.
+*/
+bool GenericAHCIController::AllocPortMemory(uint32_t portNo, uint32_t slots) {
+    AHCIPortState& ps = portState[portNo];
+    uint64_t pages = 1 + slots;
+
+    uint64_t phys = (uint64_t)_ds->RequestPages(pages);
+    if (!phys) {
+        return false;
+    }
+
+    if (!dma64 && phys + pages * 0x1000 > 0x100000000ULL) {
+        _ds->FreePages((void*)phys, pages);
+        return false;
+    }
+
+    for (uint64_t i = 0; i < pages; i++) {
+        _ds->MapMemory((void*)DMAVirt(phys + i * 0x1000), (void*)(phys + i * 0x1000), false);
+    }
+
+    uint64_t virt = DMAVirt(phys);
+    memset((void*)virt, 0, pages * 0x1000);
+
+    ps.memPhys = phys;
+    ps.memPages = pages;
+    ps.cmdList = (HBA_CMD*)virt;
+    ps.tables = (HBA_CMD_TBL*)(virt + 0x1000);
     return true;
 }
 
@@ -387,11 +851,13 @@ bool GenericAHCIController::cd_send_cmd(HBA_PORT* port, FIS_H2D* fis, void* buff
 void GenericAHCIController::Init(DriverServices& ds, DeviceKey& dKey) {
     _ds = &ds;
     devKey = dKey;
+    memset(portState, 0, sizeof(portState));
+    memset(portInfo, 0, sizeof(portInfo));
 
     void* mem = _ds->malloc(sizeof(GenericAHCIFactory));
     if (!mem) {
         _ds->Println("Failed to Malloc for Generic AHCI Factory");
-        _ds->Println(to_hstridng((uint64_t)mem));
+        _ds->kprintf("%p\n", mem);
     }
 
     /*
@@ -429,8 +895,7 @@ void GenericAHCIController::Init(DriverServices& ds, DeviceKey& dKey) {
     uint64_t bar5 = 0xFFFFFFFF00000000 + bar5phys;
     hba = (HBA_MEM*)bar5;
     _ds->MapMemory((void*)bar5, (void*)bar5phys, false);
-    _ds->Print("Bar 5: ");
-    _ds->Println(to_hstridng(bar5));
+    _ds->kprintf("Bar 5: 0x%lX\n", bar5);
     
     uint32_t cap = hba->cap;
     uint32_t ports = hba->pi;
@@ -441,7 +906,7 @@ void GenericAHCIController::Init(DriverServices& ds, DeviceKey& dKey) {
     if (version == 0x10000) {
         _ds->Println("1.0");
     } else {
-        _ds->Println(to_hstridng(version));
+        _ds->kprintf("0x%X\n", version);
     }
 
     /*
@@ -465,15 +930,17 @@ void GenericAHCIController::Init(DriverServices& ds, DeviceKey& dKey) {
     }
     
     /*
-     * Enable AHCI Mode and interrupts
+     * Enable AHCI Mode and interrupts. The
+     * handler has to be in place first.
     */
+    SetupInterrupts();
     *ghc |= (1 << 31);
     *ghc |= (1 << 1);
     
     /*
      * Check info in Capabilities ptr.
     */
-    bool supports64BitDMA = (cap & (1 << 31)) != 0;
+    dma64 = (cap & (1 << 31)) != 0;
 
     /*
      * I'd prefer to make my own code,
@@ -515,87 +982,35 @@ void GenericAHCIController::Init(DriverServices& ds, DeviceKey& dKey) {
         }
 
         /*
-         * We must allocate enough memory for the
-         * Command tables, FISes and Command List
-         * 
-         * The Command List must be *1KB* aligned
-         * The FIS (FB) must be *256Byte* aligned
-         * The Command Tables are aligned by 128B
-        */
-        uintptr_t clb_phys = (uint64_t)_ds->RequestPage();
-        uintptr_t page_end = clb_phys + 0x1000;
-
-        clb_phys = (clb_phys + 1023) & ~((uintptr_t)1023);
-
-        uintptr_t clb_virt = 0xFFFFFFFF00000000 + clb_phys;
-
-        _ds->MapMemory((void*)clb_virt, (void*)clb_phys, false);
-        memset((void*)clb_virt, 0, 1024);
-
-        p->clb = (uint32_t)clb_phys;
-        p->clbu = (uint32_t)(clb_phys >> 32);
-
-        /*
-         * Since we allocated a whole *4KB* page,
-         * we can just find the end of the clb to
-         * use for our FIS.
-        */
-        uintptr_t fb_phys = clb_phys + 1024;
-
-        fb_phys = (fb_phys + 255) & ~((uintptr_t)255);
-
-        uintptr_t fb_virt = 0xFFFFFFFF00000000 + fb_phys;
-
-        memset((void*)fb_virt, 0, 256);
-
-        p->fb = fb_phys;
-        p->fbu = (fb_phys >> 32);
-
-        /*
-         * Now we get to the tricky part, we must
-         * allocate enough memory for the Command
-         * Tables.
-         * 
-         * I wanted maximum memory efficiency, so
-         * I used the previous page from allocing
-         * a page for the clb. Then I added an if
-         * statement to check if there wasn't any
-         * space left and to request more pages.
-         * 
-         * Also, make sure you map these as unca-
-         * -cheable so that they won't be slow or
-         * inaccurate.
-         * 
-         * Each Command Table is 256 Bytes long &
-         * is aligned by 128 Bytes.
+         * Every port gets its own command list,
+         * FIS area and command tables (see
+         * AllocPortMemory), so more than one
+         * controller can run at once.
         */
-        HBA_CMD* cmdheader = (HBA_CMD*)p->clb;
-        uint64_t cmdPorts = ((cap >> 8) & 0x1F) + 1;
-
-        uint64_t currPhys = fb_phys + 256;
-
-        for (int i = 0; i < cmdPorts; i++) {
-            currPhys = (currPhys + 127) & ~((uintptr_t)127);
-            if ((currPhys + 256) > page_end) {
-                currPhys = (uint64_t)_ds->RequestPage();
-                page_end = currPhys + 0x1000;
-
-                uint64_t currVirt = 0xFFFFFFFF00000000 + currPhys;
-
-                _ds->MapMemory((void*)currVirt, (void*)currPhys, false);
-            }
-
-            uintptr_t currVirt = 0xFFFFFFFF00000000 + currPhys;
+        uint32_t cmdSlots = ((cap >> 8) & 0x1F) + 1;
+        if (!AllocPortMemory(port, cmdSlots)) {
+            _ds->klog(LOG_ERROR, "AHCI: no DMA memory for port %u", port);
+            continue;
+        }
 
-            memset((void*)currVirt, 0, 256);
+        AHCIPortState& ps = portState[port];
+        uint64_t clbPhys = ps.memPhys;
+        uint64_t fbPhys = clbPhys + 1024;
 
-            cmdheader[i].ctba = (uint32_t)currPhys;
-            cmdheader[i].ctbau = (uint32_t)(currPhys >> 32);
-            cmdheader[i].prdtl = 8;
+        p->clb = (uint32_t)clbPhys;
+        p->clbu = (uint32_t)(clbPhys >> 32);
+        p->fb = (uint32_t)fbPhys;
+        p->fbu = (uint32_t)(fbPhys >> 32);
 
-            currPhys = currPhys + 256;
+        for (uint32_t i = 0; i < cmdSlots; i++) {
+            uint64_t ctba = clbPhys + (uint64_t)(i + 1) * sizeof(HBA_CMD_TBL);
+            ps.cmdList[i].ctba = (uint32_t)ctba;
+            ps.cmdList[i].ctbau = (uint32_t)(ctba >> 32);
+            ps.cmdList[i].prdtl = 0;
         }
 
+        ps.freeSlots = cmdSlots == 32 ? 0xFFFFFFFF : (1U << cmdSlots) - 1;
+
         start_cmd(p);
 
         /*
@@ -612,7 +1027,8 @@ void GenericAHCIController::Init(DriverServices& ds, DeviceKey& dKey) {
         /*
          * Now we can enable Interrupts
         */
-        p->ie = (1 << 30);
+        p->is = (uint32_t)-1;
+        p->ie = HBA_PxIE_DEFAULT;
 
         /*
          * Pretty much the same as before
@@ -638,7 +1054,7 @@ void GenericAHCIController::Init(DriverServices& ds, DeviceKey& dKey) {
             fis.device = 0;
 
             uint64_t buf_phys = (uint64_t)_ds->RequestPage();
-            uint64_t buf_virt = 0xFFFFFFFF00000000 + buf_phys;
+            uint64_t buf_virt = DMAVirt(buf_phys);
 
             _ds->MapMemory((void*)buf_virt, (void*)buf_phys, false);
 
@@ -655,6 +1071,20 @@ void GenericAHCIController::Init(DriverServices& ds, DeviceKey& dKey) {
                 }
 
                 portInfo[port] = id;
+
+                /*
+                 * NCQ needs both the HBA (CAP.SNCQ)
+                 * and the drive (word 76 bit 8). The
+                 * drive's queue depth limits which
+                 * tags (slots) we can use.
+                */
+                bool driveNCQ = id->serial_ata_capabilities & (1 << 8);
+                if ((cap & (1 << 30)) && driveNCQ) {
+                    uint32_t depth = (id->queue_depth & 0x1F) + 1;
+                    portState[port].ncq = true;
+                    portState[port].freeSlots &= depth == 32 ? 0xFFFFFFFF : (1U << depth) - 1;
+                    _ds->klog(LOG_INFO, "AHCI: port %u uses NCQ, depth %u", port, depth);
+                }
                 
                 BaseDriver* device = factory->CreateDevice();
 
@@ -693,7 +1123,7 @@ void GenericAHCIController::Init(DriverServices& ds, DeviceKey& dKey) {
                 fis.device = 0;
 
                 uint64_t buf_phys = (uint64_t)_ds->RequestPage();
-                uint64_t buf_virt = 0xFFFFFFFF00000000 + buf_phys;
+                uint64_t buf_virt = DMAVirt(buf_phys);
 
                 _ds->MapMemory((void*)buf_virt, (void*)buf_phys, false);
 
@@ -736,41 +1166,15 @@ void GenericAHCIController::Init(DriverServices& ds, DeviceKey& dKey) {
  * Now we get to the fun stuff.
  * 
  * We can now read a sector by
- * issuing a ATA_CMD_READ_DMA_EX
- * command using a FIS.
- * 
- * Btw, most of the code in this
- * function is from the OSDev
- * Wiki.
+ * issuing a READ DMA EXT command
+ * (or READ FPDMA QUEUED if the
+ * drive does NCQ) using a FIS.
  * 
- * First we should clear any pending
- * interrupts.
- * 
- * Then we can use our ahci_send_cmd
- * helper to read the sector.
+ * Transfer builds the FIS and
+ * waits for it to finish.
 */
 bool GenericAHCIController::ReadSector(uint8_t drive, uint64_t lba, void* buffer) {
-    HBA_PORT* port = &hba->ports[drive];
-    port->is = (uint32_t)-1;
-
-    FIS_H2D fis{};
-    fis.fis_type = FIS_TYPE_REG_H2D;
-    fis.c = 1;
-    fis.command = ATA_CMD_READ_DMA_EXT;
-    fis.device = 1 << 6;
-
-    fis.lba0 = (uint8_t)(lba & 0xFF);
-    fis.lba1 = (uint8_t)((lba >> 8) & 0xFF);
-    fis.lba2 = (uint8_t)((lba >> 16) & 0xFF);
-    fis.lba3 = (uint8_t)((lba >> 24) & 0xFF);
-    fis.lba4 = (uint8_t)((lba >> 32) & 0xFF);
-    fis.lba5 = (uint8_t)((lba >> 40) & 0xFF);
-
-    fis.countl = 1;
-    fis.counth = 0;
-
-    bool success = ahci_send_cmd(port, &fis, buffer, 512, 1);
-    if (!success) {
+    if (!Transfer(drive, lba, 1, (uint64_t)buffer, false)) {
         _ds->Println("ReadSector: Failed");
         return false;
     }
@@ -781,33 +1185,36 @@ bool GenericAHCIController::ReadSector(uint8_t drive, uint64_t lba, void* buffer
 /*
  * The Write Sector function is
  * pretty much the same except
- * we need to issue an ATA CMD
- * WRITE DMA EXT command and we
- * need to set the write bit.
+ * we need to issue a WRITE
+ * command and we need to set
+ * the write bit.
 */
 bool GenericAHCIController::WriteSector(uint8_t drive, uint64_t lba, void* buffer) {
-    HBA_PORT* port = &hba->ports[drive];
-    port->is = (uint32_t)-1;
+    if (!Transfer(drive, lba, 1, (uint64_t)buffer, true)) {
+        _ds->Println("WriteSector: Failed");
+        return false;
+    }
 
-    FIS_H2D fis{};
-    fis.fis_type = FIS_TYPE_REG_H2D;
-    fis.c = 1;
-    fis.command = ATA_CMD_WRITE_DMA_EXT;
-    fis.device = 1 << 6;
+    return true;
+}
 
-    fis.lba0 = (uint8_t)(lba & 0xFF);
-    fis.lba1 = (uint8_t)((lba >> 8) & 0xFF);
-    fis.lba2 = (uint8_t)((lba >> 16) & 0xFF);
-    fis.lba3 = (uint8_t)((lba >> 24) & 0xFF);
-    fis.lba4 = (uint8_t)((lba >> 32) & 0xFF);
-    fis.lba5 = (uint8_t)((lba >> 40) & 0xFF);
+/*
+ * Same as ReadSector and WriteSector, but for
+ * `count` sectors in a row. The buffer has to
+ * be physically contiguous.
+*/
+bool GenericAHCIController::ReadSectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer) {
+    if (!Transfer(drive, lba, count, (uint64_t)buffer, false)) {
+        _ds->Println("ReadSectors: Failed");
+        return false;
+    }
 
-    fis.countl = 1;
-    fis.counth = 0;
+    return true;
+}
 
-    bool success = ahci_send_cmd(port, &fis, buffer, 512, 1, true);
-    if (!success) {
-        _ds->Println("WriteSector: Failed");
+bool GenericAHCIController::WriteSectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer) {
+    if (!Transfer(drive, lba, count, (uint64_t)buffer, true)) {
+        _ds->Println("WriteSectors: Failed");
         return false;
     }
 
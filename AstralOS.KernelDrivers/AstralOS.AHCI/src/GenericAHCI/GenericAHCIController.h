@@ -19,7 +19,23 @@
 #define HBA_PORT_IPM_ACTIVE 1
 #define HBA_PORT_DET_PRESENT 3
 
-#define	AHCI_BASE 0x400000
+/*
+ * Every command table gets a whole page, so
+ * the 128 byte header leaves room for 248
+ * PRDT entries, which is enough for 1MB in
+ * separate 4KB pages. One entry can cover up
+ * to 4MB (the byte count is 22 bits), and the
+ * count has to be even.
+*/
+#define AHCI_PRDT_ENTRIES 248
+#define AHCI_PRDT_MAX_BYTES (4 * 1024 * 1024)
+#define AHCI_MAX_SECTORS 0xFFFF
+
+/*
+ * How long WaitStep sleeps in hlt at most
+ * before it polls the port anyway.
+*/
+#define AHCI_WAKEUP_MS 10
 
 #define HBA_PxCMD_ST 0x0001
 #define HBA_PxCMD_FRE 0x0010
@@ -54,6 +70,8 @@
 #define ATA_CMD_CACHE_FLUSH_EXT 0xEA
 #define ATA_CMD_PACKET 0xA0
 #define ATA_CMD_IDENTIFY_PACKET 0xA1
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
 #define ATA_CMD_IDENTIFY 0xEC
 
 #define ATAPI_CMD_READ 0xA8
@@ -74,6 +92,23 @@
 */
 #define HBA_PxIS_TFES (1 << 30)
 
+/*
+ * PxIE/PxIS bits from the AHCI 1.3 spec.
+ * We want to hear about every FIS that can
+ * finish a command, plus all the errors.
+*/
+#define HBA_PxIS_DHRS (1 << 0)
+#define HBA_PxIS_PSS  (1 << 1)
+#define HBA_PxIS_DSS  (1 << 2)
+#define HBA_PxIS_SDBS (1 << 3)
+#define HBA_PxIS_DPS  (1 << 5)
+#define HBA_PxIS_IFS  (1 << 27)
+#define HBA_PxIS_HBDS (1 << 28)
+#define HBA_PxIS_HBFS (1 << 29)
+
+#define HBA_PxIS_ERRORS (HBA_PxIS_TFES | HBA_PxIS_HBFS | HBA_PxIS_HBDS | HBA_PxIS_IFS)
+#define HBA_PxIE_DEFAULT (HBA_PxIS_DHRS | HBA_PxIS_PSS | HBA_PxIS_DSS | HBA_PxIS_SDBS | HBA_PxIS_DPS | HBA_PxIS_ERRORS)
+
 /*
  * Structs from the OSDev Wiki:
  * https://wiki.osdev.org/AHCI
@@ -311,9 +346,11 @@ struct HBA_CMD_TBL {
 	uint8_t cfis[64];
 	uint8_t acmd[16];
 	uint8_t rsv[48];
-	HBA_PRDT_ENTRY prdt_entry[1];
+	HBA_PRDT_ENTRY prdt_entry[AHCI_PRDT_ENTRIES];
 };
 
+static_assert(sizeof(HBA_CMD_TBL) == 4096, "a command table should fill a page");
+
 /*
  * From Tianocore EDKII
  * https://github.com/tianocore/edk2/blob/master/MdePkg/Include/IndustryStandard/Atapi.h#L78
@@ -429,11 +466,54 @@ public:
     virtual BlockController* CreateDevice() override;
 };
 
+typedef void (*AHCIDone)(void* ctx, bool ok);
+
+/*
+ * Who to tell when a slot finishes.
+*/
+struct AHCISlot {
+    AHCIDone done;
+    void* ctx;
+};
+
+/*
+ * cmdList and tables point at the port's DMA
+ * memory (see AllocPortMemory), tables[slot]
+ * being the slot's command table.
+ *
+ * issued is every slot the HBA has, queued is
+ * the ones that are NCQ (and so in PxSACT).
+ * errors gets set by the IRQ handler, since it
+ * clears PxIS before anyone else looks at it.
+*/
+struct AHCIPortState {
+    HBA_CMD* cmdList;
+    HBA_CMD_TBL* tables;
+    uint64_t memPhys;
+    uint64_t memPages;
+
+    volatile uint32_t freeSlots;
+    volatile uint32_t issued;
+    volatile uint32_t queued;
+    volatile uint32_t errors;
+    bool ncq;
+    AHCISlot slots[32];
+};
+
+struct AHCIWait {
+    volatile bool done;
+    volatile bool ok;
+};
+
 class GenericAHCIController : public BlockController {
 public:
     virtual void Init(DriverServices& ds, DeviceKey& devKey) override;
     virtual bool ReadSector(uint8_t drive, uint64_t lba, void* buffer) override;
     virtual bool WriteSector(uint8_t drive, uint64_t lba, void* buffer) override;
+    virtual bool ReadSectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer) override;
+    virtual bool WriteSectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer) override;
+    virtual bool Submit(uint8_t drive, BlockRequest* req) override;
+    virtual bool Wait(uint8_t drive, BlockRequest* req) override;
 
     virtual uint64_t SectorCount(uint8_t drive) const override;
     virtual uint32_t SectorSize(uint8_t drive) const override;
@@ -444,22 +524,61 @@ public:
     virtual uint8_t GetSubClass() override;
     virtual uint8_t GetProgIF() override;
     virtual const char* DriverName() const override;
+
+    bool TransferSG(uint8_t drive, uint64_t lba, uint32_t count, const DMASegment* segs, size_t segCount, bool write);
+
+    bool HandleInterrupt();
 private:
     void probe_port(HBA_MEM *abar);
     int check_type(HBA_PORT *port);
-    void port_rebase(HBA_PORT *port, int portno);
     void start_cmd(HBA_PORT *port);
     void stop_cmd(HBA_PORT *port);
 
 	/*
 	 * Not OSDev Wiki code
 	*/
-	bool ahci_send_cmd(HBA_PORT* port, FIS_H2D* fis, void* buffer, uint32_t buf_size, uint16_t prdtl = 1, bool write = false);
+	bool ahci_send_cmd(HBA_PORT* port, FIS_H2D* fis, void* buffer, uint32_t buf_size, bool write = false);
 	bool cd_send_cmd(HBA_PORT* port, FIS_H2D* fis, void* buffer, uint32_t buf_size, uint8_t* atapi_packet, size_t packet_len);
 
+	bool Transfer(uint8_t drive, uint64_t lba, uint32_t count, uint64_t buffer, bool write);
+	bool TransferAsync(uint8_t drive, uint64_t lba, uint32_t count, const DMASegment* segs, size_t segCount, bool write, AHCIDone done, void* ctx);
+	uint32_t MaxSectors(uint8_t drive) const;
+
+	void SetupInterrupts();
+	bool AllocPortMemory(uint32_t portNo, uint32_t slots);
+	int32_t CountPRDT(const DMASegment* segs, size_t segCount);
+	void BuildCommand(HBA_PORT* port, uint32_t slot, FIS_H2D* fis, const DMASegment* segs, size_t segCount, bool write, uint8_t* packet, size_t packetLen);
+	bool Issue(uint32_t portNo, FIS_H2D* fis, const DMASegment* segs, size_t segCount, bool write, bool queued, AHCIDone done, void* ctx, uint8_t* packet = nullptr, size_t packetLen = 0);
+	int32_t ClaimSlot(uint32_t portNo);
+	void ReleaseSlot(uint32_t portNo, uint32_t slot);
+	void AckPort(uint32_t portNo);
+	void Reap(uint32_t portNo);
+	void Complete(uint32_t portNo, uint32_t slots, bool ok);
+	void RestartPort(uint32_t portNo);
+	void Poll(uint32_t portNo);
+	void WaitStep(uint32_t portNo, uint64_t flags);
+	bool WaitFor(uint32_t portNo, AHCIWait& wait);
+	void WaitIdle(uint32_t portNo);
+
     DriverServices* _ds = nullptr;
     DeviceKey devKey;
 	ATA_IDENTIFY_DATA* portInfo[32];
 	HBA_MEM* hba = nullptr;
 	bool driveSet = false;
+
+	/*
+	 * irqWorking stays false until we've
+	 * actually seen an interrupt, and until
+	 * then we poll.
+	*/
+	uint8_t vector = 0;
+	AHCIPortState portState[32];
+	volatile bool irqWorking = false;
+	static constexpr uint32_t SlotSpins = 1000;
+
+	/*
+	 * CAP.S64A, without it everything the HBA
+	 * reads or writes has to be under 4GB.
+	*/
+	bool dma64 = false;
 };
\ No newline at end of file
@@ -1,12 +1,18 @@
 #pragma once
 #include <cstdint>
 #include <cstddef>
+#include <stdarg.h>
 #ifdef DRIVER
 #include "PCI.h"
 #include "File.h"
+#include "Log.h"
+
+typedef bool (*IRQHandler)(uint8_t vector, void* ctx);
 #else 
 #include "../PCI/PCI.h"
 #include "../File/File.h"
+#include "../Log/Log.h"
+#include "../IRQ/IRQ.h"
 #endif
 
 struct DriverServices;
@@ -32,6 +38,60 @@ enum MountFSID {
     EXT4MountID = 0xE474
 };
 
+/*
+ * One physically contiguous piece of a
+ * DMA buffer. A list of these lets one
+ * command read into (or write from)
+ * memory that isn't contiguous.
+*/
+struct DMASegment {
+    uint64_t phys;
+    uint32_t size;
+};
+
+enum BlockStatus {
+    BLOCK_PENDING = 0,
+    BLOCK_OK = 1,
+    BLOCK_ERROR = 2
+};
+
+struct BlockRequest;
+typedef void (*BlockDone)(BlockRequest* req);
+
+/*
+ * A read or write of `count` sectors starting
+ * at `lba`, into (or out of) the segments,
+ * which have to add up to exactly `count`
+ * sectors. Every layer takes these through
+ * Submit, which returns right away.
+ *
+ * If Submit returns true, done(req) gets called
+ * once when it's finished (maybe from an IRQ
+ * handler, maybe before Submit even returns),
+ * with status set to BLOCK_OK or BLOCK_ERROR.
+ * If it returns false, done never gets called.
+ *
+ * Nothing gets copied on the way down, so the
+ * request and the segments have to stay around
+ * until it's done. The partition layer adds the
+ * partition's start to lba as it goes through,
+ * so don't count on lba afterwards.
+ *
+ * Wait blocks until the request is finished,
+ * and is the only safe way to do that, since
+ * some controllers have to be polled.
+*/
+struct BlockRequest {
+    uint64_t lba;
+    uint32_t count;
+    DMASegment* segs;
+    size_t segCount;
+    bool write;
+    BlockDone done;
+    void* ctx;
+    volatile BlockStatus status;
+};
+
 class BaseDriver {
 public:
     virtual ~BaseDriver() {}
@@ -52,11 +112,22 @@ public:
     virtual LayerType GetLayerType() { return PCIE; }
 };
 
+/*
+ * ReadSectors and WriteSectors move `count`
+ * sectors in a row, in as few commands as
+ * the controller can. Like ReadSector, the
+ * buffer is a physical address, and it has
+ * to be contiguous.
+*/
 class BlockController : public BaseDriver {
 public:
     virtual void Init(DriverServices& ds, DeviceKey& devKey) override = 0;
     virtual bool ReadSector(uint8_t drive, uint64_t lba, void* buffer) = 0;
     virtual bool WriteSector(uint8_t drive, uint64_t lba, void* buffer) = 0;
+    virtual bool ReadSectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer) = 0;
+    virtual bool WriteSectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer) = 0;
+    virtual bool Submit(uint8_t drive, BlockRequest* req) = 0;
+    virtual bool Wait(uint8_t drive, BlockRequest* req) = 0;
 
     virtual uint64_t SectorCount(uint8_t drive) const = 0;
     virtual uint32_t SectorSize(uint8_t drive) const = 0;
@@ -85,6 +156,10 @@ public:
     virtual void Init(DriverServices& ds, DeviceKey& devKey) override = 0;
     virtual bool ReadSector(uint64_t lba, void* buffer) = 0;
     virtual bool WriteSector(uint64_t lba, void* buffer) = 0;
+    virtual bool ReadSectors(uint64_t lba, uint32_t count, void* buffer) = 0;
+    virtual bool WriteSectors(uint64_t lba, uint32_t count, void* buffer) = 0;
+    virtual bool Submit(BlockRequest* req) = 0;
+    virtual bool Wait(BlockRequest* req) = 0;
 
     virtual uint64_t SectorCount() const = 0;
     virtual uint32_t SectorSize() const = 0;
@@ -115,6 +190,10 @@ public:
     virtual void Init(DriverServices& ds, DeviceKey& devKey) override = 0;
     virtual bool ReadSector(uint64_t lba, void* buffer) = 0;
     virtual bool WriteSector(uint64_t lba, void* buffer) = 0;
+    virtual bool ReadSectors(uint64_t lba, uint32_t count, void* buffer) = 0;
+    virtual bool WriteSectors(uint64_t lba, uint32_t count, void* buffer) = 0;
+    virtual bool Submit(BlockRequest* req) = 0;
+    virtual bool Wait(BlockRequest* req) = 0;
 
     virtual uint64_t SectorCount() const = 0;
     virtual uint32_t SectorSize() const = 0;
@@ -148,6 +227,10 @@ public:
     virtual void Init(DriverServices& ds, DeviceKey& devKey) override = 0;
     virtual bool ReadSector(uint8_t partition, uint64_t lba, void* buffer) = 0;
     virtual bool WriteSector(uint8_t partition, uint64_t lba, void* buffer) = 0;
+    virtual bool ReadSectors(uint8_t partition, uint64_t lba, uint32_t count, void* buffer) = 0;
+    virtual bool WriteSectors(uint8_t partition, uint64_t lba, uint32_t count, void* buffer) = 0;
+    virtual bool Submit(uint8_t partition, BlockRequest* req) = 0;
+    virtual bool Wait(uint8_t partition, BlockRequest* req) = 0;
 
     virtual uint64_t SectorCount(uint8_t partition) const = 0;
     virtual uint32_t SectorSize(uint8_t partition) const = 0;
@@ -215,6 +298,33 @@ public:
     virtual LayerType GetLayerType() override { return SOFTWARE; }
 };
 
+/*
+ * A block that lives in the kernel's buffer
+ * cache, see bread in DriverServices. `data`
+ * is the block's contents, and `phys` is the
+ * same memory as a physical address, in case
+ * you want to DMA into it yourself.
+ *
+ * Everything below `data` belongs to the
+ * cache, so don't touch it.
+*/
+struct BlockBuffer {
+    PartitionDevice* dev;
+    uint64_t block;
+    uint32_t size;
+    uint8_t* data;
+    uint64_t phys;
+
+    uint64_t pages;
+    uint32_t refs;
+    volatile bool valid;
+    bool dirty;
+    void* volatile io;
+    BlockBuffer* hashNext;
+    BlockBuffer* lruPrev;
+    BlockBuffer* lruNext;
+};
+
 struct DriverServices {
     /*
      * Debugging
@@ -222,10 +332,35 @@ struct DriverServices {
     void (*Print)(const char* str);
     void (*Println)(const char* str);
 
+    /*
+     * The kernel's kprintf and ksnprintf, see
+     * Utils/kprintf/kprintf.h. They don't use
+     * the heap, so use these instead of building
+     * strings with to_hstring and friends.
+    */
+    int (*kprintf)(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+    int (*ksnprintf)(char* buf, size_t size, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+    int (*kvsnprintf)(char* buf, size_t size, const char* fmt, va_list args);
+
+    /*
+     * Adds a line to the kernel log. This is
+     * much cheaper than Println, so use it for
+     * anything that isn't an error you need to
+     * see right away.
+    */
+    void (*klog)(LogLevel level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
     /*
      * Memory
     */
     void* (*RequestPage)();
+
+    /*
+     * pageCount physically contiguous pages,
+     * for DMA memory. Free them with FreePages.
+    */
+    void* (*RequestPages)(uint64_t pageCount);
+
     void (*LockPage)(void* address);
     void (*LockPages)(void* address, uint64_t pageCount);
     void (*FreePage)(void* address);
@@ -235,12 +370,34 @@ struct DriverServices {
     void* (*malloc)(size_t size);
     void (*free)(void* ptr);
     char* (*strdup)(const char* str);
+    void* (*memcpy)(void* dest, const void* src, size_t n);
+    void* (*memmove)(void* dest, const void* src, size_t n);
+    void* (*memset)(void* dest, uint8_t value, size_t n);
+    int (*memcmp)(const void* s1, const void* s2, size_t n);
+    size_t (*strlen)(const char* str);
+    int (*strcmp)(const char* s1, const char* s2);
+    int (*strncmp)(const char* s1, const char* s2, size_t n);
+    char* (*strchr)(const char* str, int ch);
 
     /*
      * IRQs
     */
     void (*SetDescriptor)(uint8_t vector, void* isr, uint8_t flags);
 
+    /*
+     * The kernel sends the EOI after your
+     * handler returns, so don't do it yourself.
+     * Get a vector from AllocateVector (or use
+     * 0x20 + irq for an IOAPIC pin with RouteIRQ),
+     * then hang your handler on it. Handlers on
+     * the same vector all get called.
+    */
+    bool (*RequestIRQ)(uint8_t vector, IRQHandler handler, void* ctx);
+    bool (*FreeIRQ)(uint8_t vector, IRQHandler handler, void* ctx);
+    uint8_t (*AllocateVector)();
+    void (*FreeVector)(uint8_t vector);
+    bool (*RouteIRQ)(uint8_t irq, uint8_t vector);
+
     /*
      * PCI/e
     */
@@ -248,6 +405,18 @@ struct DriverServices {
     bool (*PCIeExists)();
     bool (*EnableMSI)(uint8_t bus, uint8_t device, uint8_t function, uint8_t vector);
     bool (*EnableMSIx)(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint8_t vector);
+
+    /*
+     * MSI-X with more than one vector. Entries
+     * start out masked and pointed at this CPU,
+     * so RequestIRQ on each vector first, then
+     * unmask them with MaskMSIx(..., false).
+    */
+    uint16_t (*AllocateMSIx)(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t count, uint8_t* vectors);
+    void (*FreeMSIx)(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function);
+    bool (*SetMSIxAffinity)(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t entry, uint8_t apicID);
+    bool (*MaskMSIx)(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t entry, bool mask);
+
     uint16_t (*ConfigReadWord)(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
     void (*ConfigWriteWord)(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint16_t value);
     void (*ConfigWriteDWord)(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value);
@@ -269,6 +438,46 @@ struct DriverServices {
      * Timer Stuff
     */
     void (*sleep)(uint64_t ms);
+
+    /*
+     * Makes sure the CPU comes out of hlt
+     * within `ms`, even if nothing else
+     * interrupts it.
+    */
+    void (*ArmWakeup)(uint64_t ms);
+
+    /*
+     * The buffer cache. bread gives you block
+     * `block` (in `size` byte blocks) of dev,
+     * and only goes to the disk if it isn't
+     * cached already. bget is the same, but it
+     * doesn't read anything, for blocks you
+     * are about to overwrite completely.
+     *
+     * Both hold a reference on the buffer until
+     * you brelse it, so it can't get evicted
+     * from under you. Use the same size for a
+     * device every time.
+     *
+     * bwrite only marks the buffer dirty, it
+     * gets written back when it gets evicted or
+     * when someone calls bsync (nullptr syncs
+     * every device).
+     *
+     * breada starts reading `count` blocks from
+     * `block` into the cache and returns without
+     * waiting, so a bread later on is (hopefully)
+     * a hit. Blocks that are cached already get
+     * skipped. It's only a hint, so it may read
+     * less than you asked for if the cache is
+     * busy.
+    */
+    BlockBuffer* (*bread)(PartitionDevice* dev, uint64_t block, uint32_t size);
+    BlockBuffer* (*bget)(PartitionDevice* dev, uint64_t block, uint32_t size);
+    void (*bwrite)(BlockBuffer* buf);
+    void (*brelse)(BlockBuffer* buf);
+    bool (*bsync)(PartitionDevice* dev);
+    bool (*breada)(PartitionDevice* dev, uint64_t block, uint32_t count, uint32_t size);
 };
 
 struct DriverInfo {
@@ -31,6 +31,13 @@ struct File {
     uint32_t flags;
     uint64_t path;
     uint64_t data;
+
+    /*
+     * Belongs to the filesystem driver that
+     * opened the file (EXT4 keeps its readahead
+     * state here). Null if it didn't set one.
+    */
+    void* fsData;
 };
 
 enum FileFlags {
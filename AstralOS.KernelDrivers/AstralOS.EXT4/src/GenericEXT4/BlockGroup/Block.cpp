@@ -11,27 +11,24 @@
 */
 uint8_t* GenericEXT4Device::ReadBitmapBlock(BlockGroupDescriptor* GroupDesc) {
     uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t sectorsPerBlock = blockSize / pdev->SectorSize();
 
-    void* bufPhys = _ds->RequestPage();
-    uint64_t bufVirt = (uint64_t)bufPhys + 0xFFFFFFFF00000000;
-    _ds->MapMemory((void*)bufVirt, bufPhys, false);
-    memset((void*)bufVirt, 0, 4096);
+    uint8_t* Bitmap = (uint8_t*)_ds->malloc(blockSize);
+    if (!Bitmap) {
+        return nullptr;
+    }
 
     uint64_t BitmapBlock = ((uint64_t)GroupDesc->bg_block_bitmap_hi << 32) | GroupDesc->bg_block_bitmap_lo;
-    uint64_t BitmapLBA = BitmapBlock * sectorsPerBlock;
-
-    uint64_t inodeBitmapBlock = ((uint64_t)GroupDesc->bg_inode_bitmap_hi << 32) | GroupDesc->bg_inode_bitmap_lo;
 
-    for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-        if (!pdev->ReadSector(BitmapLBA + i, (uint8_t*)bufPhys + i * pdev->SectorSize())) {
-            _ds->Println("Failed to read block bitmap");
-            return nullptr;
-        }
+    /*
+     * Like ReadBitmapInode, this is your own
+     * copy, so free it when you are done.
+    */
+    if (!ReadBlock(BitmapBlock, Bitmap)) {
+        _ds->Println("Failed to read block bitmap");
+        _ds->free(Bitmap);
+        return nullptr;
     }
 
-    uint8_t* Bitmap = (uint8_t*)bufVirt;
-
     return Bitmap;
 }
 
@@ -41,37 +38,12 @@ uint8_t* GenericEXT4Device::ReadBitmapBlock(BlockGroupDescriptor* GroupDesc) {
  * the bitmap to the buffer and writing to it.
 */
 void GenericEXT4Device::WriteBitmapBlock(BlockGroupDescriptor* GroupDesc, uint8_t* bitmap) {
-    uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t sectorsPerBlock = blockSize / pdev->SectorSize();
-
-    void* bufPhys = _ds->RequestPage();
-    uint64_t bufVirt = (uint64_t)bufPhys + 0xFFFFFFFF00000000;
-    _ds->MapMemory((void*)bufVirt, bufPhys, false);
-    memset((void*)bufVirt, 0, 4096);
-
     uint64_t BitmapBlock = ((uint64_t)GroupDesc->bg_block_bitmap_hi << 32) | GroupDesc->bg_block_bitmap_lo;
-    uint64_t BitmapLBA = BitmapBlock * sectorsPerBlock;
-
-    uint64_t inodeBitmapBlock = ((uint64_t)GroupDesc->bg_inode_bitmap_hi << 32) | GroupDesc->bg_inode_bitmap_lo;
 
-    for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-        if (!pdev->ReadSector(BitmapLBA + i, (uint8_t*)bufVirt + i * pdev->SectorSize())) {
-            _ds->Println("Failed to read block bitmap");
-            return;
-        }
+    if (!WriteBlock(BitmapBlock, bitmap)) {
+        _ds->Println("Failed to write block bitmap");
+        return;
     }
-
-    memcpy((void*)bufVirt, bitmap, blockSize);
-
-    for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-        if (!pdev->WriteSector(BitmapLBA + i, (uint8_t*)bufPhys + i * pdev->SectorSize())) {
-            _ds->Println("Failed to write block bitmap");
-            return;
-        }
-    }
-
-    _ds->UnMapMemory((void*)bufVirt);
-    _ds->FreePage(bufPhys);
 }
 
 /*
@@ -87,6 +59,7 @@ void GenericEXT4Device::UpdateBlockBitmapChksum(uint32_t group, BlockGroupDescri
 
         uint32_t crc = crc32c_sw(~0, superblock->s_uuid, 16);
         crc = crc32c_sw(crc, bitmap, blockSize);
+        _ds->free(bitmap);
 
         GroupDesc->bg_block_bitmap_csum_lo = crc & 0xFFFF;
         if (superblock->s_feature_incompat & IncompatFeatures::INCOMPAT_64BIT) {
@@ -191,11 +164,14 @@ uint32_t GenericEXT4Device::AllocateBlock(FsNode* parent) {
             GroupDesc->bg_free_blocks_count_lo = count & 0xFFFF;
             GroupDesc->bg_free_blocks_count_hi = count >> 16;
 
+            _ds->free(Bitmap);
+
             UpdateSuperblock();
             UpdateGroupDesc(BlockGroup, GroupDesc);
 
             return GlobalBlock;
         }
+        _ds->free(Bitmap);
     }
     return 0;
 }
@@ -327,6 +303,7 @@ uint32_t GenericEXT4Device::AllocateBlocks(FsNode* parent, uint64_t& count) {
             }
 
             WriteBitmapBlock(GroupDesc, Bitmap);
+            _ds->free(Bitmap);
 
             superblock->s_free_blocks_count_hi = UnallocBlocks >> 16;
             superblock->s_free_blocks_count_lo = UnallocBlocks & 0xFFFF;
@@ -338,6 +315,7 @@ uint32_t GenericEXT4Device::AllocateBlocks(FsNode* parent, uint64_t& count) {
 
             return (uint64_t)BlockGroup * BlocksPerGroup + best_start;
         }
+        _ds->free(Bitmap);
     }
     return 0;
 }
\ No newline at end of file
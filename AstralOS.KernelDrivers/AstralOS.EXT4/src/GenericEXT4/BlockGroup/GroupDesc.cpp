@@ -14,32 +14,28 @@
 */
 BlockGroupDescriptor* GenericEXT4Device::ReadGroupDesc(uint32_t group) {
     uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t sectorsPerBlock = blockSize / pdev->SectorSize();
 
     uint64_t FirstGDTBlock = (blockSize == 1024) ? 2 : 1;
-    uint64_t FirstGDTLBA = FirstGDTBlock * sectorsPerBlock;
 
     uint64_t descSize = superblock->s_desc_size ? superblock->s_desc_size : 64;
     uint64_t descByteOffset = group * descSize;
-    uint64_t sectorSize = pdev->SectorSize();
-    uint64_t descLBA = FirstGDTLBA + (descByteOffset / sectorSize);
-    uint64_t descOff = descByteOffset % sectorSize;
 
-    uint64_t bytesNeeded = descOff + descSize;
-    uint64_t sectorsNeeded = (bytesNeeded + sectorSize - 1) / sectorSize;
-
-    void* bufPhys = _ds->RequestPage();
-    uint64_t bufVirt = (uint64_t)bufPhys + 0xFFFFFFFF00000000;
-
-    _ds->MapMemory((void*)bufVirt, bufPhys, false);
-    memset((void*)bufVirt, 0, 4096);
+    uint64_t copySize = descSize > sizeof(BlockGroupDescriptor) ? descSize : sizeof(BlockGroupDescriptor);
+    BlockGroupDescriptor* desc = (BlockGroupDescriptor*)_ds->malloc(copySize);
+    if (!desc) {
+        return nullptr;
+    }
+    memset(desc, 0, copySize);
 
-    for (uint64_t i = 0; i < sectorsNeeded; i++) {
-        if (!pdev->ReadSector(descLBA + i, (void*)((uint8_t*)bufPhys + i * sectorSize))) {
-            _ds->Print("GDT read failed");
-        }
+    BlockBuffer* bb = _ds->bread(pdev, FirstGDTBlock + descByteOffset / blockSize, blockSize);
+    if (!bb) {
+        _ds->Print("GDT read failed");
+        return desc;
     }
-    return (BlockGroupDescriptor*)((uint8_t*)bufVirt + descOff);
+
+    memcpy(desc, bb->data + descByteOffset % blockSize, descSize);
+    _ds->brelse(bb);
+    return desc;
 }
 
 /*
@@ -67,40 +63,22 @@ void GenericEXT4Device::UpdateGroupDesc(uint32_t group, BlockGroupDescriptor* Gr
         GroupDesc->bg_checksum = crc & 0xFFFF;
     }
     uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t sectorSize = pdev->SectorSize();
-    uint64_t sectorsPerBlock = blockSize / sectorSize;
 
     uint64_t firstGDTBlock = (blockSize == 1024) ? 2 : 1;
-    uint64_t firstGDTLBA = firstGDTBlock * sectorsPerBlock;
 
     uint64_t descSize = superblock->s_desc_size ? superblock->s_desc_size : 64;
 
     uint64_t descByteOffset = (uint64_t)group * descSize;
-    uint64_t descLBA = firstGDTLBA + (descByteOffset / sectorSize);
-    uint64_t descOff = descByteOffset % sectorSize;
-
-    uint64_t bytes = descOff + descSize;
-    uint64_t sectors = (bytes + sectorSize - 1) / sectorSize;
-
-    void* bufPhys = _ds->RequestPage();
-    uint64_t bufVirt = (uint64_t)bufPhys + 0xFFFFFFFF00000000;
-    _ds->MapMemory((void*)bufVirt, bufPhys, false);
-    memset((void*)bufVirt, 0, 4096);
-
-    for (uint64_t i = 0; i < sectors; i++) {
-        if (!pdev->ReadSector(descLBA + i, (uint8_t*)bufPhys + i * sectorSize)) {
-            _ds->Println("GDT read failed");
-            return;
-        }
+    uint64_t descBlock = firstGDTBlock + descByteOffset / blockSize;
+
+    BlockBuffer* bb = _ds->bread(pdev, descBlock, blockSize);
+    if (!bb) {
+        _ds->kprintf("GDT write failed: 0x%lX\n", descBlock);
+        return;
     }
 
-    memcpy((uint8_t*)bufVirt + descOff, GroupDesc, descSize);
+    memcpy(bb->data + descByteOffset % blockSize, GroupDesc, descSize);
 
-    for (uint64_t i = 0; i < sectors; i++) {
-        if (!pdev->WriteSector(descLBA + i, (uint8_t*)bufPhys + i * sectorSize)) {
-            _ds->Print("GDT write failed: ");
-            _ds->Println(to_hstridng(descLBA + i));
-            return;
-        }
-    }
+    _ds->bwrite(bb);
+    _ds->brelse(bb);
 }
\ No newline at end of file
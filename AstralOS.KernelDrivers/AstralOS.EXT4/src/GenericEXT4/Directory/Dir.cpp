@@ -2,23 +2,17 @@
 
 void GenericEXT4Device::ParseDirectoryBlock(FsNode**& nodes, uint64_t& count, size_t& capacity, uint64_t block) {
     uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t sectorSize = pdev->SectorSize();
-    uint64_t sectorsPerBlock = blockSize / pdev->SectorSize();
 
-    void* buf = _ds->RequestPage();
-    uint64_t bufPhys = (uint64_t)buf;
-    uint64_t bufVirt = bufPhys + 0xFFFFFFFF00000000;
-    _ds->MapMemory((void*)bufVirt, (void*)bufPhys, false);
-    memset((void*)bufVirt, 0, 4096);
-
-    uint64_t LBA = block * sectorsPerBlock;
-
-    for (uint64_t s = 0; s < sectorsPerBlock; s++) {
-        if (!pdev->ReadSector(LBA + s, (void*)((uint64_t)bufPhys + s * pdev->SectorSize()))) {
-            _ds->Println("Failed to read sector");
-            return;
-        }
+    /*
+     * We parse the block right in the buffer
+     * cache, and hold on to it until we're done.
+    */
+    BlockBuffer* bb = _ds->bread(pdev, block, blockSize);
+    if (!bb) {
+        _ds->Println("Failed to read sector");
+        return;
     }
+    uint64_t bufVirt = (uint64_t)bb->data;
 
     uint64_t offset = 0;
     while (offset < blockSize) {
@@ -92,4 +86,6 @@ void GenericEXT4Device::ParseDirectoryBlock(FsNode**& nodes, uint64_t& count, si
 
         offset += ent->rec_len;
     }
+
+    _ds->brelse(bb);
 }
\ No newline at end of file
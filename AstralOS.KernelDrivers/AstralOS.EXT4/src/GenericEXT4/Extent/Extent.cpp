@@ -8,40 +8,26 @@ uint64_t GenericEXT4Device::CountExtents(ExtentHeader* hdr) {
             //Extent* ee = (Extent*)((uint64_t)hdr + sizeof(ExtentHeader) + i * sizeof(Extent));
         }
     } else {
-        void* buf = _ds->RequestPage();
-        uint64_t bufPhys = (uint64_t)buf;
-        uint64_t bufVirt = bufPhys + 0xFFFFFFFF00000000;
-        _ds->MapMemory((void*)bufVirt, (void*)bufPhys, false);
-
         uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-        uint64_t sectorSize = pdev->SectorSize();
-        uint64_t sectorsPerBlock = blockSize / pdev->SectorSize();
 
         for (int i = 0; i < hdr->eh_entries; i++) {
-            memset((void*)bufVirt, 0, 4096);
-
             ExtentIDX* ei = (ExtentIDX*)((uint64_t)hdr + sizeof(ExtentHeader) + i * sizeof(ExtentIDX));
 
             uint64_t block = ((uint64_t)ei->ei_leaf_hi << 32) | (uint64_t)ei->ei_leaf_lo;
 
-            uint64_t LBA = block * sectorsPerBlock;
-                    
-            for (uint64_t x = 0; x < sectorsPerBlock; x++) {
-                if (!pdev->ReadSector(LBA + x, (void*)((uint8_t*)bufPhys + x * pdev->SectorSize()))) {
-                    _ds->Println("Failed to read directory block");
-                    return 0;
-                }
+            BlockBuffer* bb = _ds->bread(pdev, block, blockSize);
+            if (!bb) {
+                _ds->Println("Failed to read directory block");
+                return 0;
             }
 
-            ExtentHeader* eh = (ExtentHeader*)bufVirt;
+            ExtentHeader* eh = (ExtentHeader*)bb->data;
 
-            if (eh->eh_magic != 0xF30A) continue;
-            if (eh->eh_depth != (hdr->eh_depth - 1)) continue;
-
-            extentsCount += CountExtents(eh);
+            if (eh->eh_magic == 0xF30A && eh->eh_depth == (hdr->eh_depth - 1)) {
+                extentsCount += CountExtents(eh);
+            }
+            _ds->brelse(bb);
         }
-        _ds->UnMapMemory((void*)bufVirt);
-        _ds->FreePage(buf);
     }
 
     return extentsCount;
@@ -74,38 +60,29 @@ Extent** GenericEXT4Device::GetExtents(ExtentHeader* hdr, uint64_t& extentsCount
             extentsCount++;
         }
     } else {
-        void* buf = _ds->RequestPage();
-        uint64_t bufPhys = (uint64_t)buf;
-        uint64_t bufVirt = bufPhys + 0xFFFFFFFF00000000;
-        _ds->MapMemory((void*)bufVirt, (void*)bufPhys, false);
-
         uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-        uint64_t sectorSize = pdev->SectorSize();
-        uint64_t sectorsPerBlock = blockSize / sectorSize;
 
         for (int i = 0; i < hdr->eh_entries; i++) {
-            memset((void*)bufVirt, 0, 4096);
-
             ExtentIDX* ei = (ExtentIDX*)((uint64_t)hdr + sizeof(ExtentHeader) + i * sizeof(ExtentIDX));
 
             uint64_t block = ((uint64_t)ei->ei_leaf_hi << 32) | (uint64_t)ei->ei_leaf_lo;
 
-            uint64_t LBA = block * sectorsPerBlock;
-                    
-            for (uint64_t x = 0; x < sectorsPerBlock; x++) {
-                if (!pdev->ReadSector(LBA + x, (void*)((uint8_t*)bufPhys + x * pdev->SectorSize()))) {
-                    _ds->Println("Failed to read directory block");
-                    return 0;
-                }
+            BlockBuffer* bb = _ds->bread(pdev, block, blockSize);
+            if (!bb) {
+                _ds->Println("Failed to read directory block");
+                return 0;
             }
 
-            ExtentHeader* eh = (ExtentHeader*)bufVirt;
+            ExtentHeader* eh = (ExtentHeader*)bb->data;
 
-            if (eh->eh_magic != 0xF30A) continue;
-            if (eh->eh_depth != (hdr->eh_depth - 1)) continue;
+            if (eh->eh_magic != 0xF30A || eh->eh_depth != (hdr->eh_depth - 1)) {
+                _ds->brelse(bb);
+                continue;
+            }
 
             uint64_t extsCount = 0;
             Extent** exts = GetExtents(eh, extsCount);
+            _ds->brelse(bb);
 
             for (uint64_t x = 0; x < extsCount; x++) {
                 extents[extentsCount] = exts[x];
@@ -113,8 +90,6 @@ Extent** GenericEXT4Device::GetExtents(ExtentHeader* hdr, uint64_t& extentsCount
             }
             _ds->free(exts);
         }
-        _ds->UnMapMemory((void*)bufVirt);
-        _ds->FreePage(buf);
     }
     return extents;
 }
@@ -123,8 +98,6 @@ bool GenericEXT4Device::AddExtentDepth(ExtentHeader* hdr, uint64_t hdrBlock, Ext
     if (!hdr || hdr->eh_magic != 0xF30A) return false;
 
     uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t sectorSize = pdev->SectorSize();
-    uint64_t sectorsPerBlock = blockSize / sectorSize;
 
     if (hdr->eh_depth == 0) {
         if (hdr->eh_max != hdr->eh_entries) {
@@ -133,54 +106,48 @@ bool GenericEXT4Device::AddExtentDepth(ExtentHeader* hdr, uint64_t hdrBlock, Ext
 
             hdr->eh_entries++;
 
-            uint64_t LBA = hdrBlock * sectorsPerBlock;
-
-            for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-                if (!pdev->WriteSector(LBA + i, (uint8_t*)hdr + i * sectorSize)) {
-                    _ds->Println("Failed to flush extent leaf");
-                    return false;
-                }
+            /*
+             * hdr points into hdrBlock's buffer in
+             * the cache, so all we need to do is
+             * mark it dirty.
+            */
+            BlockBuffer* bb = _ds->bread(pdev, hdrBlock, blockSize);
+            if (!bb) {
+                _ds->Println("Failed to flush extent leaf");
+                return false;
             }
+            if (bb->data != (uint8_t*)hdr) {
+                memcpy(bb->data, hdr, blockSize);
+            }
+            _ds->bwrite(bb);
+            _ds->brelse(bb);
             
             return true;
         }
     } else {
-        void* buf = _ds->RequestPage();
-        uint64_t bufPhys = (uint64_t)buf;
-        uint64_t bufVirt = bufPhys + 0xFFFFFFFF00000000;
-        _ds->MapMemory((void*)bufVirt, (void*)bufPhys, false);
-
-        uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-        uint64_t sectorSize = pdev->SectorSize();
-        uint64_t sectorsPerBlock = blockSize / sectorSize;
-
         for (int i = 0; i < hdr->eh_entries; i++) {
-            memset((void*)bufVirt, 0, 4096);
-
             ExtentIDX* ei = (ExtentIDX*)((uint64_t)hdr + sizeof(ExtentHeader) + i * sizeof(ExtentIDX));
 
             uint64_t block = ((uint64_t)ei->ei_leaf_hi << 32) | (uint64_t)ei->ei_leaf_lo;
 
-            uint64_t LBA = block * sectorsPerBlock;
-                    
-            for (uint64_t x = 0; x < sectorsPerBlock; x++) {
-                if (!pdev->ReadSector(LBA + x, (void*)((uint8_t*)bufPhys + x * pdev->SectorSize()))) {
-                    _ds->Println("Failed to read directory block");
-                    return false;
-                }
+            BlockBuffer* bb = _ds->bread(pdev, block, blockSize);
+            if (!bb) {
+                _ds->Println("Failed to read directory block");
+                return false;
             }
 
-            ExtentHeader* eh = (ExtentHeader*)bufVirt;
+            ExtentHeader* eh = (ExtentHeader*)bb->data;
 
-            if (eh->eh_magic != 0xF30A) continue;
-            if (eh->eh_depth != (hdr->eh_depth - 1)) continue;
+            bool added = false;
+            if (eh->eh_magic == 0xF30A && eh->eh_depth == (hdr->eh_depth - 1)) {
+                added = AddExtentDepth(eh, block, ext);
+            }
+            _ds->brelse(bb);
 
-            if (AddExtentDepth(eh, block, ext)) {
+            if (added) {
                 return true;
             }
         }
-        _ds->UnMapMemory((void*)bufVirt);
-        _ds->FreePage(buf);
     }
     return false;
 }
@@ -189,8 +156,6 @@ bool GenericEXT4Device::AddExtent(FsNode* fsN, Inode* ind, Extent ext) {
     ExtentHeader* eh = (ExtentHeader*)ind->i_block;
 
     uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t sectorSize = pdev->SectorSize();
-    uint64_t sectorsPerBlock = blockSize / pdev->SectorSize();
 
     if (eh->eh_magic != 0xF30A) {
         eh->eh_magic = 0xF30A;
@@ -236,12 +201,9 @@ bool GenericEXT4Device::AddExtent(FsNode* fsN, Inode* ind, Extent ext) {
 
             newHdr->eh_entries++;
 
-            uint64_t blockLBA = block * (blockSize / pdev->SectorSize());
-            for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-                if (!pdev->WriteSector(blockLBA + i, (void*)((uint8_t*)bufPhys + i * pdev->SectorSize()))) {
-                    _ds->Println("Failed to write directory block");
-                    return false;
-                }
+            if (!WriteBlock(block, (void*)bufVirt)) {
+                _ds->Println("Failed to write directory block");
+                return false;
             }
 
             /*
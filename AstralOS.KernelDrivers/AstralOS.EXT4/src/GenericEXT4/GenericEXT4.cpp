@@ -3,11 +3,7 @@
 #include <new>
 
 size_t strlen(const char *str) {
-    size_t count = 0;
-    while (str[count] != '\0') {
-        count++;
-    }
-    return count;
+    return g_ds->strlen(str);
 }
 
 char *
@@ -19,119 +15,7 @@ strcat(char *s, const char *append)
 	return(save);
 }
 
-char* strchr(const char* s, int c) {
-    while (*s) {
-        if (*s == (char)c)
-            return (char*)s;
-        s++;
-    }
-
-    if (c == '\0')
-        return (char*)s;
-
-    return NULL;
-}
-
-char* strtok(char* str, const char* delim) {
-    static char* next = NULL;
-
-    if (str)
-        next = str;
-
-    if (!next)
-        return NULL;
-        
-    char* start = next;
-    while (*start && strchr(delim, *start))
-        start++;
-
-    if (*start == '\0') {
-        next = NULL;
-        return NULL;
-    }
-
-    char* end = start;
-    while (*end && !strchr(delim, *end))
-        end++;
-
-    if (*end) {
-        *end = '\0';
-        next = end + 1;
-    } else {
-        next = NULL;
-    }
-
-    return start;
-}
-
-/*
- * Found on Stack Overflow:
- * https://stackoverflow.com/questions/9210528/split-string-with-delimiters-in-c
-*/
-char** str_split(DriverServices* _ds, char* a_str, const char a_delim, size_t* size) {
-    char** result    = 0;
-    size_t count     = 0;
-    char* tmp        = _ds->strdup(a_str);
-    char* last_comma = 0;
-    char delim[2];
-    delim[0] = a_delim;
-    delim[1] = 0;
-
-    /* Count how many elements will be extracted. */
-    while (*tmp)
-    {
-        if (a_delim == *tmp)
-        {
-            count++;
-            last_comma = tmp;
-        }
-        tmp++;
-    }
-
-    /* Add space for trailing token. */
-    count += last_comma < (a_str + strlen(a_str) - 1);
-
-    /* Add space for terminating null string so caller
-       knows where the list of returned strings ends. */
-    count++;
-
-    result = (char**)_ds->malloc(sizeof(char*) * count);
-
-    if (result)
-    {
-        size_t idx  = 0;
-        char* token = strtok(a_str, delim);
-
-        while (token)
-        {
-            *(result + idx++) = _ds->strdup(token);
-            token = strtok(0, delim);
-        }
-        *(result + idx) = 0;
-    }
-    *size = count;
-
-    return result;
-}
-
-const char* to_hstridng(uint64_t value) {
-    static char buffer[19];
-    char* ptr = buffer + sizeof(buffer) - 1;
-    *ptr = '\0';
-
-    do {
-        uint8_t nibble = value & 0xF;
-        *--ptr = (nibble < 10) ? ('0' + nibble) : ('A' + nibble - 10);
-        value >>= 4;
-    } while (value > 0);
-
-    *--ptr = 'x';
-    *--ptr = '0';
-
-    return ptr;
-}
-
-static bool isPower(uint32_t n, uint32_t base) {
+bool isPower(uint32_t n, uint32_t base) {
     if (n < 1) return false;
     while (n % base == 0)
         n /= base;
@@ -139,15 +23,7 @@ static bool isPower(uint32_t n, uint32_t base) {
 }
 
 int memcmp(const void* a, const void* b, size_t n) {
-    const unsigned char* p1 = (const unsigned char*)a;
-    const unsigned char* p2 = (const unsigned char*)b;
-
-    for (size_t i = 0; i < n; i++) {
-        if (p1[i] != p2[i])
-            return (int)p1[i] - (int)p2[i];
-    }
-
-    return 0;
+    return g_ds->memcmp(a, b, n);
 }
 
 constexpr uint64_t ceil(uint64_t a, uint64_t b) {
@@ -155,29 +31,15 @@ constexpr uint64_t ceil(uint64_t a, uint64_t b) {
 }
 
 int strcmp(const char* a, const char* b) {
-    while (*a && (*a == *b)) {
-        a++;
-        b++;
-    }
-    return (unsigned char)*a - (unsigned char)*b;
+    return g_ds->strcmp(a, b);
 }
 
 void* memset(void* dest, uint8_t value, size_t num) {
-    uint8_t* ptr = (uint8_t*)dest;
-    for (size_t i = 0; i < num; i++) {
-        ptr[i] = value;
-    }
-    return dest;
+    return g_ds->memset(dest, value, num);
 }
 
 void* memcpy(void* dest, const void* src, size_t n) {
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
-
-    for (size_t i = 0; i < n; ++i)
-        d[i] = s[i];
-
-    return dest;
+    return g_ds->memcpy(dest, src, n);
 }
 
 bool GenericEXT4::Supports(const DeviceKey& devKey) {
@@ -211,6 +73,44 @@ void GenericEXT4Device::Init(DriverServices& ds, DeviceKey& dKey) {
     pdev = (PartitionDevice*)bsdrv;
 }
 
+/*
+ * Every block we touch goes through the
+ * kernel's buffer cache, so these copy a whole
+ * block out of it or into it. That includes
+ * file data, so readahead lands in the same
+ * place Read looks.
+ *
+ * WriteBlock only marks the block dirty, it
+ * hits the disk on bsync (or when the cache
+ * needs the buffer back).
+*/
+bool GenericEXT4Device::ReadBlock(uint64_t block, void* out) {
+    uint64_t blockSize = 1024ull << superblock->s_log_block_size;
+
+    BlockBuffer* bb = _ds->bread(pdev, block, blockSize);
+    if (!bb) {
+        return false;
+    }
+
+    memcpy(out, bb->data, blockSize);
+    _ds->brelse(bb);
+    return true;
+}
+
+bool GenericEXT4Device::WriteBlock(uint64_t block, const void* in) {
+    uint64_t blockSize = 1024ull << superblock->s_log_block_size;
+
+    BlockBuffer* bb = _ds->bget(pdev, block, blockSize);
+    if (!bb) {
+        return false;
+    }
+
+    memcpy(bb->data, in, blockSize);
+    _ds->bwrite(bb);
+    _ds->brelse(bb);
+    return true;
+}
+
 /*
  * First we need to check if the SectorCount is over 0x3
  * and if the SectorSize isn't 0. Then we get the LBA and
@@ -241,13 +141,9 @@ bool GenericEXT4Device::Support() {
     _ds->MapMemory((void*)bufVirt, (void*)bufPhys, false);
     memset((void*)bufVirt, 0, 4096);
 
-    uint64_t offsetI = 0;
-    for (size_t i = 0; i < LBASize; i++) {
-        if (!pdev->ReadSector(LBA + i, (void*)(bufPhys + offsetI))) {
-            _ds->Println("Failed To Read Sector : EXT4");
-            return false;
-        }
-        offsetI += pdev->SectorSize();
+    if (!pdev->ReadSectors(LBA, LBASize, (void*)bufPhys)) {
+        _ds->Println("Failed To Read Sector : EXT4");
+        return false;
     }
     superblock = (EXT4_Superblock*)(bufVirt + offset);
 
@@ -260,8 +156,7 @@ bool GenericEXT4Device::Support() {
             IncompatFeatures::INCOMPAT_CSUM_SEED
         );
         if ((superblock->s_feature_incompat & ~supported) != 0) {
-            _ds->Print(to_hstridng(superblock->s_feature_incompat));
-            _ds->Println("Unsupported Incompat Features");
+            _ds->kprintf("0x%X Unsupported Incompat Features\n", superblock->s_feature_incompat);
         } else {
             return true;
         }
@@ -415,6 +310,10 @@ bool GenericEXT4Device::Unmount() {
     superblock->s_state |= SuperblockState::Clean;
     UpdateSuperblock();
 
+    if (!_ds->bsync(pdev)) {
+        _ds->Println("Failed to write back some blocks");
+    }
+
     if (pdev->SetMount(0xA574A105)) { // Unmounted Code
         return false;
     }
@@ -489,22 +388,31 @@ FsNode* GenericEXT4Device::FindDir(FsNode* node, const char* path) {
         _ds->Println("FS Isnt Mounted");
         return nullptr;
     }
-    size_t cont = 0;
 
-    char** parts = str_split(_ds, _ds->strdup(path), '/', &cont);
+    return FindDir(node, StringView(path));
+}
+
+/*
+ * Walks through `path` one part at a time,
+ * so we don't need to copy or split it.
+*/
+FsNode* GenericEXT4Device::FindDir(FsNode* node, StringView path) {
+    PathIterator it(path);
+    StringView part;
 
     FsNode* nd = node;
 
-    for (int i = 0; i < cont; i++) {
+    while (it.Next(part)) {
         bool found = false;
         size_t count = 0;
         FsNode** contents = ListDir(nd, &count);
 
         for (int x = 0; x < count; x++) {
-            if (strcmp(contents[x]->name, parts[i]) == 0) {
+            if (part == contents[x]->name) {
                 nd = contents[x];
+                found = true;
+                break;
             }
-            found = true;
         }
         if (found != true) {
             _ds->Println("File Not Found");
@@ -718,12 +626,9 @@ FsNode* GenericEXT4Device::CreateDir(FsNode* parent, const char* name) {
 		dotdot->rec_len = ((blockSize - dot->rec_len) & 65532) | (((blockSize - dot->rec_len) >> 16) & 3);
     }
 
-    uint64_t blockLBA = newBlock * (blockSize / pdev->SectorSize());
-    for (uint64_t i = 0; i < sectorsInBlock; i++) {
-        if (!pdev->WriteSector(blockLBA + i, (void*)((uint8_t*)bufPhys + i * pdev->SectorSize()))) {
-            _ds->Println("Failed to write directory block");
-            return nullptr;
-        }
+    if (!WriteBlock(newBlock, (void*)bufVirt)) {
+        _ds->Println("Failed to write directory block");
+        return nullptr;
     }
 
     FsNode* fsN = (FsNode*)_ds->malloc(sizeof(FsNode));
@@ -774,10 +679,8 @@ FsNode* GenericEXT4Device::CreateDir(FsNode* parent, const char* name) {
         uint64_t extentStart = ((uint64_t)LastExtent->ee_start_hi << 32) | (uint64_t)LastExtent->ee_start_lo;
         uint64_t physicalLast = extentStart + (logicalLast - logicalFirst);
 
-        for (uint64_t i = 0; i < sectorsInBlock; i++) {
-            if (!pdev->ReadSector(physicalLast * sectorsInBlock + i, (void*)((uint8_t*)bufPhys + i * pdev->SectorSize()))) {
-                _ds->Println("Failed to read sector");
-            }
+        if (!ReadBlock(physicalLast, (void*)bufVirt)) {
+            _ds->Println("Failed to read sector");
         }
 
         bool Inserted = false;
@@ -841,20 +744,17 @@ FsNode* GenericEXT4Device::CreateDir(FsNode* parent, const char* name) {
             memcpy(newEntry->name, name, newEntry->name_len);
             newEntry->rec_len = ((8 + newEntry->name_len) + 3) & ~3u;
 
-            for (uint64_t i = 0; i < sectorsInBlock; i++) {
-                if (!pdev->WriteSector(newParentBlock * sectorsInBlock + i, (uint8_t*)bufPhys + i * pdev->SectorSize())) {
-                    _ds->Println("Failed to write sector");
-                }
+            if (!WriteBlock(newParentBlock, (void*)bufVirt)) {
+                _ds->Println("Failed to write sector");
             }
 
             WriteInode(parent->nodeId, parentInode);
+            _ds->bsync(pdev);
             return fsN;
         }
 
-        for (uint64_t i = 0; i < sectorsInBlock; i++) {
-            if (!pdev->WriteSector(physicalLast * sectorsInBlock + i, (void*)((uint8_t*)bufPhys + i * pdev->SectorSize()))) {
-                _ds->Println("Failed to write sector");
-            }
+        if (!WriteBlock(physicalLast, (void*)bufVirt)) {
+            _ds->Println("Failed to write sector");
         }
     }
 
@@ -871,6 +771,7 @@ FsNode* GenericEXT4Device::CreateDir(FsNode* parent, const char* name) {
     UpdateGroupDesc(group, GroupDesc);
     WriteInode(parent->nodeId, parentInode);
 
+    _ds->bsync(pdev);
     return fsN;
 }
 
@@ -956,6 +857,7 @@ File* GenericEXT4Device::Open(const char* name, uint32_t flags) {
 
     file->flags = flags;
     file->position = 0;
+    file->fsData = nullptr;
     return file;
 }
 
@@ -964,6 +866,22 @@ bool GenericEXT4Device::Close(File* file) {
         _ds->Println("FS Isnt Mounted");
         return false;
     }
+
+    /*
+     * Everything Write changed (the data, inodes,
+     * bitmaps, group descs) only made it into the
+     * buffer cache, so push it out when the file
+     * closes.
+    */
+    if (file->flags & (WR | APPEND | CREATE)) {
+        if (!_ds->bsync(pdev)) {
+            _ds->Println("Failed to write back some blocks");
+        }
+    }
+
+    if (file->fsData) {
+        _ds->free(file->fsData);
+    }
     _ds->free(file->node);
     _ds->free(file);
     file = nullptr;
@@ -999,14 +917,6 @@ int64_t GenericEXT4Device::Read(File* file, void* buffer, uint64_t size) {
     }
     
     uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t sectorSize = pdev->SectorSize();
-    uint64_t sectorsInBlock = blockSize / pdev->SectorSize();
-
-    void* buf = _ds->RequestPage();
-    uint64_t bufPhys = (uint64_t)buf;
-    uint64_t bufVirt = bufPhys + 0xFFFFFFFF00000000;
-    _ds->MapMemory((void*)bufVirt, (void*)bufPhys, false);
-    memset((void*)bufVirt, 0, 4096);
 
     FsNode* node = file->node;
 
@@ -1031,34 +941,65 @@ int64_t GenericEXT4Device::Read(File* file, void* buffer, uint64_t size) {
         uint64_t EXTsCount = 0;
         Extent** exts = GetExtents(eh, EXTsCount);
 
-        for (int i = 0; i < EXTsCount; i++) {
-            Extent* ee = exts[i];
+        Ext4Readahead* ra = (Ext4Readahead*)file->fsData;
+        if (!ra) {
+            ra = (Ext4Readahead*)_ds->malloc(sizeof(Ext4Readahead));
+            if (ra) {
+                memset(ra, 0, sizeof(Ext4Readahead));
+                file->fsData = ra;
+            }
+        }
 
-            if (ee->ee_len == 0) continue;
+        uint64_t fileBlocks = (fileSize + blockSize - 1) / blockSize;
+        uint64_t reqEnd = (pos + toRead + blockSize - 1) / blockSize;
 
-            uint64_t block = ((uint64_t)ee->ee_start_hi << 32) | (uint64_t)ee->ee_start_lo;
-            uint64_t fileBlock = ee->ee_block;
+        /*
+         * A block at a time out of the buffer
+         * cache. Readahead keeps the blocks after
+         * this one coming in while we copy, so most
+         * of these are already there (or on their
+         * way) by the time we ask.
+        */
+        int64_t result = 0;
+        while (readTotal < toRead) {
+            uint64_t fileBlock = pos / blockSize;
+            uint64_t blockOffset = pos % blockSize;
 
-            for (int x = 0; x < ee->ee_len; x++) {
-                memset((void*)bufVirt, 0, 4096);
-                uint64_t LBA = (block + x) * sectorsInBlock;
-                    
-                for (uint64_t j = 0; j < sectorsInBlock; j++) {
-                    if (!pdev->ReadSector(LBA + j, (void*)((uint8_t*)bufPhys + j * pdev->SectorSize()))) {
-                        _ds->Println("Failed to read directory block");
-                        return -28;
-                    }
-                }
+            uint64_t chunk = blockSize - blockOffset;
+            if (chunk > toRead - readTotal) chunk = toRead - readTotal;
 
-                uint64_t off = (fileBlock + x) * blockSize;
+            if (ra) {
+                Readahead(ra, exts, EXTsCount, fileBlock, reqEnd, fileBlocks);
+            }
 
-                uint64_t remaining = fileSize - off;
-                uint64_t toCopy = remaining < blockSize ? remaining : blockSize;
+            uint64_t block = MapBlock(exts, EXTsCount, fileBlock);
+            if (block == 0) {
+                memset(out + readTotal, 0, chunk);
+            } else {
+                BlockBuffer* bb = _ds->bread(pdev, block, blockSize);
+                if (!bb) {
+                    _ds->Println("Failed to read file block");
+                    result = -28;
+                    break;
+                }
+
+                memcpy(out + readTotal, bb->data + blockOffset, chunk);
+                _ds->brelse(bb);
+            }
 
-                memcpy(out + off, (void*)bufVirt, toCopy);
+            readTotal += chunk;
+            pos += chunk;
+        }
 
-                readTotal += blockSize;
+        if (exts) {
+            for (uint64_t i = 0; i < EXTsCount; i++) {
+                _ds->free(exts[i]);
             }
+            _ds->free(exts);
+        }
+
+        if (result < 0) {
+            return result;
         }
     } else {
         _ds->Println("File Doesnt use Extents!");
@@ -1073,19 +1014,17 @@ int64_t GenericEXT4Device::Read(File* file, void* buffer, uint64_t size) {
             uint32_t block = inode->i_block[blockIndex];
             if (block == 0) break;
 
-            uint64_t LBA = block * sectorsInBlock;
-
-            for (uint64_t i = 0; i < sectorsInBlock; i++) {
-                if (!pdev->ReadSector(LBA + i, (void*)((uint8_t*)bufPhys + i * pdev->SectorSize()))) {
-                    _ds->Println("Failed to read directory block");
-                    return -28;
-                }
+            BlockBuffer* bb = _ds->bread(pdev, block, blockSize);
+            if (!bb) {
+                _ds->Println("Failed to read file block");
+                return -28;
             }
 
             uint64_t chunk = blockSize - blockOffset;
             if (chunk > remaining) chunk = remaining;
 
-            memcpy(out + readTotal, (uint8_t*)bufVirt + blockOffset, chunk);
+            memcpy(out + readTotal, bb->data + blockOffset, chunk);
+            _ds->brelse(bb);
 
             readTotal += chunk;
             pos += chunk;
@@ -1139,13 +1078,9 @@ int64_t GenericEXT4Device::Write(File* file, void* buffer, uint64_t size) {
             */
             uint64_t block = ((uint64_t)exts[extsCount - 1]->ee_start_hi << 32) | (uint64_t)exts[extsCount - 1]->ee_start_lo;
 
-            uint64_t LBA = block * sectorsPerBlock;
-
-            for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-                if (!pdev->ReadSector(LBA + i, (void*)((uint8_t*)bufPhys + i * pdev->SectorSize()))) {
-                    _ds->Println("Failed to read file block");
-                    return -28;
-                }
+            if (!ReadBlock(block, (void*)bufVirt)) {
+                _ds->Println("Failed to read file block");
+                return -28;
             }
 
             /*
@@ -1165,10 +1100,8 @@ int64_t GenericEXT4Device::Write(File* file, void* buffer, uint64_t size) {
 
             memcpy((uint8_t*)bufVirt + tailOffset, buffer, toCopy);
 
-            for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-                if (!pdev->WriteSector(LBA + i, (uint8_t*)bufPhys + i * sectorSize)) {
-                    return -28;
-                }
+            if (!WriteBlock(block, (void*)bufVirt)) {
+                return -28;
             }
 
             /*
@@ -1231,13 +1164,9 @@ int64_t GenericEXT4Device::Write(File* file, void* buffer, uint64_t size) {
                     bufOff += blockSize;
                 }
 
-                uint64_t LBA = (i + blocks) * sectorsPerBlock;
-
-                for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-                    if (!pdev->WriteSector(LBA + i, (void*)((uint8_t*)bufPhys + i * pdev->SectorSize()))) {
-                        _ds->Println("Failed to read file block");
-                        return -28;
-                    }
+                if (!WriteBlock(i + blocks, (void*)bufVirt)) {
+                    _ds->Println("Failed to write file block");
+                    return -28;
                 }
             }
 
@@ -1287,31 +1216,21 @@ int64_t GenericEXT4Device::Write(File* file, void* buffer, uint64_t size) {
         return size;
     } else if ((file->flags & CREATE)) {
         if (file->node->type == FsNodeType::File) {
-            size_t size = 0;
-            char** p = str_split(_ds, _ds->strdup(file->node->name), '/', &size);
-
-            uint64_t newSize = 0;
-            for (size_t i = 0; i < (size - 1); i++) {
-                if ((size - 1) == 1) {
-                    newSize += strlen(p[i - 1]);
-                } else {
-                    newSize += strlen(p[i - 1]) + 1;
-                }
-            }
-
-            char* newPath = (char*)_ds->malloc(newSize);
-            
-            for (size_t i = 0; i < (size - 1); i++) {
-                if ((size - 1) == 1) {
-                    strcat(newPath, p[i]);
-                } else {
-                    strcat(newPath, p[i]);
-                    strcat(newPath, "/");
-                }
+            /*
+             * The part before the last `/` is the
+             * dir the file goes in, and the rest
+             * is the name of the new file.
+            */
+            StringView name(file->node->name);
+            size_t slash = name.rfind('/');
+
+            StringView newPath;
+            const char* newFile = name.data();
+            if (slash != StringView::npos) {
+                newPath = name.substring(0, slash);
+                newFile = name.data() + slash + 1;
             }
 
-            char* newFile = p[size - 1];
-
             FsNode* fsN = FindDir(pdev->GetMountNode(), newPath);
             if (!fsN) {
                 _ds->Println("Failed to Find Dir");
@@ -1408,7 +1327,7 @@ int64_t GenericEXT4Device::Write(File* file, void* buffer, uint64_t size) {
                 uint32_t newBlk = AllocateBlock(fsN);
                 
                 ExtentHeader* extHdr = (ExtentHeader*)((uint8_t*)newInode->i_block);
-                _ds->Print(to_hstridng(extHdr->eh_magic));
+                _ds->kprintf("0x%X", extHdr->eh_magic);
                 extHdr->eh_magic = 0xF30A;
                 extHdr->eh_entries = 0;
                 extHdr->eh_max = 4;
@@ -1440,10 +1359,8 @@ int64_t GenericEXT4Device::Write(File* file, void* buffer, uint64_t size) {
             uint64_t extentStart = ((uint64_t)LastExtent->ee_start_hi << 32) | (uint64_t)LastExtent->ee_start_lo;
             uint64_t physicalLast = extentStart + (logicalLast - logicalFirst);
 
-            for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-                if (!pdev->ReadSector(physicalLast * sectorsPerBlock + i, (void*)((uint8_t*)bufPhys + i * pdev->SectorSize()))) {
-                    _ds->Println("Failed to read sector");
-                }
+            if (!ReadBlock(physicalLast, (void*)bufVirt)) {
+                _ds->Println("Failed to read sector");
             }
 
             bool Inserted = false;
@@ -1509,10 +1426,8 @@ int64_t GenericEXT4Device::Write(File* file, void* buffer, uint64_t size) {
                 memcpy(newEntry->name, newFile, newEntry->name_len);
                 newEntry->rec_len = ((8 + newEntry->name_len) + 3) & ~3u;
 
-                for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-                    if (!pdev->WriteSector(newParentBlock * sectorsPerBlock + i, (uint8_t*)bufPhys + i * pdev->SectorSize())) {
-                        _ds->Println("Failed to write sector");
-                    }
+                if (!WriteBlock(newParentBlock, (void*)bufVirt)) {
+                    _ds->Println("Failed to write sector");
                 }
 
                 WriteInode(fsN->nodeId, ParentInode);
@@ -1548,10 +1463,8 @@ int64_t GenericEXT4Device::Write(File* file, void* buffer, uint64_t size) {
                 return 0;
             }
 
-            for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-                if (!pdev->WriteSector(physicalLast * sectorsPerBlock + i, (void*)((uint8_t*)bufPhys + i * pdev->SectorSize()))) {
-                    _ds->Println("Failed to write sector");
-                }
+            if (!WriteBlock(physicalLast, (void*)bufVirt)) {
+                _ds->Println("Failed to write sector");
             }
             
             FsNode* newfsN = (FsNode*)_ds->malloc(sizeof(FsNode));
@@ -3,6 +3,7 @@
 #define FILE
 #include "../PCI.h"
 #include "../DriverServices.h"
+#include "../StringView.h"
 #include <cstdint>
 #include "../crc32c.h"
 
@@ -11,9 +12,9 @@
 #include "Inode/Inode.h"
 #include "Directory/Directory.h"
 #include "Extent/Extent.h"
+#include "Readahead/Readahead.h"
 
-const char* to_hstridng(uint64_t value);
-static bool isPower(uint32_t n, uint32_t base);
+bool isPower(uint32_t n, uint32_t base);
 int memcmp(const void* a, const void* b, size_t n);
 constexpr uint64_t ceil(uint64_t a, uint64_t b);
 int strcmp(const char* a, const char* b);
@@ -49,6 +50,7 @@ public:
 
     virtual FsNode** ListDir(FsNode* node, size_t* outCount) override;
     virtual FsNode* FindDir(FsNode* node, const char* name) override;
+    FsNode* FindDir(FsNode* node, StringView path);
     virtual FsNode* CreateDir(FsNode* parent, const char* name) override;
     virtual bool Remove(FsNode* node) override;
 
@@ -88,6 +90,11 @@ private:
     bool AddExtent(FsNode* fsN, Inode* ind, Extent ee);
     bool AddExtentDepth(ExtentHeader* hdr, uint64_t hdrBlock, Extent ext);
     void ParseDirectoryBlock(FsNode**& nodes, uint64_t& count, size_t& capacity, uint64_t block);
+    bool ReadBlock(uint64_t block, void* out);
+    bool WriteBlock(uint64_t block, const void* in);
+    uint64_t MapBlock(Extent** exts, uint64_t extsCount, uint64_t fileBlock);
+    void IssueReadahead(Extent** exts, uint64_t extsCount, uint64_t from, uint64_t count, uint64_t fileBlocks);
+    void Readahead(Ext4Readahead* ra, Extent** exts, uint64_t extsCount, uint64_t fileBlock, uint64_t reqEnd, uint64_t fileBlocks);
 
 	PartitionDevice* pdev;
 	DriverServices* _ds = nullptr;
@@ -20,28 +20,27 @@
  * Then we can read and return our Bitmap.
 */
 uint8_t* GenericEXT4Device::ReadBitmapInode(BlockGroupDescriptor* GroupDesc) {
-    void* bufPhys = _ds->RequestPage();
-    uint64_t bufVirt = (uint64_t)bufPhys + 0xFFFFFFFF00000000;
-    _ds->MapMemory((void*)bufVirt, bufPhys, false);
-    memset((void*)bufVirt, 0, 4096);
-
     uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t sectorsPerBlock = blockSize / pdev->SectorSize();
+
+    uint8_t* bitmap = (uint8_t*)_ds->malloc(blockSize);
+    if (!bitmap) {
+        return 0;
+    }
 
     uint64_t inodeBitmapBlock = ((uint64_t)GroupDesc->bg_inode_bitmap_hi << 32) | GroupDesc->bg_inode_bitmap_lo;
-    uint64_t inodeBitmapLBA = inodeBitmapBlock * sectorsPerBlock;
 
     /*
-     * Now we can read our Inode Bitmap
+     * Now we can read our Inode Bitmap. You
+     * get your own copy, so free it when you
+     * are done.
     */
-    for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-        if (!pdev->ReadSector(inodeBitmapLBA + i, (uint8_t*)bufPhys + i * pdev->SectorSize())) {
-            _ds->Println("Failed to read inode bitmap");
-            return 0;
-        }
+    if (!ReadBlock(inodeBitmapBlock, bitmap)) {
+        _ds->Println("Failed to read inode bitmap");
+        _ds->free(bitmap);
+        return 0;
     }
 
-    return (uint8_t*)bufVirt;
+    return bitmap;
 }
 
 /*
@@ -53,35 +52,12 @@ uint8_t* GenericEXT4Device::ReadBitmapInode(BlockGroupDescriptor* GroupDesc) {
  * Next, we can just Unmap and free the page.
 */
 void GenericEXT4Device::WriteBitmapInode(BlockGroupDescriptor* GroupDesc, uint8_t* bitmap) {
-    void* bufPhys = _ds->RequestPage();
-    uint64_t bufVirt = (uint64_t)bufPhys + 0xFFFFFFFF00000000;
-    _ds->MapMemory((void*)bufVirt, bufPhys, false);
-    memset((void*)bufVirt, 0, 4096);
-
-    uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t sectorsPerBlock = blockSize / pdev->SectorSize();
-
     uint64_t inodeBitmapBlock = ((uint64_t)GroupDesc->bg_inode_bitmap_hi << 32) | GroupDesc->bg_inode_bitmap_lo;
-    uint64_t inodeBitmapLBA = inodeBitmapBlock * sectorsPerBlock;
 
-    for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-        if (!pdev->ReadSector(inodeBitmapLBA + i, (uint8_t*)bufPhys + i * pdev->SectorSize())) {
-            _ds->Println("Failed to read inode bitmap");
-            return;
-        }
-    }
-    
-    memcpy((void*)bufVirt, bitmap, blockSize);
-
-    for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-        if (!pdev->WriteSector(inodeBitmapLBA + i, (uint8_t*)bufPhys + i * pdev->SectorSize())) {
-            _ds->Println("Failed to write inode bitmap");
-            return;
-        }
+    if (!WriteBlock(inodeBitmapBlock, bitmap)) {
+        _ds->Println("Failed to write inode bitmap");
+        return;
     }
-
-    _ds->UnMapMemory((void*)bufVirt);
-    _ds->FreePage(bufPhys);
 }
 
 /*
@@ -157,10 +133,12 @@ uint32_t GenericEXT4Device::AllocateInode(FsNode* parent) {
 
         if (newInode == 0xFFFFFFFF) {
             _ds->Println("No free inode");
+            _ds->free(bitmap);
             continue;
         }
 
         WriteBitmapInode(GroupDesc, bitmap);
+        _ds->free(bitmap);
         
         superblock->s_free_inodes_count--;
         UpdateSuperblock();
@@ -197,6 +175,7 @@ void GenericEXT4Device::UpdateInodeBitmapChksum(uint32_t group, BlockGroupDescri
 
         uint32_t crc = crc32c_sw(~0, superblock->s_uuid, 16);
         crc = crc32c_sw(crc, bitmap, blockSize);
+        _ds->free(bitmap);
 
         GroupDesc->bg_inode_bitmap_csum_lo = crc & 0xFFFF;
         if (superblock->s_feature_incompat & IncompatFeatures::INCOMPAT_64BIT) {
@@ -222,36 +201,36 @@ Inode* GenericEXT4Device::ReadInode(uint64_t node) {
     uint64_t InodeIndex = (node - 1) % superblock->s_inodes_per_group;
 
     uint64_t BlockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t SectorSize = pdev->SectorSize();
-    uint64_t SectorsPerBlock = BlockSize / SectorSize;
-
-    void* buf = _ds->RequestPage();
-    uint64_t bufPhys = (uint64_t)buf;
-    uint64_t bufVirt = bufPhys + 0xFFFFFFFF00000000;
-
-    _ds->MapMemory((void*)bufVirt, (void*)bufPhys, false);
-    memset((void*)bufVirt, 0, 4096);
 
     BlockGroupDescriptor* GroupDesc = GroupDescs[InodeBlockGroup];
 
     uint64_t InodeTableBlock = ((uint64_t)GroupDesc->bg_inode_table_hi << 32) | (uint64_t)GroupDesc->bg_inode_table_lo;
-    uint64_t InodeTableLBA = InodeTableBlock * SectorsPerBlock;
     uint64_t InodeOffset = InodeIndex * superblock->s_inode_size;
     uint64_t InodeSize = superblock->s_inode_size;
 
-    uint64_t startSectorIndex = InodeOffset / SectorSize;
-    uint64_t sectorOffset = InodeOffset % SectorSize;
+    /*
+     * The inode table block comes out of the
+     * buffer cache, and you get a copy of the
+     * inode, so changing it doesn't change the
+     * cached block until you WriteInode it.
+    */
+    BlockBuffer* bb = _ds->bread(pdev, InodeTableBlock + InodeOffset / BlockSize, BlockSize);
+    if (!bb) {
+        _ds->Println("Failed to read root inode");
+        return nullptr;
+    }
 
-    uint64_t bytesNeeded = sectorOffset + InodeSize;
-    uint64_t sectorsToRead = (bytesNeeded + SectorSize - 1) / SectorSize;
-    for (uint64_t i = 0; i < sectorsToRead; i++) {
-        uint64_t LBA = InodeTableLBA + startSectorIndex + i;
-        if (!pdev->ReadSector(LBA, (void*)(bufPhys + i * SectorSize))) {
-            _ds->Println("Failed to read root inode");
-            return nullptr;
-        }
+    uint64_t copySize = InodeSize > sizeof(Inode) ? InodeSize : sizeof(Inode);
+    Inode* inode = (Inode*)_ds->malloc(copySize);
+    if (!inode) {
+        _ds->brelse(bb);
+        return nullptr;
     }
-    return (Inode*)(bufVirt + sectorOffset);
+    memset(inode, 0, copySize);
+    memcpy(inode, bb->data + InodeOffset % BlockSize, InodeSize);
+
+    _ds->brelse(bb);
+    return inode;
 }
 
 /*
@@ -287,8 +266,6 @@ void GenericEXT4Device::WriteInode(uint32_t inodeNum, Inode* ind) {
         ind->i_checksum_hi = (crc >> 16);
     }
     uint64_t blockSize = 1024ull << superblock->s_log_block_size;
-    uint64_t sectorSize = pdev->SectorSize();
-    uint64_t sectorsPerBlock = blockSize / sectorSize;
 
     uint32_t inodeIndex = inodeNum - 1;
     uint32_t inodesPerGroup = superblock->s_inodes_per_group;
@@ -308,29 +285,17 @@ void GenericEXT4Device::WriteInode(uint32_t inodeNum, Inode* ind) {
     uint64_t blockOffset = byteOffset / blockSize;
     uint64_t offsetInBlock = byteOffset % blockSize;
 
-    uint64_t LBA = (inodeTableBlock + blockOffset) * sectorsPerBlock;
-
-    void* bufPhys = _ds->RequestPage();
-    uint64_t bufVirt = (uint64_t)bufPhys + 0xFFFFFFFF00000000;
-    _ds->MapMemory((void*)bufVirt, bufPhys, false);
-    memset((void*)bufVirt, 0, 4096);
-
-    for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-        if (!pdev->ReadSector(LBA + i, (uint8_t*)bufPhys + i * sectorSize)) {
-            _ds->Println("Failed to Write Inode");
-            return;
-        }
+    BlockBuffer* bb = _ds->bread(pdev, inodeTableBlock + blockOffset, blockSize);
+    if (!bb) {
+        _ds->Println("Failed to Write Inode");
+        return;
     }
     
     uint8_t tmp[4096];
     memset(tmp, 0, inodeSize);
     memcpy(tmp, ind, sizeof(Inode));
-    memcpy((uint8_t*)bufVirt + offsetInBlock, tmp, inodeSize);
+    memcpy(bb->data + offsetInBlock, tmp, inodeSize);
 
-    for (uint64_t i = 0; i < sectorsPerBlock; i++) {
-        if (!pdev->WriteSector(LBA + i, (uint8_t*)bufPhys + i * sectorSize)) {
-            _ds->Println("Failed to Write Inode [Write Sector]");
-            return;
-        }
-    }
+    _ds->bwrite(bb);
+    _ds->brelse(bb);
 }
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include "../GenericEXT4.h"
+
+/*
+ * An extent with ee_len over 32768 is
+ * uninitialized, which reads back as zeros,
+ * so there's nothing on the disk to read.
+*/
+static bool ExtentReadable(Extent* ee) {
+    return ee->ee_len != 0 && ee->ee_len <= 32768;
+}
+
+/*
+ * Turns a block of the file into a block on
+ * the disk, or 0 if it's in a hole.
+*/
+uint64_t GenericEXT4Device::MapBlock(Extent** exts, uint64_t extsCount, uint64_t fileBlock) {
+    for (uint64_t i = 0; i < extsCount; i++) {
+        Extent* ee = exts[i];
+        if (!ExtentReadable(ee)) continue;
+
+        if (fileBlock >= ee->ee_block && fileBlock < (uint64_t)ee->ee_block + ee->ee_len) {
+            uint64_t start = ((uint64_t)ee->ee_start_hi << 32) | (uint64_t)ee->ee_start_lo;
+            return start + (fileBlock - ee->ee_block);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Sends file blocks [from, from + count) off
+ * to the buffer cache without waiting. Each
+ * extent is contiguous on the disk, so every
+ * piece of the range that lands in one extent
+ * is one breada.
+*/
+void GenericEXT4Device::IssueReadahead(Extent** exts, uint64_t extsCount, uint64_t from, uint64_t count, uint64_t fileBlocks) {
+    uint64_t blockSize = 1024ull << superblock->s_log_block_size;
+
+    uint64_t end = from + count;
+    if (end > fileBlocks) end = fileBlocks;
+
+    for (uint64_t i = 0; i < extsCount && from < end; i++) {
+        Extent* ee = exts[i];
+        if (!ExtentReadable(ee)) continue;
+
+        uint64_t lo = ee->ee_block;
+        uint64_t hi = lo + ee->ee_len;
+        if (lo < from) lo = from;
+        if (hi > end) hi = end;
+        if (lo >= hi) continue;
+
+        uint64_t start = ((uint64_t)ee->ee_start_hi << 32) | (uint64_t)ee->ee_start_lo;
+        _ds->breada(pdev, start + (lo - ee->ee_block), hi - lo, blockSize);
+    }
+}
+
+/*
+ * Read calls this before every block it reads.
+ *
+ * If the reader jumped somewhere, we start over
+ * with a window that covers the rest of this
+ * read (at least EXT4_RA_MIN). After that, every
+ * time the reader gets halfway into the last
+ * window we sent out, the next one goes out
+ * right behind it at twice the size, so the
+ * disk stays ahead of a sequential reader.
+*/
+void GenericEXT4Device::Readahead(Ext4Readahead* ra, Extent** exts, uint64_t extsCount, uint64_t fileBlock, uint64_t reqEnd, uint64_t fileBlocks) {
+    uint64_t blockSize = 1024ull << superblock->s_log_block_size;
+    uint64_t minBlocks = EXT4_RA_MIN / blockSize;
+    uint64_t maxBlocks = EXT4_RA_MAX / blockSize;
+
+    bool sequential = fileBlock == ra->next;
+    ra->next = fileBlock + 1;
+
+    if (!sequential) {
+        ra->start = fileBlock;
+        ra->size = 0;
+        ra->marker = fileBlock;
+    }
+
+    if (fileBlock < ra->marker) {
+        return;
+    }
+
+    uint64_t from = ra->start + ra->size;
+    uint64_t size;
+    if (ra->size == 0) {
+        size = reqEnd - fileBlock;
+    } else {
+        size = ra->size * 2;
+    }
+    if (size < minBlocks) size = minBlocks;
+    if (size > maxBlocks) size = maxBlocks;
+
+    if (from >= fileBlocks) {
+        /*
+         * Everything up to the end of the file
+         * is out already.
+        */
+        ra->marker = ~0ull;
+        return;
+    }
+
+    IssueReadahead(exts, extsCount, from, size, fileBlocks);
+
+    ra->start = from;
+    ra->size = size;
+    ra->marker = from + size / 2;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <stddef.h>
+
+/*
+ * Readahead starts out EXT4_RA_MIN bytes ahead
+ * of a sequential reader and doubles every time
+ * the reader catches up, up to EXT4_RA_MAX.
+*/
+#define EXT4_RA_MIN (128 * 1024)
+#define EXT4_RA_MAX (2 * 1024 * 1024)
+
+/*
+ * Kept in File::fsData, one per open file. All
+ * of these are logical (file) block numbers.
+ *
+ * `next` is where a sequential read would go
+ * next. The last window we sent out is `start`
+ * to `start + size`, and once the reader gets
+ * to `marker` we send out the one after it.
+*/
+struct Ext4Readahead {
+    uint64_t next;
+    uint64_t start;
+    uint64_t size;
+    uint64_t marker;
+};
@@ -31,40 +31,21 @@ void GenericEXT4Device::UpdateSuperblock() {
         superblock->s_checksum = crc32c_sw(~0, superblock->s_uuid, 16);
         superblock->s_checksum = crc32c_sw(superblock->s_checksum, superblock, offsetof(EXT4_Superblock, s_checksum));
     }
-    uint32_t sectorSize = pdev->SectorSize();
-
     uint64_t superblockSize = 1024;
     uint64_t SuperblockOffset = 1024;
     uint64_t blockSize = 1024ull << superblock->s_log_block_size;
 
     auto writeSuperblock = [&](uint64_t blockNum) {
-        uint64_t LBA = (blockNum * blockSize) / sectorSize;
-        uint64_t Offset = (blockNum * blockSize) % sectorSize;
-        uint64_t sectorsNeeded = (Offset + superblockSize + sectorSize - 1) / sectorSize;
-
-        void* bufPhys = _ds->RequestPage();
-        uint64_t bufVirt = (uint64_t)bufPhys + 0xFFFFFFFF00000000;
-        _ds->MapMemory((void*)bufVirt, bufPhys, false);
-        memset((void*)bufVirt, 0, 4096);
-
-        for (uint64_t i = 0; i < sectorsNeeded; i++) {
-            if (!pdev->ReadSector(LBA + i, (uint8_t*)bufPhys + i * sectorSize)) {
-                _ds->Println("Failed to read superblock backup");
-                return;
-            }
+        BlockBuffer* bb = _ds->bread(pdev, blockNum, blockSize);
+        if (!bb) {
+            _ds->Println("Failed to read superblock backup");
+            return;
         }
 
-        EXT4_Superblock* sup = (EXT4_Superblock*)((uint8_t*)bufVirt + Offset);
+        memcpy(bb->data, superblock, superblockSize);
 
-        memcpy((uint8_t*)bufVirt + Offset, superblock, superblockSize);
-
-        for (uint64_t i = 0; i < sectorsNeeded; i++) {
-            if (!pdev->WriteSector(LBA + i, (uint8_t*)bufPhys + i * sectorSize)) {
-                _ds->Print("Failed to write superblock backup: ");
-                _ds->Println(to_hstridng(LBA + i));
-                return;
-            }
-        }
+        _ds->bwrite(bb);
+        _ds->brelse(bb);
     };
 
     writeSuperblock(SuperblockOffset / blockSize);
@@ -82,7 +63,7 @@ void GenericEXT4Device::UpdateSuperblock() {
         uint32_t totalBlockGroups = (blocks + superblock->s_blocks_per_group - 1) / superblock->s_blocks_per_group;
         for (uint32_t bg = 0; bg < totalBlockGroups; bg++) {
             if (HasSuperblockBKP(bg)) {
-                    _ds->Println(to_hstridng(bg));
+                    _ds->kprintf("0x%X\n", bg);
                 uint64_t backupBlock = (bg == 0) ? superblock->s_first_data_block : bg * superblock->s_blocks_per_group;
                 if (backupBlock != SuperblockOffset / blockSize) {
                     //writeSuperblock(backupBlock);
@@ -0,0 +1,452 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <utility>
+#ifdef DRIVER
+#include "DriverServices.h"
+#include "StringView.h"
+
+extern DriverServices* g_ds;
+#else
+#include "../../KernelServices/Paging/MemoryAlloc/Heap.h"
+#include "../StringView/StringView.h"
+
+void Print(const char* str);
+#endif
+
+/*
+ * The HashMap gets its memory from here.
+ *
+ * The kernel can just use the heap, but
+ * drivers can't link against the kernel,
+ * so they have to go through the
+ * DriverServices that they got passed in
+ * DriverMain.
+ *
+ * If you need the memory to come from
+ * somewhere else, you can pass your own
+ * struct with an Alloc and a Free func.
+*/
+struct HashMapAlloc {
+    static void* Alloc(size_t size) {
+#ifdef DRIVER
+        return g_ds->malloc(size);
+#else
+        return malloc(size);
+#endif
+    }
+
+    static void Free(void* ptr) {
+#ifdef DRIVER
+        g_ds->free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+};
+
+/*
+ * operator[] has to hand back a reference, so
+ * if it can't get the memory for a new entry
+ * there's nothing sane left to return. We say
+ * so and stop, instead of reading past the end
+ * of the slots.
+*/
+[[noreturn]] inline void HashMapOutOfMemory() {
+#ifdef DRIVER
+    g_ds->Println("HashMap: out of memory");
+#else
+    Print("HashMap: out of memory");
+#endif
+    while (true) {
+        asm volatile("cli; hlt");
+    }
+}
+
+/*
+ * This is the finalizer from MurmurHash3.
+ *
+ * Most of our keys are small numbers that
+ * only differ in their low bits (like PCI
+ * locations), so we need to mix them, or
+ * else they would all end up next to each
+ * other in the table.
+*/
+inline uint64_t HashInt(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+/*
+ * FNV-1a, which is simple and good
+ * enough for paths and names.
+*/
+inline uint64_t HashStr(const char* str) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    while (*str) {
+        hash ^= (uint8_t)*str++;
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+inline uint64_t HashStr(const char* str, size_t len) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/*
+ * The HashTraits tell the HashMap how to
+ * hash a key and how to compare two keys.
+ *
+ * This one works for integers, enums and
+ * pointers. If you want to use your own
+ * struct as a key, write a struct with a
+ * Hash and an Equal func and pass it to
+ * the HashMap.
+*/
+template<typename K>
+struct HashTraits {
+    static uint64_t Hash(const K& key) {
+        return HashInt((uint64_t)key);
+    }
+
+    static bool Equal(const K& a, const K& b) {
+        return a == b;
+    }
+};
+
+/*
+ * Strings are compared by their contents,
+ * not by their pointers.
+ *
+ * The HashMap doesn't copy the string, so
+ * whatever the key points to must stay
+ * alive for as long as it is in the map.
+*/
+template<>
+struct HashTraits<const char*> {
+    static uint64_t Hash(const char* key) {
+        return HashStr(key);
+    }
+
+    static bool Equal(const char* a, const char* b) {
+        while (*a && (*a == *b)) {
+            a++;
+            b++;
+        }
+        return *a == *b;
+    }
+};
+
+/*
+ * StringViews hash the same way as C
+ * strings, so you can look up part of
+ * a path without copying it out first.
+*/
+template<>
+struct HashTraits<StringView> {
+    static uint64_t Hash(const StringView& key) {
+        return HashStr(key.data(), key.size());
+    }
+
+    static bool Equal(const StringView& a, const StringView& b) {
+        return a == b;
+    }
+};
+
+template<>
+struct HashTraits<char*> {
+    static uint64_t Hash(const char* key) {
+        return HashStr(key);
+    }
+
+    static bool Equal(const char* a, const char* b) {
+        return HashTraits<const char*>::Equal(a, b);
+    }
+};
+
+/*
+ * An open addressing hash map, which uses
+ * Robin Hood hashing.
+ *
+ * -- How it works --
+ * Every key has a home slot (its hash masked
+ * to the capacity). If the home slot is in
+ * use, we keep walking to the next slot until
+ * we find an empty one.
+ *
+ * The Robin Hood part is that each entry
+ * remembers how far away from its home it
+ * is. When we insert and find an entry that
+ * is closer to its home than we are to ours,
+ * we take its slot and keep walking with the
+ * entry we kicked out. This keeps every probe
+ * short, and a lookup can stop as soon as it
+ * finds an entry that is closer to home than
+ * the key we are looking for.
+ *
+ * The distances live in their own byte array
+ * (ctrl), so a lookup mostly reads one cache
+ * line of bytes and only touches the slots
+ * when a distance matches. 0 means the slot
+ * is empty, otherwise it is the distance + 1.
+ *
+ * Removing an entry shifts the entries after
+ * it back by one, so we don't need tombstones.
+*/
+template<typename K, typename V, typename Traits = HashTraits<K>, typename Alloc = HashMapAlloc>
+class HashMap {
+public:
+    HashMap() {}
+
+    ~HashMap() {
+        clear();
+        Alloc::Free(ctrl);
+        Alloc::Free(slots);
+    }
+
+    HashMap(const HashMap&) = delete;
+    HashMap& operator=(const HashMap&) = delete;
+
+    /*
+     * Adds the key or replaces the value of
+     * the key if it is already in the map.
+     *
+     * Returns true if the key is new.
+    */
+    bool insert(const K& key, const V& value) {
+        size_t idx = findIndex(key);
+        if (idx != npos) {
+            slots[idx].value = value;
+            return false;
+        }
+
+        return emplace(K(key), V(value));
+    }
+
+    V* find(const K& key) {
+        size_t idx = findIndex(key);
+        return idx == npos ? nullptr : &slots[idx].value;
+    }
+
+    const V* find(const K& key) const {
+        size_t idx = findIndex(key);
+        return idx == npos ? nullptr : &slots[idx].value;
+    }
+
+    bool contains(const K& key) const {
+        return findIndex(key) != npos;
+    }
+
+    /*
+     * Like the STL, this will add a default
+     * value if the key doesn't exist yet.
+    */
+    V& operator[](const K& key) {
+        size_t idx = findIndex(key);
+        if (idx == npos) {
+            if (!emplace(K(key), V())) {
+                HashMapOutOfMemory();
+            }
+            idx = findIndex(key);
+        }
+        return slots[idx].value;
+    }
+
+    bool remove(const K& key) {
+        size_t idx = findIndex(key);
+        if (idx == npos) {
+            return false;
+        }
+
+        slots[idx].~Slot();
+
+        size_t next = (idx + 1) & mask;
+        while (ctrl[next] > 1) {
+            new (&slots[idx]) Slot{ std::move(slots[next].key), std::move(slots[next].value) };
+            slots[next].~Slot();
+            ctrl[idx] = ctrl[next] - 1;
+
+            idx = next;
+            next = (next + 1) & mask;
+        }
+
+        ctrl[idx] = 0;
+        count--;
+        return true;
+    }
+
+    /*
+     * Makes sure we can hold `entries` entries
+     * without having to grow again.
+    */
+    bool reserve(size_t entries) {
+        size_t cap = MinCapacity;
+        while (entries * MaxLoadDen > cap * MaxLoadNum) {
+            cap *= 2;
+        }
+
+        if (cap <= capacity) {
+            return true;
+        }
+        return rehash(cap);
+    }
+
+    void clear() {
+        for (size_t i = 0; i < capacity; i++) {
+            if (ctrl[i] != 0) {
+                slots[i].~Slot();
+                ctrl[i] = 0;
+            }
+        }
+        count = 0;
+    }
+
+    /*
+     * Calls fn(key, value) for every entry.
+     * Don't insert or remove from inside fn.
+    */
+    template<typename Fn>
+    void forEach(Fn fn) {
+        for (size_t i = 0; i < capacity; i++) {
+            if (ctrl[i] != 0) {
+                fn(slots[i].key, slots[i].value);
+            }
+        }
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+private:
+    struct Slot {
+        K key;
+        V value;
+    };
+
+    static constexpr size_t npos = (size_t)-1;
+    static constexpr size_t MinCapacity = 8;
+    static constexpr size_t MaxLoadNum = 7;
+    static constexpr size_t MaxLoadDen = 8;
+    static constexpr uint8_t MaxDist = 0xFF;
+
+    size_t findIndex(const K& key) const {
+        if (count == 0) {
+            return npos;
+        }
+
+        size_t idx = Traits::Hash(key) & mask;
+        uint8_t dist = 1;
+
+        while (true) {
+            uint8_t c = ctrl[idx];
+            if (c < dist) {
+                return npos;
+            }
+            if (c == dist && Traits::Equal(slots[idx].key, key)) {
+                return idx;
+            }
+            idx = (idx + 1) & mask;
+            dist++;
+        }
+    }
+
+    /*
+     * Inserts a key that we know isn't in
+     * the map yet.
+     *
+     * If an entry ever ends up MaxDist slots
+     * away from home, the table is way too
+     * crowded, so we grow it and try again
+     * with whatever entry we are holding.
+    */
+    bool emplace(K&& key, V&& value) {
+        if ((count + 1) * MaxLoadDen > capacity * MaxLoadNum) {
+            if (!rehash(capacity ? capacity * 2 : MinCapacity)) {
+                return false;
+            }
+        }
+
+        K k = std::move(key);
+        V v = std::move(value);
+        uint8_t dist = 1;
+        size_t idx = Traits::Hash(k) & mask;
+
+        while (true) {
+            if (ctrl[idx] == 0) {
+                new (&slots[idx]) Slot{ std::move(k), std::move(v) };
+                ctrl[idx] = dist;
+                count++;
+                return true;
+            }
+
+            if (ctrl[idx] < dist) {
+                std::swap(k, slots[idx].key);
+                std::swap(v, slots[idx].value);
+                std::swap(dist, ctrl[idx]);
+            }
+
+            idx = (idx + 1) & mask;
+            dist++;
+
+            if (dist == MaxDist) {
+                if (!rehash(capacity * 2)) {
+                    return false;
+                }
+                dist = 1;
+                idx = Traits::Hash(k) & mask;
+            }
+        }
+    }
+
+    bool rehash(size_t newCapacity) {
+        uint8_t* oldCtrl = ctrl;
+        Slot* oldSlots = slots;
+        size_t oldCapacity = capacity;
+
+        uint8_t* newCtrl = (uint8_t*)Alloc::Alloc(newCapacity);
+        Slot* newSlots = (Slot*)Alloc::Alloc(newCapacity * sizeof(Slot));
+        if (!newCtrl || !newSlots) {
+            Alloc::Free(newCtrl);
+            Alloc::Free(newSlots);
+            return false;
+        }
+
+        for (size_t i = 0; i < newCapacity; i++) {
+            newCtrl[i] = 0;
+        }
+
+        ctrl = newCtrl;
+        slots = newSlots;
+        capacity = newCapacity;
+        mask = newCapacity - 1;
+        count = 0;
+
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (oldCtrl[i] != 0) {
+                emplace(std::move(oldSlots[i].key), std::move(oldSlots[i].value));
+                oldSlots[i].~Slot();
+            }
+        }
+
+        Alloc::Free(oldCtrl);
+        Alloc::Free(oldSlots);
+        return true;
+    }
+
+    uint8_t* ctrl = nullptr;
+    Slot* slots = nullptr;
+    size_t capacity = 0;
+    size_t mask = 0;
+    size_t count = 0;
+};
@@ -44,6 +44,22 @@ bool GenericGPTDevice::WriteSector(uint64_t lba, void* buffer) {
     return pcdev->WriteSector(partition, lba, buffer);
 }
 
+bool GenericGPTDevice::ReadSectors(uint64_t lba, uint32_t count, void* buffer) {
+    return pcdev->ReadSectors(partition, lba, count, buffer);
+}
+
+bool GenericGPTDevice::WriteSectors(uint64_t lba, uint32_t count, void* buffer) {
+    return pcdev->WriteSectors(partition, lba, count, buffer);
+}
+
+bool GenericGPTDevice::Submit(BlockRequest* req) {
+    return pcdev->Submit(partition, req);
+}
+
+bool GenericGPTDevice::Wait(BlockRequest* req) {
+    return pcdev->Wait(partition, req);
+}
+
 uint64_t GenericGPTDevice::SectorCount() const {
     return pcdev->SectorCount(partition);
 }
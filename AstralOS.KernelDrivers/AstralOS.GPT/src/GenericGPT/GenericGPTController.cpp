@@ -2,23 +2,6 @@
 #include "../global.h"
 #include <new>
 
-const char* to_hstridng(uint64_t value) {
-    static char buffer[19];
-    char* ptr = buffer + sizeof(buffer) - 1;
-    *ptr = '\0';
-
-    do {
-        uint8_t nibble = value & 0xF;
-        *--ptr = (nibble < 10) ? ('0' + nibble) : ('A' + nibble - 10);
-        value >>= 4;
-    } while (value > 0);
-
-    *--ptr = 'x';
-    *--ptr = '0';
-
-    return ptr;
-}
-
 bool GenericGPTControllerFactory::Supports(const DeviceKey& devKey) {
     if (devKey.bars[2] == 22) {
         uint64_t dev = ((uint64_t)devKey.bars[0] << 32) | devKey.bars[1];
@@ -45,21 +28,11 @@ PartitionController* GenericGPTControllerFactory::CreateDevice() {
 }
 
 void* memset(void* dest, uint8_t value, size_t num) {
-    uint8_t* ptr = (uint8_t*)dest;
-    for (size_t i = 0; i < num; i++) {
-        ptr[i] = value;
-    }
-    return dest;
+    return g_ds->memset(dest, value, num);
 }
 
 void* memcpy(void* dest, const void* src, size_t n) {
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
-
-    for (size_t i = 0; i < n; ++i)
-        d[i] = s[i];
-
-    return dest;
+    return g_ds->memcpy(dest, src, n);
 }
 
 void GenericGPTController::Init(DriverServices& ds, DeviceKey& dKey) {
@@ -73,7 +46,7 @@ void GenericGPTController::Init(DriverServices& ds, DeviceKey& dKey) {
     void* mem = _ds->malloc(sizeof(GenericGPTDeviceFactory));
     if (!mem) {
         _ds->Println("Failed to Malloc for Generic GPT Device Factory");
-        _ds->Println(to_hstridng((uint64_t)mem));
+        _ds->kprintf("%p\n", mem);
     }
 
     /*
@@ -194,6 +167,44 @@ bool GenericGPTController::WriteSector(uint8_t partition, uint64_t lba, void* bu
     return bldev->WriteSector(start + lba, buffer);
 }
 
+bool GenericGPTController::ReadSectors(uint8_t partition, uint64_t lba, uint32_t count, void* buffer) {
+    uint64_t sectors = SectorCount(partition);
+    if (lba >= sectors || count > sectors - lba) {
+        return false;
+    }
+
+    return bldev->ReadSectors(Partitions[partition].StartingLBA + lba, count, buffer);
+}
+
+bool GenericGPTController::WriteSectors(uint8_t partition, uint64_t lba, uint32_t count, void* buffer) {
+    uint64_t sectors = SectorCount(partition);
+    if (lba >= sectors || count > sectors - lba) {
+        return false;
+    }
+
+    return bldev->WriteSectors(Partitions[partition].StartingLBA + lba, count, buffer);
+}
+
+/*
+ * The request goes straight down to the disk,
+ * we just move lba from the start of the
+ * partition to the start of the disk.
+*/
+bool GenericGPTController::Submit(uint8_t partition, BlockRequest* req) {
+    uint64_t sectors = SectorCount(partition);
+    if (req->lba >= sectors || req->count > sectors - req->lba) {
+        req->status = BLOCK_ERROR;
+        return false;
+    }
+
+    req->lba += Partitions[partition].StartingLBA;
+    return bldev->Submit(req);
+}
+
+bool GenericGPTController::Wait(uint8_t partition, BlockRequest* req) {
+    return bldev->Wait(req);
+}
+
 uint64_t GenericGPTController::SectorCount(uint8_t partition) const {
     if (Partitions[partition].EndingLBA >= Partitions[partition].StartingLBA) {
         return (Partitions[partition].EndingLBA - Partitions[partition].StartingLBA) + 1;
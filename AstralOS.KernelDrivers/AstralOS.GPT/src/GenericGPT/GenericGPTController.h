@@ -62,6 +62,10 @@ public:
     virtual void Init(DriverServices& ds, DeviceKey& devKey) override;
     virtual bool ReadSector(uint8_t partition, uint64_t lba, void* buffer) override;
     virtual bool WriteSector(uint8_t partition, uint64_t lba, void* buffer) override;
+    virtual bool ReadSectors(uint8_t partition, uint64_t lba, uint32_t count, void* buffer) override;
+    virtual bool WriteSectors(uint8_t partition, uint64_t lba, uint32_t count, void* buffer) override;
+    virtual bool Submit(uint8_t partition, BlockRequest* req) override;
+    virtual bool Wait(uint8_t partition, BlockRequest* req) override;
 
     virtual uint64_t SectorCount(uint8_t partition) const override;
     virtual uint32_t SectorSize(uint8_t partition) const override;
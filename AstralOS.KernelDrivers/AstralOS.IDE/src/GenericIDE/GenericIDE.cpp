@@ -43,6 +43,22 @@ bool GenericIDE::WriteSector(uint64_t lba, void* buffer) {
     return pdev->WriteSector(drive, lba, buffer);
 }
 
+bool GenericIDE::ReadSectors(uint64_t lba, uint32_t count, void* buffer) {
+    return pdev->ReadSectors(drive, lba, count, buffer);
+}
+
+bool GenericIDE::WriteSectors(uint64_t lba, uint32_t count, void* buffer) {
+    return pdev->WriteSectors(drive, lba, count, buffer);
+}
+
+bool GenericIDE::Submit(BlockRequest* req) {
+    return pdev->Submit(drive, req);
+}
+
+bool GenericIDE::Wait(BlockRequest* req) {
+    return pdev->Wait(drive, req);
+}
+
 uint64_t GenericIDE::SectorCount() const {
     return pdev->SectorCount(drive);
 }
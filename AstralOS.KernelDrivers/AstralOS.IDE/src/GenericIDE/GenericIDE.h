@@ -15,6 +15,10 @@ public:
     virtual void Init(DriverServices& ds, DeviceKey& devKey) override;
     virtual bool ReadSector(uint64_t lba, void* buffer) override;
     virtual bool WriteSector(uint64_t lba, void* buffer) override;
+    virtual bool ReadSectors(uint64_t lba, uint32_t count, void* buffer) override;
+    virtual bool WriteSectors(uint64_t lba, uint32_t count, void* buffer) override;
+    virtual bool Submit(BlockRequest* req) override;
+    virtual bool Wait(BlockRequest* req) override;
 
     virtual uint64_t SectorCount() const override;
     virtual uint32_t SectorSize() const override;
@@ -2,41 +2,6 @@
 #include "../global.h"
 #include  <new>
 
-const char* to_hstridng(uint64_t value) {
-    static char buffer[19];
-    char* ptr = buffer + sizeof(buffer) - 1;
-    *ptr = '\0';
-
-    do {
-        uint8_t nibble = value & 0xF;
-        *--ptr = (nibble < 10) ? ('0' + nibble) : ('A' + nibble - 10);
-        value >>= 4;
-    } while (value > 0);
-
-    *--ptr = 'x';
-    *--ptr = '0';
-
-    return ptr;
-}
-
-const char* to_string(int64_t value) {
-    static char buffer[21];
-    char* ptr = buffer + sizeof(buffer) - 1;
-    *ptr = '\0';
-
-    bool isNegative = (value < 0);
-    if (isNegative) value = -value;
-
-    do {
-        *--ptr = '0' + (value % 10);
-        value /= 10;
-    } while (value > 0);
-
-    if (isNegative) *--ptr = '-';
-
-    return ptr;
-}
-
 static inline void outb(uint16_t port, uint8_t val) {
     asm volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
 }
@@ -56,6 +21,20 @@ static inline void insl(uint16_t port, void* addr, uint32_t count) {
                   : "memory");
 }
 
+static inline void insw(uint16_t port, void* addr, uint32_t count) {
+    asm volatile ("rep insw"
+                  : "+D"(addr), "+c"(count)
+                  : "d"(port)
+                  : "memory");
+}
+
+static inline void outsw(uint16_t port, const void* addr, uint32_t count) {
+    asm volatile ("rep outsw"
+                  : "+S"(addr), "+c"(count)
+                  : "d"(port)
+                  : "memory");
+}
+
 static inline uint16_t inw(uint16_t port) {
     uint16_t ret;
     asm volatile("inw %1, %0" : "=a"(ret) : "Nd"(port));
@@ -66,6 +45,26 @@ static inline void outw(uint16_t port, uint16_t val) {
     asm volatile("outw %0, %1" : : "a"(val), "Nd"(port));
 }
 
+static inline void outl(uint16_t port, uint32_t val) {
+    asm volatile("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
+/*
+ * Same as the AHCI driver, turning interrupts
+ * off is all the locking we need on one CPU.
+*/
+static inline uint64_t IDELock() {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void IDEUnlock(uint64_t flags) {
+    if (flags & (1 << 9)) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
 bool GenericIDEControllerFactory::Supports(const DeviceKey& devKey) {
     if (devKey.classCode == 0x01 && devKey.subclass == 0x01) {
         if (devKey.progIF == 0x0 || 
@@ -101,7 +100,7 @@ void GenericIDEController::Init(DriverServices& ds, DeviceKey& dKey) {
     void* mem = _ds->malloc(sizeof(GenericIDEFactory));
     if (!mem) {
         _ds->Println("Failed to Malloc for Generic IDE Factory");
-        _ds->Println(to_hstridng((uint64_t)mem));
+        _ds->kprintf("%p\n", mem);
     }
 
     /*
@@ -117,9 +116,21 @@ void GenericIDEController::Init(DriverServices& ds, DeviceKey& dKey) {
     channels[ATA_PRIMARY ].bmide = (devKey.bars[4] & 0xFFFFFFFC) + 0; 
     channels[ATA_SECONDARY].bmide = (devKey.bars[4] & 0xFFFFFFFC) + 8;
 
+    /*
+     * nIEN stays set (no interrupts) until
+     * SetupIRQs has a handler for the channel.
+    */
+    channels[ATA_PRIMARY  ].nIEN = 2;
+    channels[ATA_SECONDARY].nIEN = 2;
     ide_write(ATA_PRIMARY  , ATA_REG_CONTROL, 2);
     ide_write(ATA_SECONDARY, ATA_REG_CONTROL, 2);
 
+    for (int i = 0; i < 4; i++) {
+        ide_devices[i].Reserved = 0;
+        ide_devices[i].DMA = 0;
+        ide_devices[i].Multiple = 0;
+    }
+
     int count = 0;
 
     for (int i = 0; i < 2; i++) {
@@ -183,6 +194,10 @@ void GenericIDEController::Init(DriverServices& ds, DeviceKey& dKey) {
             }
             ide_devices[count].Model[40] = 0;
 
+            if (type == IDE_ATA) {
+                SetupMultiple(count, *((unsigned short *)(ide_buf + ATA_IDENT_MAX_MULTIPLE)) & 0xFF);
+            }
+
             BaseDriver* device = factory->CreateDevice();
 
             BaseDriver* dev = this;
@@ -207,16 +222,191 @@ void GenericIDEController::Init(DriverServices& ds, DeviceKey& dKey) {
             } else if (ide_devices[i].Type == IDE_ATAPI) {
                 _ds->Print("ATAPI");
             }
-            _ds->Print(" Drive ");
-            _ds->Print(to_string(ide_devices[i].Size / 1024 / 1024 / 2));
-            _ds->Print("GB - ");
-            _ds->Println((const char*)ide_devices[i].Model);
+            _ds->kprintf(" Drive %uGB - %s\n", ide_devices[i].Size / 1024 / 1024 / 2, (const char*)ide_devices[i].Model);
       }
     }
 
+    SetupIRQs();
+    SetupDMA();
+
     Initialised = true;
 }
 
+/*
+ * READ/WRITE MULTIPLE gives us a whole block
+ * of sectors per DRQ instead of one, so there's
+ * a lot less status polling between them. The
+ * block size has to be a power of two, and we
+ * take the biggest one the drive can do.
+*/
+void GenericIDEController::SetupMultiple(uint8_t drive, unsigned short max) {
+    if (max > IDE_MAX_MULTIPLE) max = IDE_MAX_MULTIPLE;
+    if (max < 2) {
+        return;
+    }
+
+    unsigned short sectors = 1;
+    while (sectors * 2 <= max) {
+        sectors *= 2;
+    }
+
+    uint8_t channel = ide_devices[drive].Channel;
+    ide_write(channel, ATA_REG_HDDEVSEL, 0xA0 | (ide_devices[drive].Drive << 4));
+    ide_write(channel, ATA_REG_SECCOUNT0, sectors);
+    ide_write(channel, ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+
+    if (ide_polling(channel, 0) || (ide_read(channel, ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF))) {
+        _ds->klog(LOG_WARN, "IDE: drive %u refused SET MULTIPLE MODE (%u sectors)", drive, sectors);
+        return;
+    }
+
+    ide_devices[drive].Multiple = sectors;
+    _ds->klog(LOG_INFO, "IDE: drive %u using %u sectors per DRQ block", drive, sectors);
+}
+
+static bool IDEInterrupt(uint8_t, void* ctx) {
+    IDEChannelDMA* d = (IDEChannelDMA*)ctx;
+    return d->ctrl->HandleInterrupt(d->channel);
+}
+
+/*
+ * A channel in compatibility mode is always on
+ * ISA IRQ 14 (primary) or 15 (secondary), so
+ * we can route that pin ourselves. In native
+ * mode it's a level triggered PCI INTx line,
+ * and without the ACPI routing for it (_PRT)
+ * we'd only be guessing, so those channels
+ * stay on PIO and get polled.
+*/
+bool GenericIDEController::SetupChannelIRQ(uint8_t channel) {
+    bool native = devKey.progIF & (channel == ATA_PRIMARY ? 0x01 : 0x04);
+    if (native) {
+        _ds->klog(LOG_WARN, "IDE: channel %u is in native mode, polling", channel);
+        return false;
+    }
+
+    uint8_t vector = _ds->AllocateVector();
+    if (vector == 0) {
+        _ds->klog(LOG_WARN, "IDE: no free vector for channel %u, polling", channel);
+        return false;
+    }
+
+    if (!_ds->RequestIRQ(vector, IDEInterrupt, &dma[channel])) {
+        _ds->FreeVector(vector);
+        return false;
+    }
+
+    if (!_ds->RouteIRQ(channel == ATA_PRIMARY ? 14 : 15, vector)) {
+        _ds->FreeIRQ(vector, IDEInterrupt, &dma[channel]);
+        _ds->FreeVector(vector);
+        return false;
+    }
+
+    dma[channel].vector = vector;
+    channels[channel].nIEN = 0;
+    ide_write(channel, ATA_REG_CONTROL, 0);
+    _ds->klog(LOG_INFO, "IDE: channel %u using vector 0x%X", channel, vector);
+    return true;
+}
+
+/*
+ * Every channel with something on it gets its
+ * IRQ, not just the ones doing DMA, since ATAPI
+ * reads wait for it too.
+*/
+void GenericIDEController::SetupIRQs() {
+    for (int ch = 0; ch < 2; ch++) {
+        dma[ch].ctrl = this;
+        dma[ch].channel = ch;
+        dma[ch].prdt = nullptr;
+        dma[ch].prdtPhys = 0;
+        dma[ch].vector = 0;
+        dma[ch].irqWorking = false;
+        dma[ch].req = nullptr;
+    }
+
+    for (int ch = 0; ch < 2; ch++) {
+        for (int d = 0; d < 4; d++) {
+            if (ide_devices[d].Reserved && ide_devices[d].Channel == ch) {
+                SetupChannelIRQ(ch);
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Bus mastering needs the controller to say
+ * it can (bit 7 of the ProgIF), BAR4, and a
+ * PRD table somewhere under 4GB, since the
+ * PRD pointer is only 32 bits. Drives that
+ * don't report DMA in their IDENTIFY data, and
+ * ATAPI drives, stay on PIO.
+ *
+ * So do channels without an IRQ. With nIEN set
+ * the drive never raises INTRQ, so the bus
+ * master never sets its IRQ bit and we'd have
+ * no way to tell the transfer finished.
+*/
+void GenericIDEController::SetupDMA() {
+    if (!(devKey.progIF & 0x80) || (devKey.bars[4] & 0xFFFFFFFC) == 0) {
+        _ds->klog(LOG_INFO, "IDE: no bus mastering, using PIO");
+        return;
+    }
+
+    /*
+     * Enable I/O Space and Bus Master
+    */
+    if (devKey.PCIe) {
+        uint16_t cmd = _ds->ConfigReadWorde(devKey.segment, devKey.bus, devKey.device, devKey.function, 0x04);
+        _ds->ConfigWriteWorde(devKey.segment, devKey.bus, devKey.device, devKey.function, 0x04, cmd | (1 << 0) | (1 << 2));
+    } else {
+        uint16_t cmd = _ds->ConfigReadWord(devKey.bus, devKey.device, devKey.function, 0x04);
+        _ds->ConfigWriteWord(devKey.bus, devKey.device, devKey.function, 0x04, cmd | (1 << 0) | (1 << 2));
+    }
+
+    for (int ch = 0; ch < 2; ch++) {
+        bool want = false;
+        for (int d = 0; d < 4; d++) {
+            if (ide_devices[d].Reserved && ide_devices[d].Channel == ch &&
+                ide_devices[d].Type == IDE_ATA && (ide_devices[d].Capabilities & (1 << 8))) {
+                want = true;
+            }
+        }
+        if (!want) {
+            continue;
+        }
+        if (dma[ch].vector == 0) {
+            _ds->klog(LOG_WARN, "IDE: channel %u has no IRQ, staying on PIO", ch);
+            continue;
+        }
+
+        uint64_t phys = (uint64_t)_ds->RequestPage();
+        if (!phys) {
+            continue;
+        }
+        if (phys + 4096 > 0x100000000ull) {
+            _ds->FreePage((void*)phys);
+            continue;
+        }
+
+        dma[ch].prdtPhys = phys;
+        dma[ch].prdt = (IDEPRD*)(0xFFFFFFFF00000000 + phys);
+        _ds->MapMemory((void*)dma[ch].prdt, (void*)phys, false);
+
+        outb(channels[ch].bmide + BMIDE_REG_COMMAND, 0);
+        outb(channels[ch].bmide + BMIDE_REG_STATUS, BMIDE_SR_ERR | BMIDE_SR_IRQ);
+
+        for (int d = 0; d < 4; d++) {
+            if (ide_devices[d].Reserved && ide_devices[d].Channel == ch &&
+                ide_devices[d].Type == IDE_ATA && (ide_devices[d].Capabilities & (1 << 8))) {
+                ide_devices[d].DMA = 1;
+                _ds->klog(LOG_INFO, "IDE: drive %d using bus master DMA", d);
+            }
+        }
+    }
+}
+
 /*
  * This code is from the OSDev Wiki:
  * https://wiki.osdev.org/PCI_IDE_Controller
@@ -361,6 +551,9 @@ unsigned char GenericIDEController::ide_print_error(uint8_t drive, unsigned char
     } else if (err == 4) {
         _ds->Println("Write Protected");
         err = 8;
+    } else if (err == 5) {
+        _ds->Println("Bad Request");
+        err = 24;
     }
     _ds->Print("- [");
 
@@ -384,83 +577,113 @@ unsigned char GenericIDEController::ide_print_error(uint8_t drive, unsigned char
    return err;
 }
 
-unsigned char GenericIDEController::ide_ata_access(uint8_t drive, unsigned char direction, unsigned int lba, unsigned char numsects, void* buffer) {
-    unsigned char lba_mode, cmd;
-    unsigned char lba_io[6];
+/*
+ * numsects goes up to IDE_PIO_MAX_SECTORS. If
+ * the drive took SET MULTIPLE MODE, each DRQ
+ * is a block of Multiple sectors, otherwise
+ * it's one. Either way the data goes through
+ * with one rep insw/outsw per DRQ, and a write
+ * only gets flushed once at the end.
+ *
+ * A sector count we can't send, or an LBA past
+ * 28 bits on a drive without LBA48, is error 5.
+*/
+unsigned char GenericIDEController::ide_ata_access(uint8_t drive, unsigned char direction, uint64_t lba, uint32_t numsects, void* buffer) {
+    unsigned char cmd;
     uint32_t channel = ide_devices[drive].Channel;
     uint32_t slavebit = ide_devices[drive].Drive;
     uint16_t bus = channels[channel].base;
-    unsigned char head;
+    uint32_t multiple = ide_devices[drive].Multiple;
+    bool lba48 = lba + numsects > 0x10000000;
+
+    if (numsects == 0 || numsects > IDE_PIO_MAX_SECTORS) {
+        return 5;
+    }
+    if (lba48 && !(ide_devices[drive].CommandSets & (1 << 26))) {
+        return 5;
+    }
 
     while (ide_read(channel, ATA_REG_STATUS) & ATA_SR_BSY) {
 
     }
 
-    if (lba >= 0x10000000) {
-        lba_mode = 2;
-        lba_io[0] = (lba & 0xFF);
-        lba_io[1] = (lba >> 8) & 0xFF;
-        lba_io[2] = (lba >> 16) & 0xFF;
-        lba_io[3] = (lba >> 24) & 0xFF;
-        lba_io[4] = 0;
-        lba_io[5] = 0;
-        head = 0;
-    } else {
-        lba_mode = 1;
-        lba_io[0] = (lba & 0xFF);
-        lba_io[1] = (lba >> 8) & 0xFF;
-        lba_io[2] = (lba >> 16) & 0xFF;
-        lba_io[3] = 0;
-        lba_io[4] = 0;
-        lba_io[5] = 0;
-        head = (lba >> 24) & 0xF;
-    }
-
-    if (lba_mode == 1) {
-        ide_write(channel, ATA_REG_HDDEVSEL, 0xE0 | (slavebit << 4) | head);
-    } else {
+    if (lba48) {
         ide_write(channel, ATA_REG_HDDEVSEL, 0x40 | (slavebit << 4));
+        ide_write(channel, ATA_REG_SECCOUNT1, (numsects >> 8) & 0xFF);
+        ide_write(channel, ATA_REG_LBA3, (lba >> 24) & 0xFF);
+        ide_write(channel, ATA_REG_LBA4, (lba >> 32) & 0xFF);
+        ide_write(channel, ATA_REG_LBA5, (lba >> 40) & 0xFF);
+    } else {
+        ide_write(channel, ATA_REG_HDDEVSEL, 0xE0 | (slavebit << 4) | ((lba >> 24) & 0xF));
     }
 
-    ide_write(channel, ATA_REG_SECCOUNT0, numsects);
-    ide_write(channel, ATA_REG_LBA0, lba_io[0]);
-    ide_write(channel, ATA_REG_LBA1, lba_io[1]);
-    ide_write(channel, ATA_REG_LBA2, lba_io[2]);
+    ide_write(channel, ATA_REG_SECCOUNT0, numsects & 0xFF);
+    ide_write(channel, ATA_REG_LBA0, lba & 0xFF);
+    ide_write(channel, ATA_REG_LBA1, (lba >> 8) & 0xFF);
+    ide_write(channel, ATA_REG_LBA2, (lba >> 16) & 0xFF);
 
-    if (direction == 0) {
-        cmd = (lba_mode == 2) ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO;
+    if (multiple) {
+        if (direction == 0) {
+            cmd = lba48 ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+        } else {
+            cmd = lba48 ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+        }
     } else {
-        cmd = (lba_mode == 2) ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO;
+        multiple = 1;
+        if (direction == 0) {
+            cmd = lba48 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO;
+        } else {
+            cmd = lba48 ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO;
+        }
     }
 
     ide_write(channel, ATA_REG_COMMAND, cmd);
 
     uint16_t* buf = (uint16_t*)buffer;
-    for (unsigned char i = 0; i < numsects; i++) {
+    uint32_t left = numsects;
+    while (left > 0) {
+        uint32_t block = left < multiple ? left : multiple;
+        unsigned char err = ide_polling(channel, 1);
+        if (err) {
+            return err;
+        }
+
         if (direction == 0) {
-            if (ide_polling(channel, 1)) {
-                return 1;
-            }
-            for (int w = 0; w < 256; w++) {
-                buf[w] = inw(bus);
-            }
+            insw(bus, buf, block * 256);
         } else {
-            if (ide_polling(channel, 0)) return 1;
-            for (int w = 0; w < 256; w++) {
-                outw(bus, buf[w]);
-            }
-            ide_write(channel, ATA_REG_COMMAND, (lba_mode == 2) ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
-            ide_polling(channel, 0);
+            outsw(bus, buf, block * 256);
+        }
+
+        buf += block * 256;
+        left -= block;
+    }
+
+    if (direction != 0) {
+        ide_polling(channel, 0);
+        ide_write(channel, ATA_REG_COMMAND, lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+        if (ide_polling(channel, 0)) {
+            return 1;
         }
-        buf += 256;
     }
     return 0;
 }
 
-void GenericIDEController::ide_wait_irq() {
-   while (!ide_irq_invoked)
-      ;
-   ide_irq_invoked = 0;
+/*
+ * The drive showing DRQ (or an error) with BSY
+ * clear counts too, so a channel without an
+ * IRQ, or an IRQ that got lost, doesn't leave
+ * us spinning here. ALTSTATUS doesn't ack the
+ * interrupt, so the IRQ still gets through.
+*/
+void GenericIDEController::ide_wait_irq(uint8_t channel) {
+    while (!ide_irq_invoked) {
+        unsigned char state = ide_read(channel, ATA_REG_ALTSTATUS);
+        if (!(state & ATA_SR_BSY) && (state & (ATA_SR_DRQ | ATA_SR_ERR))) {
+            break;
+        }
+        asm volatile("pause");
+    }
+    ide_irq_invoked = 0;
 }
 
 void GenericIDEController::ide_irq() {
@@ -510,7 +733,7 @@ unsigned char GenericIDEController::ide_atapi_read(uint8_t drive, unsigned int l
 
     uint16_t* buf16 = (uint16_t*)buffer;
     for (int i = 0; i < numsects; i++) {
-        ide_wait_irq();
+        ide_wait_irq(channel);
         if ((err = ide_polling(channel, 1))) {
             return err;
         }
@@ -528,47 +751,401 @@ unsigned char GenericIDEController::ide_atapi_read(uint8_t drive, unsigned int l
     return 0;
 }
 
+/*
+ * These go through Submit too, so they wait
+ * their turn behind any DMA on the channel.
+*/
 bool GenericIDEController::ReadSector(uint8_t drive, uint64_t lba, void* buffer) {
-    if (drive > 3 || ide_devices[drive].Reserved == 0) {
-        _ds->Println("[IDE] Drive Not Found");
+    return ReadSectors(drive, lba, 1, buffer);
+}
+
+bool GenericIDEController::WriteSector(uint8_t drive, uint64_t lba, void* buffer) {
+    return WriteSectors(drive, lba, 1, buffer);
+}
+
+/*
+ * Just one request with one segment, Submit
+ * already knows how to split it up.
+*/
+bool GenericIDEController::ReadSectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer) {
+    DMASegment seg = { (uint64_t)buffer, count * SectorSize(drive) };
+    BlockRequest req = { lba, count, &seg, 1, false, nullptr, nullptr, BLOCK_PENDING };
+    if (!Submit(drive, &req)) {
         return false;
     }
+    return Wait(drive, &req);
+}
 
-    if ((lba >= ide_devices[drive].Size) && ide_devices[drive].Type == IDE_ATA) {
-        _ds->Println("[IDE] Out of bounds");
+bool GenericIDEController::WriteSectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer) {
+    DMASegment seg = { (uint64_t)buffer, count * SectorSize(drive) };
+    BlockRequest req = { lba, count, &seg, 1, true, nullptr, nullptr, BLOCK_PENDING };
+    if (!Submit(drive, &req)) {
         return false;
     }
+    return Wait(drive, &req);
+}
 
-    unsigned char err = 0;
-    if (ide_devices[drive].Type == IDE_ATA) {
-        err = ide_ata_access(drive, ATA_READ, lba, 1, buffer);
-    } else if (ide_devices[drive].Type == IDE_ATAPI) {
-        err = ide_atapi_read(drive, lba, 1, buffer);
+/*
+ * The PRD pointer and every address in the
+ * table are 32 bits, and the controller moves
+ * words, so the segments have to be under 4GB
+ * and even. Anything else goes through PIO.
+*/
+bool GenericIDEController::DMAUsable(uint8_t drive, BlockRequest* req) {
+    if (!ide_devices[drive].DMA || !dma[ide_devices[drive].Channel].prdt) {
+        return false;
+    }
+
+    bool lba48 = ide_devices[drive].CommandSets & (1 << 26);
+    if (!lba48 && req->lba + req->count > 0x10000000) {
+        return false;
     }
 
-    ide_print_error(drive, err);
+    for (size_t i = 0; i < req->segCount; i++) {
+        if ((req->segs[i].phys | req->segs[i].size) & 1) {
+            return false;
+        }
+        if (req->segs[i].phys + req->segs[i].size > 0x100000000ull) {
+            return false;
+        }
+    }
     return true;
 }
 
-bool GenericIDEController::WriteSector(uint8_t drive, uint64_t lba, void* buffer) {
+/*
+ * Fills the PRD table with the next piece of
+ * the channel's request and starts it. Called
+ * with interrupts off, from Submit or from the
+ * IRQ when the piece before it finished.
+*/
+bool GenericIDEController::StartDMA(uint8_t channel) {
+    IDEChannelDMA& d = dma[channel];
+    BlockRequest* req = d.req;
+    uint8_t drive = d.drive;
+    uint32_t sectorSize = SectorSize(drive);
+    bool lba48 = ide_devices[drive].CommandSets & (1 << 26);
+
+    uint64_t sectors = d.end - d.lba;
+    uint32_t max = lba48 ? IDE_DMA_MAX_SECTORS : IDE_DMA_MAX_SECTORS28;
+    if (sectors > max) sectors = max;
+
+    uint64_t left = sectors * sectorSize;
+    uint64_t total = 0;
+    size_t n = 0;
+    while (left && d.seg < req->segCount && n < IDE_PRD_ENTRIES) {
+        const DMASegment& seg = req->segs[d.seg];
+        uint64_t phys = seg.phys + d.segOff;
+        uint64_t len = seg.size - d.segOff;
+        uint64_t boundary = 0x10000 - (phys & 0xFFFF);
+        if (len > left) len = left;
+        if (len > boundary) len = boundary;
+
+        d.prdt[n].phys = (uint32_t)phys;
+        d.prdt[n].bytes = (uint16_t)len;
+        d.prdt[n].flags = 0;
+        n++;
+
+        left -= len;
+        total += len;
+        d.segOff += len;
+        if (d.segOff == seg.size) {
+            d.seg++;
+            d.segOff = 0;
+        }
+    }
+
+    /*
+     * If the table filled up in the middle of a
+     * sector, give the odd bytes back to the next
+     * piece, since a command moves whole sectors.
+    */
+    uint64_t excess = total % sectorSize;
+    total -= excess;
+    while (excess) {
+        uint32_t bytes = d.prdt[n - 1].bytes ? d.prdt[n - 1].bytes : 0x10000;
+        uint32_t take = bytes < excess ? bytes : excess;
+        if (d.segOff == 0) {
+            d.seg--;
+            d.segOff = req->segs[d.seg].size;
+        }
+        d.segOff -= take;
+        excess -= take;
+        if (take == bytes) {
+            n--;
+        } else {
+            d.prdt[n - 1].bytes = (uint16_t)(bytes - take);
+        }
+    }
+
+    if (total == 0) {
+        return false;
+    }
+    d.prdt[n - 1].flags = IDE_PRD_EOT;
+    d.chunk = total / sectorSize;
+
+    uint16_t bm = channels[channel].bmide;
+    uint8_t dir = req->write ? 0 : BMIDE_CMD_READ;
+
+    while (ide_read(channel, ATA_REG_STATUS) & ATA_SR_BSY) {
+
+    }
+
+    outb(bm + BMIDE_REG_COMMAND, 0);
+    outl(bm + BMIDE_REG_PRDT, (uint32_t)d.prdtPhys);
+    outb(bm + BMIDE_REG_STATUS, BMIDE_SR_ERR | BMIDE_SR_IRQ);
+    outb(bm + BMIDE_REG_COMMAND, dir);
+
+    uint64_t lba = d.lba;
+    uint8_t slavebit = ide_devices[drive].Drive;
+    uint8_t cmd;
+    if (lba48) {
+        ide_write(channel, ATA_REG_HDDEVSEL, 0x40 | (slavebit << 4));
+        ide_write(channel, ATA_REG_SECCOUNT1, (d.chunk >> 8) & 0xFF);
+        ide_write(channel, ATA_REG_LBA3, (lba >> 24) & 0xFF);
+        ide_write(channel, ATA_REG_LBA4, (lba >> 32) & 0xFF);
+        ide_write(channel, ATA_REG_LBA5, (lba >> 40) & 0xFF);
+        cmd = req->write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    } else {
+        ide_write(channel, ATA_REG_HDDEVSEL, 0xE0 | (slavebit << 4) | ((lba >> 24) & 0xF));
+        cmd = req->write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+    }
+    ide_write(channel, ATA_REG_SECCOUNT0, d.chunk & 0xFF);
+    ide_write(channel, ATA_REG_LBA0, lba & 0xFF);
+    ide_write(channel, ATA_REG_LBA1, (lba >> 8) & 0xFF);
+    ide_write(channel, ATA_REG_LBA2, (lba >> 16) & 0xFF);
+    ide_write(channel, ATA_REG_COMMAND, cmd);
+
+    outb(bm + BMIDE_REG_COMMAND, dir | BMIDE_CMD_START);
+    return true;
+}
+
+/*
+ * Checks whether the piece in flight is done,
+ * and if it is, starts the next one or finishes
+ * the request. Reading the status register is
+ * what makes the drive drop its IRQ line.
+ * Returns false if the channel didn't have
+ * anything for us.
+*/
+bool GenericIDEController::FinishDMA(uint8_t channel) {
+    IDEChannelDMA& d = dma[channel];
+    uint16_t bm = channels[channel].bmide;
+
+    uint8_t bmStatus = inb(bm + BMIDE_REG_STATUS);
+    if (!(bmStatus & BMIDE_SR_IRQ)) {
+        return false;
+    }
+
+    outb(bm + BMIDE_REG_COMMAND, 0);
+    uint8_t status = ide_read(channel, ATA_REG_STATUS);
+    outb(bm + BMIDE_REG_STATUS, BMIDE_SR_ERR | BMIDE_SR_IRQ);
+
+    BlockRequest* req = d.req;
+    if (!req) {
+        return true;
+    }
+
+    bool ok = !(bmStatus & BMIDE_SR_ERR) && !(status & (ATA_SR_ERR | ATA_SR_DF));
+    if (ok) {
+        d.lba += d.chunk;
+        if (d.lba < d.end) {
+            if (StartDMA(channel)) {
+                return true;
+            }
+            ok = false;
+        }
+    }
+
+    d.req = nullptr;
+
+    /*
+     * The drive stays on PIO from here on, and
+     * the whole request goes again that way.
+     * This runs from the IRQ, but PIO only
+     * polls, and it only happens once a drive.
+    */
+    if (!ok) {
+        _ds->klog(LOG_ERROR, "IDE: DMA failed at lba %lu (status 0x%X, bus master 0x%X), drive %u falling back to PIO",
+            d.lba, status, bmStatus, d.drive);
+        ide_devices[d.drive].DMA = 0;
+        ok = TransferPIO(d.drive, req) == 0;
+    }
+
+    req->status = ok ? BLOCK_OK : BLOCK_ERROR;
+    if (req->done) {
+        req->done(req);
+    }
+    return true;
+}
+
+/*
+ * On a channel without DMA in flight, this is
+ * a PIO or ATAPI command, so we just let
+ * ide_wait_irq know.
+*/
+bool GenericIDEController::HandleInterrupt(uint8_t channel) {
+    if (!dma[channel].req) {
+        ide_irq();
+        return true;
+    }
+
+    if (!FinishDMA(channel)) {
+        return false;
+    }
+    dma[channel].irqWorking = true;
+    return true;
+}
+
+void GenericIDEController::Poll(uint8_t channel) {
+    if (dma[channel].req) {
+        FinishDMA(channel);
+    }
+}
+
+/*
+ * Like the AHCI driver: once we've seen the
+ * IRQ work we sleep until it comes, before
+ * that we poll. We poll after every wakeup
+ * too, and the timer wakes us after
+ * IDE_WAKEUP_MS at most, so a lost IRQ can't
+ * hang us. Called with interrupts off, and
+ * gives them back.
+*/
+void GenericIDEController::WaitStep(uint8_t channel, uint64_t flags) {
+    if (dma[channel].irqWorking && (flags & (1 << 9))) {
+        _ds->ArmWakeup(IDE_WAKEUP_MS);
+        asm volatile("sti; hlt" : : : "memory");
+
+        flags = IDELock();
+        Poll(channel);
+        IDEUnlock(flags);
+    } else {
+        Poll(channel);
+        IDEUnlock(flags);
+        asm volatile("pause");
+    }
+}
+
+/*
+ * A channel only takes one command at a time,
+ * for either of its drives.
+*/
+void GenericIDEController::WaitChannel(uint8_t channel) {
+    while (true) {
+        uint64_t flags = IDELock();
+        if (!dma[channel].req) {
+            IDEUnlock(flags);
+            return;
+        }
+        WaitStep(channel, flags);
+    }
+}
+
+/*
+ * Does all of req with PIO, right here. One
+ * command can only move IDE_PIO_MAX_SECTORS
+ * (255 for ATAPI), so bigger segments get
+ * split up.
+*/
+unsigned char GenericIDEController::TransferPIO(uint8_t drive, BlockRequest* req) {
+    uint32_t sectorSize = SectorSize(drive);
+    uint64_t lba = req->lba;
+    unsigned char err = 0;
+    for (size_t i = 0; i < req->segCount && !err; i++) {
+        uint8_t* buf = (uint8_t*)req->segs[i].phys;
+        uint32_t sectors = req->segs[i].size / sectorSize;
+
+        while (sectors > 0 && !err) {
+            uint32_t chunk = sectors;
+            if (ide_devices[drive].Type == IDE_ATA) {
+                if (chunk > IDE_PIO_MAX_SECTORS) chunk = IDE_PIO_MAX_SECTORS;
+            } else if (chunk > 255) {
+                chunk = 255;
+            }
+            if (ide_devices[drive].Type == IDE_ATA) {
+                err = ide_ata_access(drive, req->write ? ATA_WRITE : ATA_READ, lba, chunk, buf);
+            } else if (req->write) {
+                err = 4;
+            } else {
+                err = ide_atapi_read(drive, lba, chunk, buf);
+            }
+
+            lba += chunk;
+            buf += chunk * sectorSize;
+            sectors -= chunk;
+        }
+    }
+
+    if (err) {
+        ide_print_error(drive, err);
+    }
+    return err;
+}
+
+/*
+ * ATA drives that can do it get bus master
+ * DMA: Submit starts it and returns, and done
+ * gets called from the IRQ (or from Wait, if
+ * we're polling). Everything else is PIO, so
+ * the whole request is done by the time Submit
+ * returns, and done gets called before that.
+*/
+bool GenericIDEController::Submit(uint8_t drive, BlockRequest* req) {
     if (drive > 3 || ide_devices[drive].Reserved == 0) {
         _ds->Println("[IDE] Drive Not Found");
+        req->status = BLOCK_ERROR;
         return false;
     }
 
-    if ((lba >= ide_devices[drive].Size) && ide_devices[drive].Type == IDE_ATA) {
+    if (ide_devices[drive].Type == IDE_ATA && req->lba + req->count > ide_devices[drive].Size) {
         _ds->Println("[IDE] Out of bounds");
+        req->status = BLOCK_ERROR;
         return false;
     }
 
-    unsigned char err = 0;
-    if (ide_devices[drive].Type == IDE_ATA) {
-        err = ide_ata_access(drive, ATA_WRITE, lba, 1, buffer);
-    } else if (ide_devices[drive].Type == IDE_ATAPI) {
-        err = 4;
+    uint8_t channel = ide_devices[drive].Channel;
+    WaitChannel(channel);
+
+    req->status = BLOCK_PENDING;
+
+    if (req->count && DMAUsable(drive, req)) {
+        IDEChannelDMA& d = dma[channel];
+        uint64_t flags = IDELock();
+        d.req = req;
+        d.drive = drive;
+        d.lba = req->lba;
+        d.end = req->lba + req->count;
+        d.seg = 0;
+        d.segOff = 0;
+        bool started = StartDMA(channel);
+        if (!started) {
+            d.req = nullptr;
+        }
+        IDEUnlock(flags);
+
+        if (started) {
+            return true;
+        }
+    }
+
+    unsigned char err = TransferPIO(drive, req);
+    req->status = err ? BLOCK_ERROR : BLOCK_OK;
+    if (req->done) {
+        req->done(req);
     }
+    return true;
+}
 
-    ide_print_error(drive, err);
+bool GenericIDEController::Wait(uint8_t drive, BlockRequest* req) {
+    uint8_t channel = ide_devices[drive].Channel;
+    while (true) {
+        uint64_t flags = IDELock();
+        if (req->status != BLOCK_PENDING) {
+            IDEUnlock(flags);
+            return req->status == BLOCK_OK;
+        }
+        WaitStep(channel, flags);
+    }
 }
 
 uint64_t GenericIDEController::SectorCount(uint8_t drive) const {
@@ -39,6 +39,11 @@ enum ATA_Commands {
     ATA_CMD_WRITE_PIO_EXT = 0x34,
     ATA_CMD_WRITE_DMA = 0xCA,
     ATA_CMD_WRITE_DMA_EXT = 0x35,
+    ATA_CMD_READ_MULTIPLE = 0xC4,
+    ATA_CMD_READ_MULTIPLE_EXT = 0x29,
+    ATA_CMD_WRITE_MULTIPLE = 0xC5,
+    ATA_CMD_WRITE_MULTIPLE_EXT = 0x39,
+    ATA_CMD_SET_MULTIPLE = 0xC6,
     ATA_CMD_CACHE_FLUSH = 0xE7,
     ATA_CMD_CACHE_FLUSH_EXT = 0xEA,
     ATA_CMD_PACKET = 0xA0,
@@ -58,8 +63,10 @@ enum ATA_IDENT {
     ATA_IDENT_SECTORS = 12,
     ATA_IDENT_SERIAL = 20,
     ATA_IDENT_MODEL = 54,
+    ATA_IDENT_MAX_MULTIPLE = 94,
     ATA_IDENT_CAPABILITIES = 98,
     ATA_IDENT_FIELDVALID = 106,
+    ATA_IDENT_MULTIPLE = 118,
     ATA_IDENT_MAX_LBA = 120,
     ATA_IDENT_COMMANDSETS = 164,
     ATA_IDENT_MAX_LBA_EXT = 200
@@ -105,6 +112,91 @@ enum ATA_Direction {
     ATA_WRITE = 0x01
 };
 
+/*
+ * The bus master registers, from bmide (the
+ * secondary channel's start 8 bytes in).
+*/
+enum BMIDE_Registers {
+    BMIDE_REG_COMMAND = 0x00,
+    BMIDE_REG_STATUS = 0x02,
+    BMIDE_REG_PRDT = 0x04
+};
+
+enum BMIDE_Command {
+    BMIDE_CMD_START = 0x01,
+    BMIDE_CMD_READ = 0x08   // The device writes to memory
+};
+
+enum BMIDE_Status {
+    BMIDE_SR_ACTIVE = 0x01,
+    BMIDE_SR_ERR = 0x02,
+    BMIDE_SR_IRQ = 0x04
+};
+
+/*
+ * One page of PRD entries per channel. An
+ * entry can't cross a 64KB boundary and moves
+ * 64KB at most (a size of 0 means 64KB), and
+ * the last one has IDE_PRD_EOT set.
+ *
+ * One DMA command moves at most
+ * IDE_DMA_MAX_SECTORS with READ/WRITE DMA EXT,
+ * or IDE_DMA_MAX_SECTORS28 on drives that
+ * don't do LBA48. Bigger requests get sent
+ * out a piece at a time from the IRQ.
+*/
+#define IDE_PRD_ENTRIES         512
+#define IDE_PRD_EOT             0x8000
+#define IDE_DMA_MAX_SECTORS     0xFFFF
+#define IDE_DMA_MAX_SECTORS28   256
+
+/*
+ * A PIO command moves at most IDE_PIO_MAX_SECTORS
+ * (a sector count of 0 means 256, so that's
+ * the most the 28 bit commands can do), and
+ * IDE_MAX_MULTIPLE is the biggest DRQ block
+ * we ask for with SET MULTIPLE MODE.
+*/
+#define IDE_PIO_MAX_SECTORS     256
+#define IDE_MAX_MULTIPLE        128
+
+/*
+ * How long WaitStep sleeps in hlt at most
+ * before it polls the channel anyway.
+*/
+#define IDE_WAKEUP_MS           10
+
+struct IDEPRD {
+    uint32_t phys;
+    uint16_t bytes;
+    uint16_t flags;
+} __attribute__((packed));
+
+class GenericIDEController;
+
+/*
+ * The DMA request a channel is working on,
+ * if any. lba/seg/segOff say where the next
+ * piece starts, and `chunk` is how many
+ * sectors the one in flight moves.
+*/
+struct IDEChannelDMA {
+    GenericIDEController* ctrl;
+    uint8_t channel;
+    IDEPRD* prdt;
+    uint64_t prdtPhys;
+    uint8_t vector;
+    volatile bool irqWorking;
+
+    BlockRequest* volatile req;
+    uint8_t drive;
+    uint64_t lba;
+    uint64_t end;
+    size_t seg;
+    uint32_t segOff;
+    uint32_t chunk;
+};
+
 struct IDEChannelRegisters {
    unsigned short base;  // I/O Base.
    unsigned short ctrl;  // Control Base
@@ -122,6 +214,8 @@ struct ide_device {
    unsigned int   CommandSets; // Command Sets Supported.
    unsigned int   Size;        // Size in Sectors.
    unsigned char  Model[41];   // Model in string.
+   unsigned char  DMA;         // 1 if we use bus master DMA for it.
+   unsigned short Multiple;    // Sectors per DRQ block for READ/WRITE MULTIPLE, 0 if not set.
 };
 
 class GenericIDEControllerFactory : public BlockControllerFactory {
@@ -136,6 +230,10 @@ public:
     virtual void Init(DriverServices& ds, DeviceKey& devKey) override;
     virtual bool ReadSector(uint8_t drive, uint64_t lba, void* buffer) override;
     virtual bool WriteSector(uint8_t drive, uint64_t lba, void* buffer) override;
+    virtual bool ReadSectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer) override;
+    virtual bool WriteSectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer) override;
+    virtual bool Submit(uint8_t drive, BlockRequest* req) override;
+    virtual bool Wait(uint8_t drive, BlockRequest* req) override;
 
     virtual uint64_t SectorCount(uint8_t drive) const override;
     virtual uint32_t SectorSize(uint8_t drive) const override;
@@ -152,11 +250,26 @@ private:
     void ide_read_buffer(uint8_t channel, uint8_t reg, void* buffer, uint32_t quads);
     unsigned char ide_polling(unsigned char channel, unsigned int advanced_check);
     unsigned char ide_print_error(uint8_t drive, unsigned char err);
-    unsigned char ide_ata_access(uint8_t drive, unsigned char direction, unsigned int lba, unsigned char numsects, void* buffer);
+    unsigned char ide_ata_access(uint8_t drive, unsigned char direction, uint64_t lba, uint32_t numsects, void* buffer);
     unsigned char ide_atapi_read(uint8_t drive, unsigned int lba, unsigned char numsects, void* buffer);
 
     void ide_irq();
-    void ide_wait_irq();
+    void ide_wait_irq(uint8_t channel);
+
+    void SetupMultiple(uint8_t drive, unsigned short max);
+    void SetupIRQs();
+    void SetupDMA();
+    bool SetupChannelIRQ(uint8_t channel);
+    unsigned char TransferPIO(uint8_t drive, BlockRequest* req);
+    bool DMAUsable(uint8_t drive, BlockRequest* req);
+    bool StartDMA(uint8_t channel);
+    bool FinishDMA(uint8_t channel);
+    void Poll(uint8_t channel);
+    void WaitStep(uint8_t channel, uint64_t flags);
+    void WaitChannel(uint8_t channel);
+public:
+    bool HandleInterrupt(uint8_t channel);
+private:
 
     DriverServices* _ds = nullptr;
     DeviceKey devKey;
@@ -166,5 +279,6 @@ private:
     volatile unsigned char ide_irq_invoked;
     unsigned char atapi_packet[12] = {0xA8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
     IDEChannelRegisters channels[2];
+    IDEChannelDMA dma[2];
     ide_device ide_devices[4];
 };
\ No newline at end of file
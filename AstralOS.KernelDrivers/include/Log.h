@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <stdarg.h>
+
+enum LogLevel {
+    LOG_DEBUG = 0,
+    LOG_INFO = 1,
+    LOG_WARN = 2,
+    LOG_ERROR = 3
+};
+
+enum LogSink {
+    LOG_SINK_CONSOLE = 0,
+    LOG_SINK_SERIAL = 1,
+    LOG_SINK_COUNT = 2
+};
+
+/*
+ * One line in the kernel log. They are all
+ * the same size, so the ring is just an
+ * array of them. Longer lines get cut off.
+ *
+ * seq is 0 while someone is writing the
+ * record, and the record's position + 1
+ * once it's done.
+*/
+struct LogRecord {
+    volatile uint64_t seq;
+    uint64_t tsc;
+    uint8_t level;
+    char text[111];
+} __attribute__((aligned(64)));
+
+static_assert(sizeof(LogRecord) == 128, "LogRecord should be 2 cache lines");
+
+/*
+ * The kernel log (what Linux calls dmesg).
+ *
+ * Logging only formats the line into the next
+ * record in a ring, which takes a few hundred
+ * cycles and doesn't lock anything. Getting it
+ * onto the screen and the serial port happens
+ * later, in Render, which the timer tick and
+ * the shell call. Errors get rendered right
+ * away, since those are what you need to see
+ * if the next thing we do crashes.
+ *
+ * Every sink has its own level, so you can send
+ * LOG_DEBUG to serial and keep the screen clean.
+ *
+ * The ring keeps the last LogRingSize lines,
+ * and `dmesg` in the shell dumps all of them.
+*/
+class KernelLog {
+public:
+    KernelLog();
+
+    void Write(LogLevel level, const char* fmt, va_list args);
+    void Render();
+    void Dump();
+
+    void SetSinkLevel(LogSink sink, LogLevel level);
+    void SetTSCPerMs(uint64_t ticks);
+private:
+    void Emit(const LogRecord& rec, bool force);
+    void FormatLine(const LogRecord& rec, char* buf, size_t size);
+
+    volatile uint64_t head = 0;
+    uint64_t rendered = 0;
+    uint64_t lost = 0;
+    volatile bool rendering = false;
+
+    uint64_t bootTSC = 0;
+    uint64_t tscPerMs = 0;
+    LogLevel sinkLevels[LOG_SINK_COUNT];
+};
+
+void klog(LogLevel level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));